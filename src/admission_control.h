@@ -0,0 +1,54 @@
+// CoDel-style admission control for the `-p` server: under persistent overload, reject the requests that have queued
+// for too long early, rather than evaluate them late, for clients that have likely given up on them by then.
+//
+// This is CoDel as adapted from network queues to server queues. The queueing delay of a request is how long it has
+// waited from when the kernel received it until its handling starts, see `ThreadPerCoreConfig::receive_timestamps`.
+// A queue that is good at times is fine, as a burst drains in time: the queue only counts as overloaded for an interval
+// if even the least delayed request of the previous interval has queued for longer than the target. Then, the requests
+// that have queued for longer than the target are shed; otherwise, only those that have queued for a whole interval.
+// Shedding is cheap, so the queue drains fast, its delay drops back under the target, and admission resumes.
+//
+// One `CoDelAdmission` per event loop, as each loop is a queue of its own; it is not thread-safe.
+
+#ifndef SLEIPNIR_ADMISSION_CONTROL_H
+#define SLEIPNIR_ADMISSION_CONTROL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+class CoDelAdmission final {
+ private:
+  constexpr static uint64_t kNone = std::numeric_limits<uint64_t>::max();
+
+  uint64_t const target_ns_;
+  uint64_t const interval_ns_;
+  uint64_t interval_end_ns_ = 0u;
+  uint64_t min_delay_ns_ = kNone;  // Over the current interval.
+  bool overloaded_ = false;  // As of the previous interval.
+
+ public:
+  CoDelAdmission(uint64_t target_ns, uint64_t interval_ns) : target_ns_(target_ns), interval_ns_(interval_ns) {}
+
+  // Whether to handle the request received at `received_ns` and about to be handled at `started_ns`, or to shed it.
+  // The requests with no timestamps, zeros, are always admitted. As the clock may step back, the delays are clamped.
+  bool Admit(uint64_t received_ns, uint64_t started_ns) {
+    if (!received_ns) {
+      return true;
+    }
+    uint64_t const delay_ns = started_ns > received_ns ? started_ns - received_ns : 0u;
+    if (started_ns >= interval_end_ns_) {
+      // A loop that had nothing to handle for a whole interval since has no queue left, whatever it had before.
+      bool const idle = started_ns - interval_end_ns_ >= interval_ns_;
+      overloaded_ = !idle && min_delay_ns_ != kNone && min_delay_ns_ > target_ns_;
+      min_delay_ns_ = kNone;
+      interval_end_ns_ = started_ns + interval_ns_;
+    }
+    min_delay_ns_ = std::min(min_delay_ns_, delay_ns);
+    return delay_ns <= (overloaded_ ? target_ns_ : interval_ns_);
+  }
+
+  bool Overloaded() const { return overloaded_; }
+};
+
+#endif  // SLEIPNIR_ADMISSION_CONTROL_H
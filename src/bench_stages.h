@@ -0,0 +1,77 @@
+// In-process, per-stage timing of a server variant: parse, evaluate, and serialize, each over the whole corpus.
+// Every binary supports `--queries queries.txt --stages_json out.json`, which `bench_suite` runs and collects.
+
+#ifndef SLEIPNIR_BENCH_STAGES_H
+#define SLEIPNIR_BENCH_STAGES_H
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "current/typesystem/serialization/json.h"
+
+#include "mmap_lines.h"
+
+CURRENT_STRUCT(BenchStages) {
+  CURRENT_FIELD(queries, uint64_t, 0u);
+  CURRENT_FIELD(parse_us, double, 0.0);
+  CURRENT_FIELD(eval_us, double, 0.0);
+  CURRENT_FIELD(serialize_us, double, 0.0);
+};
+
+// Runs `parse(std::string const& line)` over all the lines of `queries_file`, then `eval(parsed)` over all the parsed
+// inputs, then `serialize(result)` over all the results, and returns the mean time per query of each stage.
+template <class PARSE, class EVAL, class SERIALIZE>
+BenchStages MeasureBenchStages(std::string const& queries_file, PARSE&& parse, EVAL&& eval, SERIALIZE&& serialize) {
+  std::vector<std::string> lines;
+  {
+    MMappedFile const file(queries_file);
+    LinesCursor cursor(file.Contents());
+    std::string_view line;
+    while (cursor.Next(line)) {
+      lines.emplace_back(line);
+    }
+  }
+  using parsed_t = std::decay_t<decltype(parse(lines.front()))>;
+  using result_t = std::decay_t<decltype(eval(std::declval<parsed_t const&>()))>;
+  std::vector<parsed_t> parsed;
+  std::vector<result_t> results;
+  std::vector<std::string> responses;
+  parsed.reserve(lines.size());
+  results.reserve(lines.size());
+  responses.reserve(lines.size());
+
+  auto const now = []() { return std::chrono::steady_clock::now(); };
+  auto const t0 = now();
+  for (std::string const& line : lines) {
+    parsed.push_back(parse(line));
+  }
+  auto const t1 = now();
+  for (parsed_t const& input : parsed) {
+    results.push_back(eval(input));
+  }
+  auto const t2 = now();
+  for (result_t const& result : results) {
+    responses.push_back(serialize(result));
+  }
+  auto const t3 = now();
+
+  BenchStages stages;
+  stages.queries = lines.size();
+  if (!lines.empty()) {
+    auto const us = [&](std::chrono::steady_clock::duration d) {
+      return std::chrono::duration<double, std::micro>(d).count() / lines.size();
+    };
+    stages.parse_us = us(t1 - t0);
+    stages.eval_us = us(t2 - t1);
+    stages.serialize_us = us(t3 - t2);
+  }
+  return stages;
+}
+
+inline void WriteBenchStages(std::string const& filename, BenchStages const& stages) {
+  std::ofstream(filename) << JSON(stages) << std::endl;
+}
+
+#endif  // SLEIPNIR_BENCH_STAGES_H
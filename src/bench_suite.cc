@@ -0,0 +1,171 @@
+// g++ -O3 -DNDEBUG -pthread -std=c++17 bench_suite.cc -o bench_suite
+//
+// Runs the five server variants side by side, and attributes the time per request to its stages.
+//
+// Each variant is first run in-process, as `$VARIANT --queries ... --stages_json ...`, to time parsing, evaluation and
+// serialization separately. Then it is started as an HTTP server and loaded over loopback: over one connection to get
+// the round-trip latency, whose excess over the in-process stages is attributed to HTTP, and over many connections
+// to get the throughput. The results go into a JSON file, and can be compared against the one from another commit.
+
+#include <cstdio>
+#include <iostream>
+#include <map>
+
+#include <signal.h>
+
+#include "current/bricks/dflags/dflags.h"
+#include "current/bricks/file/file.h"
+#include "current/blocks/xterm/vt100.h"
+#include "current/typesystem/serialization/json.h"
+
+#include "bench_stages.h"
+#include "http_load.h"
+#include "server_process.h"
+
+using namespace current::vt100;
+
+DEFINE_string(variants,
+              "dummy_http,manual_policy_norun_impl,manual_policy_impl,transpiled,transpiled_strongly_typed",
+              "The comma-separated binaries to benchmark.");
+DEFINE_string(bin_dir, ".", "The directory with the binaries to benchmark.");
+DEFINE_string(queries, "queries.txt", "The corpus of `{\"input\":{...}}` queries, one per line.");
+DEFINE_uint16(port, 8181u, "The port to start the servers on, one at a time.");
+DEFINE_uint32(connections, 64u, "The number of keep-alive connections for the throughput measurement.");
+DEFINE_uint32(threads, 1u, "The number of load generator threads for the throughput measurement.");
+DEFINE_double(warmup, 1.0, "The number of seconds of each loopback run to not measure.");
+DEFINE_double(duration, 5.0, "The number of seconds of each loopback run to measure.");
+DEFINE_string(json_output, "bench_suite.json", "The file to write the results into.");
+DEFINE_string(baseline, "", "Set to the `--json_output` of another run to flag the regressions against it.");
+DEFINE_double(regression_threshold, 0.1, "The relative slowdown to consider a regression.");
+
+CURRENT_STRUCT(BenchSuiteVariant) {
+  CURRENT_FIELD(name, std::string);
+  CURRENT_FIELD(queries, uint64_t, 0u);
+  CURRENT_FIELD(parse_us, double, 0.0);
+  CURRENT_FIELD(eval_us, double, 0.0);
+  CURRENT_FIELD(serialize_us, double, 0.0);
+  CURRENT_FIELD(in_process_us, double, 0.0);
+  CURRENT_FIELD(loopback_us, double, 0.0);
+  CURRENT_FIELD(http_us, double, 0.0);
+  CURRENT_FIELD(throughput_rps, double, 0.0);
+};
+
+CURRENT_STRUCT(BenchSuiteReport) {
+  CURRENT_FIELD(queries_file, std::string);
+  CURRENT_FIELD(variants, std::vector<BenchSuiteVariant>);
+};
+
+BenchSuiteVariant RunVariant(std::string const& name, std::vector<std::string> const& requests) {
+  BenchSuiteVariant result;
+  result.name = name;
+  std::string const binary = FLAGS_bin_dir + '/' + name;
+
+  std::string const stages_file = "/tmp/sleipnir_bench_suite_" + name + ".json";
+  if (WaitFor(Spawn({binary, "--queries", FLAGS_queries, "--stages_json", stages_file})) != 0) {
+    throw std::runtime_error("`" + binary + " --stages_json` failed.");
+  }
+  BenchStages const stages = ParseJSON<BenchStages>(current::FileSystem::ReadFileAsString(stages_file));
+  current::FileSystem::RmFile(stages_file);
+  result.queries = stages.queries;
+  result.parse_us = stages.parse_us;
+  result.eval_us = stages.eval_us;
+  result.serialize_us = stages.serialize_us;
+  result.in_process_us = stages.parse_us + stages.eval_us + stages.serialize_us;
+
+  // All the variants accept `-p $PORT -d`.
+  // The transpiled ones only serve HTTP with `-p`, and only keep serving it with `-d`.
+  pid_t const server = Spawn({binary, "-p", current::strings::ToString(FLAGS_port), "-d"});
+  if (!WaitForPort(FLAGS_port, server)) {
+    ::kill(server, SIGKILL);
+    WaitFor(server);
+    throw std::runtime_error("`" + binary + "` did not start listening on port " +
+                             current::strings::ToString(FLAGS_port) + '.');
+  }
+  HTTPLoadConfig config;
+  config.port = FLAGS_port;
+  config.warmup_seconds = FLAGS_warmup;
+  config.duration_seconds = FLAGS_duration;
+  config.connections = 1u;
+  HTTPLoadResult const latency = RunHTTPLoad(config, requests);
+  config.connections = FLAGS_connections;
+  config.threads = FLAGS_threads;
+  HTTPLoadResult const throughput = RunHTTPLoad(config, requests);
+  ::kill(server, SIGTERM);
+  WaitFor(server);
+
+  result.loopback_us = latency.latency_ns.Mean() * 1e-3;
+  result.http_us = std::max(0.0, result.loopback_us - result.in_process_us);
+  result.throughput_rps = throughput.achieved_rate;
+  return result;
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  std::vector<std::string> requests;
+  {
+    MMappedFile const file(FLAGS_queries);
+    LinesCursor lines(file.Contents());
+    std::string_view line;
+    while (lines.Next(line)) {
+      requests.push_back(BuildHTTPPostRequest("/v1/data/rbac/allow", line));
+    }
+  }
+
+  BenchSuiteReport report;
+  report.queries_file = FLAGS_queries;
+  std::cout << "                variant    parse     eval serialize in-process loopback     http      req/s"
+            << std::endl;
+  for (std::string const& name : current::strings::Split(FLAGS_variants, ',')) {
+    BenchSuiteVariant const v = RunVariant(name, requests);
+    report.variants.push_back(v);
+    auto const f = [](double x) { return current::strings::RoundDoubleToString(x, 3); };
+    std::printf("%23s %8s %8s %9s %10s %8s %8s %10s\n",
+                name.c_str(),
+                f(v.parse_us).c_str(),
+                f(v.eval_us).c_str(),
+                f(v.serialize_us).c_str(),
+                f(v.in_process_us).c_str(),
+                f(v.loopback_us).c_str(),
+                f(v.http_us).c_str(),
+                current::strings::RoundDoubleToString(v.throughput_rps, 0).c_str());
+    std::fflush(stdout);
+  }
+  std::cout << "The times are in microseconds per request; `http` is the loopback round trip over one connection "
+               "minus the in-process stages."
+            << std::endl;
+  current::FileSystem::WriteStringToFile(JSON(report), FLAGS_json_output);
+
+  if (!FLAGS_baseline.empty()) {
+    BenchSuiteReport const baseline = ParseJSON<BenchSuiteReport>(current::FileSystem::ReadFileAsString(FLAGS_baseline));
+    std::map<std::string, BenchSuiteVariant> before;
+    for (BenchSuiteVariant const& v : baseline.variants) {
+      before[v.name] = v;
+    }
+    bool regressed = false;
+    double const k = 1.0 + FLAGS_regression_threshold;
+    for (BenchSuiteVariant const& after : report.variants) {
+      auto const cit = before.find(after.name);
+      if (cit == before.end()) {
+        continue;
+      }
+      BenchSuiteVariant const& was = cit->second;
+      auto const check = [&](char const* what, double old_value, double new_value, bool lower_is_better) {
+        if (lower_is_better ? new_value > old_value * k : new_value * k < old_value) {
+          regressed = true;
+          std::cout << red << bold << "REGRESSION" << reset << ": " << after.name << ' ' << what << ": " << old_value
+                    << " -> " << new_value << std::endl;
+        }
+      };
+      check("parse_us", was.parse_us, after.parse_us, true);
+      check("eval_us", was.eval_us, after.eval_us, true);
+      check("serialize_us", was.serialize_us, after.serialize_us, true);
+      check("loopback_us", was.loopback_us, after.loopback_us, true);
+      check("throughput_rps", was.throughput_rps, after.throughput_rps, false);
+    }
+    if (regressed) {
+      return 1;
+    }
+    std::cout << "No regressions against " << cyan << FLAGS_baseline << reset << '.' << std::endl;
+  }
+}
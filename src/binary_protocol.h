@@ -0,0 +1,509 @@
+// A compact, length-prefixed binary protocol for high-rate internal callers, served alongside JSON over HTTP.
+//
+// A connection starts with the eight bytes of `kBinaryProtocolMagic`, sent by the client. Then each request is a
+// `uint32_t` payload length followed by the payload, which is the policy input as one typed value, and each response,
+// in the order of the requests, is one `BinaryProtocolDecision` byte. Thus, clients can pipeline freely, and for
+// boolean rules the whole response is that one byte. A non-boolean result is followed by its length and its JSON.
+//
+// A value is a `BinaryProtocolTag` byte, then, for numbers, a `double`; for strings, a `uint32_t` length and the bytes;
+// for arrays, a `uint32_t` count and the elements; for objects, a `uint32_t` count and the name-value pairs, each name
+// being a length-prefixed string. A `CURRENT_STRUCT` input may also be sent as a `Struct`: a `uint32_t` count and the
+// values of its fields in their declaration order, without names, which is what makes the protocol compact.
+// For `transpiled_strongly_typed.cc` the input is `Struct[Struct[user, action, object]]`. All integers are little-endian.
+// Untyped values nested deeper than `kBinaryProtocolMaxDepth` are answered with `Invalid`, as are malformed ones.
+
+#ifndef SLEIPNIR_BINARY_PROTOCOL_H
+#define SLEIPNIR_BINARY_PROTOCOL_H
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "current/blocks/json/json.h"
+#include "current/typesystem/reflection/reflection.h"
+
+#include "unix_socket_server.h"
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The binary protocol is little-endian.");
+
+constexpr static char kBinaryProtocolMagic[8] = {'S', 'L', 'P', 'B', 'I', 'N', '1', '\0'};
+constexpr static uint32_t kBinaryProtocolMaxPayload = 1u << 20;
+constexpr static uint32_t kBinaryProtocolMaxDepth = 64u;
+
+enum class BinaryProtocolTag : uint8_t {
+  Null = 0,
+  False = 1,
+  True = 2,
+  Number = 3,
+  String = 4,
+  Array = 5,
+  Object = 6,
+  Struct = 7
+};
+
+enum class BinaryProtocolDecision : uint8_t { False = 0, True = 1, Invalid = 2, JSON = 3 };
+
+class BinaryProtocolWriter final {
+ private:
+  std::string& output_;
+
+ public:
+  explicit BinaryProtocolWriter(std::string& output) : output_(output) {}
+
+  template <typename T>
+  void WritePOD(T value) {
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    output_.append(reinterpret_cast<char const*>(&value), sizeof(T));
+  }
+
+  void WriteString(std::string_view s) {
+    WritePOD(static_cast<uint32_t>(s.length()));
+    output_.append(s.data(), s.length());
+  }
+};
+
+class BinaryProtocolReader final {
+ private:
+  char const* p_;
+  char const* const end_;
+
+ public:
+  explicit BinaryProtocolReader(std::string_view payload) : p_(payload.data()), end_(payload.data() + payload.length()) {}
+
+  template <typename T>
+  T ReadPOD() {
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    if (static_cast<size_t>(end_ - p_) < sizeof(T)) {
+      throw std::runtime_error("Truncated binary request.");
+    }
+    T value;
+    std::memcpy(&value, p_, sizeof(T));
+    p_ += sizeof(T);
+    return value;
+  }
+
+  std::string_view ReadString() {
+    uint32_t const length = ReadPOD<uint32_t>();
+    if (static_cast<size_t>(end_ - p_) < length) {
+      throw std::runtime_error("Truncated binary request.");
+    }
+    std::string_view const s(p_, length);
+    p_ += length;
+    return s;
+  }
+
+  BinaryProtocolTag ReadTag(BinaryProtocolTag expected) {
+    BinaryProtocolTag const tag = ReadPOD<BinaryProtocolTag>();
+    if (tag != expected) {
+      throw std::runtime_error("Unexpected type in the binary request.");
+    }
+    return tag;
+  }
+
+  bool AtEnd() const { return p_ == end_; }
+};
+
+// The codec of `CURRENT_STRUCT`-s: a `Struct` of all fields, in order, or an `Object`, with the fields by name.
+template <typename T, typename ENABLE = void>
+struct BinaryProtocolCodec final {
+  static void Write(BinaryProtocolWriter& w, T const& value) {
+    uint32_t count = 0u;
+    current::reflection::VisitAllFields<T, current::reflection::FieldNameAndImmutableValue>::WithObject(
+        value, [&count](auto const&, auto const&) { ++count; });
+    w.WritePOD(BinaryProtocolTag::Struct);
+    w.WritePOD(count);
+    current::reflection::VisitAllFields<T, current::reflection::FieldNameAndImmutableValue>::WithObject(
+        value,
+        [&w](auto const&, auto const& field) { BinaryProtocolCodec<std::decay_t<decltype(field)>>::Write(w, field); });
+  }
+  static void Read(BinaryProtocolReader& r, T& value) {
+    BinaryProtocolTag const tag = r.ReadPOD<BinaryProtocolTag>();
+    uint32_t const count = r.ReadPOD<uint32_t>();
+    if (tag == BinaryProtocolTag::Struct) {
+      // The fields not sent keep their default values.
+      uint32_t i = 0u;
+      current::reflection::VisitAllFields<T, current::reflection::FieldNameAndMutableValue>::WithObject(
+          value, [&r, &i, count](auto const&, auto& field) {
+            if (i < count) {
+              BinaryProtocolCodec<std::decay_t<decltype(field)>>::Read(r, field);
+              ++i;
+            }
+          });
+      if (i < count) {
+        throw std::runtime_error("Too many fields in the binary request.");
+      }
+    } else if (tag == BinaryProtocolTag::Object) {
+      for (uint32_t i = 0u; i < count; ++i) {
+        std::string_view const name = r.ReadString();
+        bool found = false;
+        current::reflection::VisitAllFields<T, current::reflection::FieldNameAndMutableValue>::WithObject(
+            value, [&r, &found, name](auto const& field_name, auto& field) {
+              if (!found && std::string_view(field_name) == name) {
+                BinaryProtocolCodec<std::decay_t<decltype(field)>>::Read(r, field);
+                found = true;
+              }
+            });
+        if (!found) {
+          throw std::runtime_error("Unknown field in the binary request.");
+        }
+      }
+    } else {
+      throw std::runtime_error("Unexpected type in the binary request.");
+    }
+  }
+};
+
+template <>
+struct BinaryProtocolCodec<std::string> final {
+  static void Write(BinaryProtocolWriter& w, std::string const& value) {
+    w.WritePOD(BinaryProtocolTag::String);
+    w.WriteString(value);
+  }
+  static void Read(BinaryProtocolReader& r, std::string& value) {
+    r.ReadTag(BinaryProtocolTag::String);
+    std::string_view const s = r.ReadString();
+    value.assign(s.data(), s.length());
+  }
+};
+
+template <>
+struct BinaryProtocolCodec<bool> final {
+  static void Write(BinaryProtocolWriter& w, bool value) {
+    w.WritePOD(value ? BinaryProtocolTag::True : BinaryProtocolTag::False);
+  }
+  static void Read(BinaryProtocolReader& r, bool& value) {
+    BinaryProtocolTag const tag = r.ReadPOD<BinaryProtocolTag>();
+    if (tag != BinaryProtocolTag::False && tag != BinaryProtocolTag::True) {
+      throw std::runtime_error("Unexpected type in the binary request.");
+    }
+    value = tag == BinaryProtocolTag::True;
+  }
+};
+
+template <typename T>
+struct BinaryProtocolCodec<T, std::enable_if_t<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>> final {
+  static void Write(BinaryProtocolWriter& w, T value) {
+    w.WritePOD(BinaryProtocolTag::Number);
+    w.WritePOD(static_cast<double>(value));
+  }
+  static void Read(BinaryProtocolReader& r, T& value) {
+    r.ReadTag(BinaryProtocolTag::Number);
+    value = static_cast<T>(r.ReadPOD<double>());
+  }
+};
+
+template <typename T>
+struct BinaryProtocolCodec<std::vector<T>> final {
+  static void Write(BinaryProtocolWriter& w, std::vector<T> const& value) {
+    w.WritePOD(BinaryProtocolTag::Array);
+    w.WritePOD(static_cast<uint32_t>(value.size()));
+    for (T const& e : value) {
+      BinaryProtocolCodec<T>::Write(w, e);
+    }
+  }
+  static void Read(BinaryProtocolReader& r, std::vector<T>& value) {
+    r.ReadTag(BinaryProtocolTag::Array);
+    uint32_t const n = r.ReadPOD<uint32_t>();
+    value.clear();
+    for (uint32_t i = 0u; i < n; ++i) {
+      value.emplace_back();
+      BinaryProtocolCodec<T>::Read(r, value.back());
+    }
+  }
+};
+
+// The codec of untyped inputs: a tagged tree, with named object fields. `Struct`-s are sent for `CURRENT_STRUCT`-s,
+// so here they are only written, from the fields of the objects in their order, by the clients that know the schema.
+template <>
+struct BinaryProtocolCodec<current::json::JSONValue> final {
+  static void Write(BinaryProtocolWriter& w, current::json::JSONValue const& value, bool positional = false) {
+    using namespace current::json;
+    if (Exists<JSONNumber>(value)) {
+      w.WritePOD(BinaryProtocolTag::Number);
+      w.WritePOD(static_cast<double>(Value<JSONNumber>(value).number));
+    } else if (Exists<JSONString>(value)) {
+      w.WritePOD(BinaryProtocolTag::String);
+      w.WriteString(Value<JSONString>(value).string);
+    } else if (Exists<JSONBoolean>(value)) {
+      w.WritePOD(Value<JSONBoolean>(value).boolean ? BinaryProtocolTag::True : BinaryProtocolTag::False);
+    } else if (Exists<JSONArray>(value)) {
+      JSONArray const& array = Value<JSONArray>(value);
+      w.WritePOD(BinaryProtocolTag::Array);
+      w.WritePOD(static_cast<uint32_t>(array.size()));
+      for (JSONValue const& e : array.elements) {
+        Write(w, e, positional);
+      }
+    } else if (Exists<JSONObject>(value)) {
+      JSONObject const& object = Value<JSONObject>(value);
+      w.WritePOD(positional ? BinaryProtocolTag::Struct : BinaryProtocolTag::Object);
+      w.WritePOD(static_cast<uint32_t>(object.keys.size()));
+      for (std::string const& key : object.keys) {
+        if (!positional) {
+          w.WriteString(key);
+        }
+        Write(w, object[key], positional);
+      }
+    } else {
+      w.WritePOD(BinaryProtocolTag::Null);
+    }
+  }
+
+  static void Read(BinaryProtocolReader& r, current::json::JSONValue& value, uint32_t depth = 0u) {
+    using namespace current::json;
+    if (depth >= kBinaryProtocolMaxDepth) {
+      throw std::runtime_error("Too deeply nested binary request.");
+    }
+    BinaryProtocolTag const tag = r.ReadPOD<BinaryProtocolTag>();
+    if (tag == BinaryProtocolTag::Null) {
+      value = JSONNull();
+    } else if (tag == BinaryProtocolTag::False || tag == BinaryProtocolTag::True) {
+      value = JSONBoolean(tag == BinaryProtocolTag::True);
+    } else if (tag == BinaryProtocolTag::Number) {
+      value = JSONNumber(r.ReadPOD<double>());
+    } else if (tag == BinaryProtocolTag::String) {
+      std::string_view const s = r.ReadString();
+      value = JSONString(std::string(s.data(), s.length()));
+    } else if (tag == BinaryProtocolTag::Array) {
+      uint32_t const n = r.ReadPOD<uint32_t>();
+      JSONArray array;
+      for (uint32_t i = 0u; i < n; ++i) {
+        JSONValue e;
+        Read(r, e, depth + 1u);
+        array.push_back(std::move(e));
+      }
+      value = std::move(array);
+    } else if (tag == BinaryProtocolTag::Object) {
+      uint32_t const n = r.ReadPOD<uint32_t>();
+      JSONObject object;
+      for (uint32_t i = 0u; i < n; ++i) {
+        std::string_view const key = r.ReadString();
+        JSONValue e;
+        Read(r, e, depth + 1u);
+        object.push_back(std::string(key.data(), key.length()), std::move(e));
+      }
+      value = std::move(object);
+    } else {
+      throw std::runtime_error("Unexpected type in the binary request.");
+    }
+  }
+};
+
+// Decodes the payload of one request, which must hold exactly one value.
+template <typename T>
+void DecodeBinaryRequest(std::string_view payload, T& value) {
+  BinaryProtocolReader reader(payload);
+  BinaryProtocolCodec<T>::Read(reader, value);
+  if (!reader.AtEnd()) {
+    throw std::runtime_error("Trailing bytes in the binary request.");
+  }
+}
+
+// Appends the length-prefixed request for `payload`, as written via `BinaryProtocolWriter`, to `output`.
+inline void AppendBinaryRequest(std::string& output, std::string_view payload) {
+  uint32_t const length = static_cast<uint32_t>(payload.length());
+  output.append(reinterpret_cast<char const*>(&length), sizeof(length));
+  output.append(payload.data(), payload.length());
+}
+
+inline void AppendBinaryResponse(std::string& output, current::json::JSONValue const& result) {
+  using namespace current::json;
+  if (Exists<JSONBoolean>(result)) {
+    output += static_cast<char>(Value<JSONBoolean>(result).boolean ? BinaryProtocolDecision::True
+                                                                   : BinaryProtocolDecision::False);
+  } else {
+    output += static_cast<char>(BinaryProtocolDecision::JSON);
+    BinaryProtocolWriter(output).WriteString(AsJSON(result));
+  }
+}
+
+// The client side of the response stream: `Feed()` the bytes as they arrive, and it returns the number of responses
+// completed by them, passing each to `f(decision, json)`, where `json` is only non-empty for `Decision::JSON`.
+class BinaryResponseStream final {
+ private:
+  std::string buffer_;
+
+ public:
+  template <class F>
+  size_t Feed(char const* data, size_t length, F&& f) {
+    buffer_.append(data, length);
+    size_t n = 0u;
+    size_t offset = 0u;
+    while (offset < buffer_.length()) {
+      auto const decision = static_cast<BinaryProtocolDecision>(buffer_[offset]);
+      if (decision != BinaryProtocolDecision::JSON) {
+        f(decision, std::string_view());
+        offset += 1u;
+      } else {
+        uint32_t json_length;
+        if (buffer_.length() - offset < 1u + sizeof(json_length)) {
+          break;
+        }
+        std::memcpy(&json_length, &buffer_[offset + 1u], sizeof(json_length));
+        if (buffer_.length() - offset < 1u + sizeof(json_length) + json_length) {
+          break;
+        }
+        f(decision, std::string_view(buffer_).substr(offset + 1u + sizeof(json_length), json_length));
+        offset += 1u + sizeof(json_length) + json_length;
+      }
+      ++n;
+    }
+    buffer_.erase(0u, offset);
+    return n;
+  }
+  size_t Feed(char const* data, size_t length) {
+    return Feed(data, length, [](BinaryProtocolDecision, std::string_view) {});
+  }
+};
+
+// The TCP listener of the binary protocol. As with `UnixSocketLineServer`, there is one detached thread per connection,
+// only the live ones tracked, and all the complete requests of each `read()` are handed to the handler at once, their
+// responses sent with one `write()`. A connection that does not start with `kBinaryProtocolMagic`, or sends an
+// oversized request, is closed. The protocol is for internal callers, so it listens on the loopback interface unless
+// told otherwise.
+class BinaryProtocolServer final {
+ public:
+  // Appends the responses to the request `payloads` to `output`, one per request.
+  using handler_t = std::function<void(std::vector<std::string_view> const& payloads, std::string& output)>;
+
+ private:
+  handler_t const handler_;
+  int listen_fd_;
+  std::mutex mutex_;
+  std::condition_variable all_closed_;
+  std::unordered_set<int> connections_;  // One per live connection thread.
+  std::thread acceptor_;
+
+  void Serve(int fd) {
+    std::string buffer;
+    std::string output;
+    std::vector<std::string_view> payloads;
+    std::vector<char> chunk(1u << 16);
+    bool handshake = false;
+    while (true) {
+      ssize_t const n = ::read(fd, chunk.data(), chunk.size());
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+      buffer.append(chunk.data(), static_cast<size_t>(n));
+      size_t offset = 0u;
+      if (!handshake) {
+        if (buffer.length() < sizeof(kBinaryProtocolMagic)) {
+          continue;
+        }
+        if (std::memcmp(buffer.data(), kBinaryProtocolMagic, sizeof(kBinaryProtocolMagic))) {
+          break;
+        }
+        handshake = true;
+        offset = sizeof(kBinaryProtocolMagic);
+      }
+      payloads.clear();
+      uint32_t length = 0u;
+      while (buffer.length() - offset >= sizeof(length)) {
+        std::memcpy(&length, &buffer[offset], sizeof(length));
+        if (length > kBinaryProtocolMaxPayload || buffer.length() - offset - sizeof(length) < length) {
+          break;
+        }
+        payloads.push_back(std::string_view(buffer).substr(offset + sizeof(length), length));
+        offset += sizeof(length) + length;
+      }
+      if (length > kBinaryProtocolMaxPayload) {
+        break;
+      }
+      if (!payloads.empty()) {
+        output.clear();
+        handler_(payloads, output);
+        if (!WriteAll(fd, output.data(), output.length())) {
+          break;
+        }
+      }
+      buffer.erase(0u, offset);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.erase(fd);
+    ::close(fd);
+    if (connections_.empty()) {
+      all_closed_.notify_all();
+    }
+  }
+
+ public:
+  BinaryProtocolServer(uint16_t port, handler_t handler, std::string const& bind_address = "127.0.0.1")
+      : handler_(std::move(handler)) {
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (::inet_pton(AF_INET, bind_address.c_str(), &address.sin_addr) != 1) {
+      throw std::invalid_argument("The binary protocol address `" + bind_address + "` is not an IPv4 address.");
+    }
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+      throw std::runtime_error("Can not create a TCP socket.");
+    }
+    int const one = 1;
+    ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) ||
+        ::listen(listen_fd_, SOMAXCONN)) {
+      ::close(listen_fd_);
+      throw std::runtime_error("Can not listen on port " + std::to_string(port) + ": " + std::strerror(errno) + '.');
+    }
+    acceptor_ = std::thread([this]() {
+      while (true) {
+        int const fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+          if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+          }
+          return;
+        }
+        int const nodelay = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections_.insert(fd);
+        std::thread([this, fd]() { Serve(fd); }).detach();
+      }
+    });
+  }
+
+  ~BinaryProtocolServer() {
+    ::shutdown(listen_fd_, SHUT_RDWR);
+    if (acceptor_.joinable()) {
+      acceptor_.join();
+    }
+    ::close(listen_fd_);
+    {
+      // The connection threads are detached, so this waits for the last one of them to be done with `this`.
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (int fd : connections_) {
+        ::shutdown(fd, SHUT_RDWR);
+      }
+      all_closed_.wait(lock, [this]() { return connections_.empty(); });
+    }
+  }
+
+  BinaryProtocolServer(BinaryProtocolServer const&) = delete;
+  BinaryProtocolServer& operator=(BinaryProtocolServer const&) = delete;
+
+  // Blocks for as long as the listener is up.
+  void Join() { acceptor_.join(); }
+};
+
+#endif  // SLEIPNIR_BINARY_PROTOCOL_H
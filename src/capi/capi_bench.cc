@@ -0,0 +1,131 @@
+// g++ -O3 -DNDEBUG -pthread -std=c++17 capi_bench.cc -L. -lsleipnir_policy -Wl,-rpath,. -o capi_bench
+//
+// The in-process benchmark of the C ABI of `sleipnir_policy.h`: the cost per call of each entry point, over the
+// `--queries` corpus. The typed inputs are extracted from the JSON queries before timing, as a caller that already has
+// the fields would. The first row, an empty call into the library, is the floor of the per-call overhead.
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "current/blocks/json/json.h"
+#include "current/bricks/dflags/dflags.h"
+
+#include "../mmap_lines.h"
+#include "sleipnir_policy.h"
+
+using namespace current::json;
+
+DEFINE_string(queries, "queries.txt", "The corpus of `{\"input\":{...}}` queries, one per line.");
+DEFINE_uint32(batch, 1000u, "The number of inputs per `sleipnir_policy_evaluate_batch()` call.");
+DEFINE_uint32(repeat, 3u, "The number of passes over the corpus per entry point, the fastest one reported.");
+
+struct TypedQuery final {
+  std::string user;
+  std::string action;
+  std::string object;
+};
+
+std::string StringField(JSONValue const& object, char const* name) {
+  JSONValue const& value = Value<JSONObject>(object)[name];
+  return Exists<JSONString>(value) ? Value<JSONString>(value).string : std::string();
+}
+
+// Runs `f()` over the corpus `--repeat` times, and reports the best nanoseconds per query and the number of `ALLOW`-s.
+template <class F>
+void Measure(char const* name, size_t n, F&& f) {
+  double best_ns = 0.0;
+  size_t allowed = 0u;
+  for (uint32_t r = 0u; r < std::max(FLAGS_repeat, 1u); ++r) {
+    auto const t0 = std::chrono::steady_clock::now();
+    allowed = f();
+    auto const t1 = std::chrono::steady_clock::now();
+    double const ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+    best_ns = r ? std::min(best_ns, ns) : ns;
+  }
+  std::printf("%26s %10.1f %10zu\n", name, best_ns, allowed);
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  if (sleipnir_abi_version() != SLEIPNIR_ABI_VERSION) {
+    std::cerr << "The library is of ABI version " << sleipnir_abi_version() << ", not " << SLEIPNIR_ABI_VERSION << '.'
+              << std::endl;
+    return 1;
+  }
+
+  std::vector<std::string> queries;
+  std::vector<TypedQuery> typed;
+  {
+    MMappedFile const file(FLAGS_queries);
+    LinesCursor lines(file.Contents());
+    std::string_view line;
+    while (lines.Next(line)) {
+      queries.emplace_back(line);
+      JSONValue const query = ParseJSONUniversally(queries.back());
+      JSONValue const& input = Value<JSONObject>(query)["input"];
+      typed.push_back(TypedQuery{StringField(input, "user"), StringField(input, "action"), StringField(input, "object")});
+    }
+  }
+  if (queries.empty()) {
+    std::cerr << "No queries in `" << FLAGS_queries << "`." << std::endl;
+    return 1;
+  }
+  std::vector<sleipnir_input> inputs;
+  for (TypedQuery const& q : typed) {
+    inputs.push_back(sleipnir_input{sleipnir_string{q.user.data(), q.user.length()},
+                                    sleipnir_string{q.action.data(), q.action.length()},
+                                    sleipnir_string{q.object.data(), q.object.length()}});
+  }
+
+  sleipnir_policy* const policy = sleipnir_policy_create(nullptr, 0u);
+  if (!policy) {
+    std::cerr << "Can not create the policy." << std::endl;
+    return 1;
+  }
+  size_t const n = queries.size();
+  // Warms up the policy, so that its one-time initialization is not timed.
+  sleipnir_policy_evaluate(policy, &inputs.front());
+
+  std::cout << "Over " << n << " queries:" << std::endl;
+  std::cout << "               entry point    ns/call    allowed" << std::endl;
+  Measure("sleipnir_abi_version", n, [n]() {
+    size_t sum = 0u;
+    for (size_t i = 0u; i < n; ++i) {
+      sum += static_cast<size_t>(sleipnir_abi_version() == 0);
+    }
+    return sum;
+  });
+  Measure("evaluate_json", n, [&]() {
+    size_t allowed = 0u;
+    for (std::string const& query : queries) {
+      allowed += sleipnir_policy_evaluate_json(policy, query.data(), query.length()) == SLEIPNIR_ALLOW;
+    }
+    return allowed;
+  });
+  Measure("evaluate", n, [&]() {
+    size_t allowed = 0u;
+    for (sleipnir_input const& input : inputs) {
+      allowed += sleipnir_policy_evaluate(policy, &input) == SLEIPNIR_ALLOW;
+    }
+    return allowed;
+  });
+  std::vector<int8_t> results(n);
+  std::string const batch_name = "evaluate_batch, " + std::to_string(FLAGS_batch) + " each";
+  Measure(batch_name.c_str(), n, [&]() {
+    size_t const batch = std::max(FLAGS_batch, 1u);
+    for (size_t begin = 0u; begin < n; begin += batch) {
+      sleipnir_policy_evaluate_batch(policy, &inputs[begin], std::min(batch, n - begin), &results[begin]);
+    }
+    size_t allowed = 0u;
+    for (int8_t const r : results) {
+      allowed += r == SLEIPNIR_ALLOW;
+    }
+    return allowed;
+  });
+
+  sleipnir_policy_destroy(policy);
+}
@@ -0,0 +1,245 @@
+// g++ -O3 -DNDEBUG -pthread -std=c++17 -fPIC -fvisibility=hidden -shared sleipnir_policy.cc -o libsleipnir_policy.so
+//
+// The in-process library of the transpiled policy, see `sleipnir_policy.h`. For a static library instead, build with
+// `-c sleipnir_policy.cc` and `ar rcs libsleipnir_policy.a sleipnir_policy.o`, and link it with `-pthread`.
+// The policy is `transpiled_strongly_typed.cc` verbatim, less its `main()`, in an anonymous namespace, so that none of
+// its symbols, nor those of the headers it includes, such as `WriteAll()`, clash with the host's when linked in.
+// Only `ToPolicyInput()` below depends on the schema of its input, and should follow it when the policy is regenerated.
+
+// The library has no command line. Its copies of the flags of the policy binary are `static` and keep their default
+// values, so that they neither clash with, nor register into, the flags of the host.
+#include "current/bricks/dflags/dflags.h"
+#undef DEFINE_bool
+#undef DEFINE_int32
+#undef DEFINE_uint16
+#undef DEFINE_uint32
+#undef DEFINE_uint64
+#undef DEFINE_double
+#undef DEFINE_string
+#define DEFINE_bool(name, value, description) [[maybe_unused]] static bool FLAGS_##name = value
+#define DEFINE_int32(name, value, description) [[maybe_unused]] static int32_t FLAGS_##name = value
+#define DEFINE_uint16(name, value, description) [[maybe_unused]] static uint16_t FLAGS_##name = value
+#define DEFINE_uint32(name, value, description) [[maybe_unused]] static uint32_t FLAGS_##name = value
+#define DEFINE_uint64(name, value, description) [[maybe_unused]] static uint64_t FLAGS_##name = value
+#define DEFINE_double(name, value, description) [[maybe_unused]] static double FLAGS_##name = value
+#define DEFINE_string(name, value, description) [[maybe_unused]] static std::string FLAGS_##name = value
+
+// Everything the policy includes from outside of this directory tree, so that only the policy and the headers of this
+// repository land in the namespace of the policy below.
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <linux/io_uring.h>
+#include <linux/net_tstamp.h>
+#include <linux/perf_event.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <new>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <thread>
+#include <time.h>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <x86intrin.h>
+#endif
+
+#include "current/blocks/http/api.h"
+#include "current/blocks/json/json.h"
+#include "current/blocks/xterm/progress.h"
+#include "current/blocks/xterm/vt100.h"
+#include "current/bricks/file/file.h"
+#include "current/bricks/strings/strings.h"
+#include "current/typesystem/reflection/reflection.h"
+#include "current/typesystem/serialization/json.h"
+
+#include "sleipnir_policy.h"
+
+namespace {
+
+// The policy overloads these for its own types, which would otherwise hide the global ones in here.
+using ::Exists;
+using ::Value;
+
+// Not all of the policy binary is used by the library.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#define SLEIPNIR_NO_MAIN
+#include "../transpiled_strongly_typed.cc"
+#pragma GCC diagnostic pop
+
+}  // namespace
+
+struct sleipnir_policy final {
+  JSONValue data;
+};
+
+namespace {
+
+// `WarmUpPolicy()` memoizes what the policy derives from the data of its first call for good, so the data of the first
+// handle, as normalized JSON, is the only data the handles of this process can have.
+std::mutex warmed_up_data_mutex;
+bool warmed_up = false;
+std::string warmed_up_data;
+
+int DecisionOf(JSONValue const& result) {
+  if (Exists<JSONBoolean>(result)) {
+    return Value<JSONBoolean>(result).boolean ? SLEIPNIR_ALLOW : SLEIPNIR_DENY;
+  }
+  return SLEIPNIR_NOT_BOOLEAN;
+}
+
+std::string ToString(sleipnir_string s) { return s.length ? std::string(s.data, s.length) : std::string(); }
+
+OPARequest ToPolicyInput(sleipnir_input const& input) {
+  OPARequest request;
+  request.user = ToString(input.user);
+  request.action = ToString(input.action);
+  request.object = ToString(input.object);
+  return request;
+}
+
+// Returns the decision, or `SLEIPNIR_INVALID_INPUT`, and sets `result` unless the query is invalid.
+int EvaluateJSON(sleipnir_policy const* handle, char const* query_json, size_t length, JSONValue& result) {
+  policy_input_t input;
+  try {
+    // Not via the `std::string_view` overload, as its `thread_local` buffer would keep a `dlopen()`-ed library from
+    // ever being unloaded, for as long as the threads that have called it live.
+    input = ParsePolicyInputFromString<policy_input_t>(std::string(query_json, length));
+  } catch (std::exception const&) {
+    return SLEIPNIR_INVALID_INPUT;
+  }
+  result = policy(ExtractPolicyInputFromParsedInput(input), handle->data).pack();
+  return DecisionOf(result);
+}
+
+}  // namespace
+
+extern "C" {
+
+int sleipnir_abi_version(void) { return SLEIPNIR_ABI_VERSION; }
+
+sleipnir_policy* sleipnir_policy_create(char const* data_json, size_t length) {
+  try {
+    auto handle = std::make_unique<sleipnir_policy>();
+    handle->data = data_json ? ParseJSONUniversally(std::string(data_json, length)) : JSONValue(JSONObject());
+    std::string normalized = AsJSON(handle->data);
+    std::lock_guard<std::mutex> lock(warmed_up_data_mutex);
+    if (!warmed_up) {
+      WarmUpPolicy(handle->data);
+      warmed_up_data = std::move(normalized);
+      warmed_up = true;
+    } else if (normalized != warmed_up_data) {
+      return nullptr;
+    }
+    return handle.release();
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void sleipnir_policy_destroy(sleipnir_policy* handle) { delete handle; }
+
+int sleipnir_policy_evaluate_json(sleipnir_policy const* handle, char const* query_json, size_t length) {
+  try {
+    JSONValue result;
+    return EvaluateJSON(handle, query_json, length, result);
+  } catch (...) {
+    return SLEIPNIR_ERROR;
+  }
+}
+
+int sleipnir_policy_evaluate_json_result(sleipnir_policy const* handle,
+                                         char const* query_json,
+                                         size_t length,
+                                         char* result,
+                                         size_t capacity,
+                                         size_t* result_length) {
+  try {
+    JSONValue value;
+    int const decision = EvaluateJSON(handle, query_json, length, value);
+    if (decision == SLEIPNIR_INVALID_INPUT) {
+      return decision;
+    }
+    std::string const json = AsJSON(value);
+    *result_length = json.length();
+    if (json.length() > capacity) {
+      return SLEIPNIR_BUFFER_TOO_SMALL;
+    }
+    std::memcpy(result, json.data(), json.length());
+    return decision;
+  } catch (...) {
+    return SLEIPNIR_ERROR;
+  }
+}
+
+int sleipnir_policy_evaluate(sleipnir_policy const* handle, sleipnir_input const* input) {
+  try {
+    return DecisionOf(policy(ToPolicyInput(*input), handle->data).pack());
+  } catch (...) {
+    return SLEIPNIR_ERROR;
+  }
+}
+
+int sleipnir_policy_evaluate_batch(sleipnir_policy const* handle,
+                                   sleipnir_input const* inputs,
+                                   size_t count,
+                                   int8_t* results) {
+  try {
+    std::vector<OPARequest> requests;
+    std::vector<OPARequest const*> batch;
+    requests.reserve(count);
+    batch.reserve(count);
+    for (size_t i = 0u; i < count; ++i) {
+      requests.push_back(ToPolicyInput(inputs[i]));
+      batch.push_back(&requests.back());
+    }
+    std::vector<JSONValue> const decisions = policy_batch(batch, handle->data);
+    for (size_t i = 0u; i < count; ++i) {
+      results[i] = static_cast<int8_t>(DecisionOf(decisions[i]));
+    }
+    return 0;
+  } catch (...) {
+    return SLEIPNIR_ERROR;
+  }
+}
+
+}  // extern "C"
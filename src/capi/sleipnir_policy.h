@@ -0,0 +1,90 @@
+/* The C ABI of a transpiled policy, to evaluate it in-process, from C, C++, or Go via cgo, with no network hop.
+ *
+ * The library is `sleipnir_policy.cc`, which wraps `transpiled_strongly_typed.cc`, built as a static or as a shared
+ * library. A `sleipnir_policy` handle holds the `data` document, and is safe to evaluate from many threads at once.
+ * What the policy derives from `data` alone is memoized once per process, though, so all the handles of a process must
+ * be created with the same `data`; see `sleipnir_policy_create()`.
+ * No C++ exception crosses this ABI: all the errors are reported as negative return codes.
+ *
+ * The typed entry points take `sleipnir_input`, which mirrors `OPARequest` of the transpiled policy, so that the
+ * callers that have already extracted the fields skip JSON altogether.
+ */
+
+#ifndef SLEIPNIR_CAPI_SLEIPNIR_POLICY_H
+#define SLEIPNIR_CAPI_SLEIPNIR_POLICY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SLEIPNIR_ABI_VERSION 1
+
+#if defined(__GNUC__)
+#define SLEIPNIR_API __attribute__((visibility("default")))
+#else
+#define SLEIPNIR_API
+#endif
+
+/* The decisions of the boolean rules, and the errors. */
+#define SLEIPNIR_DENY 0
+#define SLEIPNIR_ALLOW 1
+#define SLEIPNIR_NOT_BOOLEAN 2 /* The result is not a boolean, see `sleipnir_policy_evaluate_json_result()`. */
+#define SLEIPNIR_INVALID_INPUT (-1)
+#define SLEIPNIR_BUFFER_TOO_SMALL (-2)
+#define SLEIPNIR_ERROR (-3)
+
+typedef struct sleipnir_policy sleipnir_policy;
+
+/* Need not be NUL-terminated. */
+typedef struct sleipnir_string {
+  char const* data;
+  size_t length;
+} sleipnir_string;
+
+typedef struct sleipnir_input {
+  sleipnir_string user;
+  sleipnir_string action;
+  sleipnir_string object;
+} sleipnir_input;
+
+/* Returns `SLEIPNIR_ABI_VERSION` of the library, for the callers to check against the header they were built with. */
+SLEIPNIR_API int sleipnir_abi_version(void);
+
+/* Takes the `data` document as JSON, or `NULL` for `{}`. Returns `NULL` if it is not valid JSON. Also precomputes what
+ * the policy derives from `data` alone, so that the first evaluation is no slower than the others. That is process-wide
+ * state, so the handles created after the first one must have the same `data`, or `NULL` is returned for them too. */
+SLEIPNIR_API sleipnir_policy* sleipnir_policy_create(char const* data_json, size_t length);
+SLEIPNIR_API void sleipnir_policy_destroy(sleipnir_policy* policy);
+
+/* Evaluates one `{"input":{...}}` query. Returns `SLEIPNIR_DENY`, `SLEIPNIR_ALLOW`, `SLEIPNIR_NOT_BOOLEAN`, or an
+ * error. */
+SLEIPNIR_API int sleipnir_policy_evaluate_json(sleipnir_policy const* policy, char const* query_json, size_t length);
+
+/* As above, and also writes the JSON of the result, not NUL-terminated, into `result`, and its length into
+ * `*result_length`. If it does not fit into `capacity` bytes, returns `SLEIPNIR_BUFFER_TOO_SMALL`, with the length
+ * required in `*result_length`. */
+SLEIPNIR_API int sleipnir_policy_evaluate_json_result(sleipnir_policy const* policy,
+                                                      char const* query_json,
+                                                      size_t length,
+                                                      char* result,
+                                                      size_t capacity,
+                                                      size_t* result_length);
+
+/* Evaluates one pre-extracted input. Returns as `sleipnir_policy_evaluate_json()` does. */
+SLEIPNIR_API int sleipnir_policy_evaluate(sleipnir_policy const* policy, sleipnir_input const* input);
+
+/* Evaluates `count` inputs at once, via the batch evaluator, writing the decision for each into `results`.
+ * Returns zero, or an error. */
+SLEIPNIR_API int sleipnir_policy_evaluate_batch(sleipnir_policy const* policy,
+                                                sleipnir_input const* inputs,
+                                                size_t count,
+                                                int8_t* results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SLEIPNIR_CAPI_SLEIPNIR_POLICY_H */
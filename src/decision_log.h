@@ -0,0 +1,295 @@
+// The asynchronous decision log: every evaluated query and its result, written to disk off the hot path.
+//
+// Each producer thread gets its own single-producer, single-consumer byte ring, so logging a decision is two `memcpy`-s
+// and a release store, with no locks and no read-modify-write atomics. When the ring is full the decision is dropped
+// and counted, the producer never blocks. One background thread drains all the rings, batches the records into large
+// `write()`-s, as NDJSON or as the binary format below, and `fdatasync()`-s the file every `fsync_ms`.
+//
+// The NDJSON lines are `{"ts":$MICROS,"query":$QUERY,"result":$RESULT}`, where `$QUERY` is the query as received.
+// The binary log is `DecisionLogFileHeader`, followed by the records, each `DecisionLogRecordHeader` followed by the
+// bytes of the query and of the result.
+
+#ifndef SLEIPNIR_DECISION_LOG_H
+#define SLEIPNIR_DECISION_LOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+struct DecisionLogFileHeader final {
+  char magic[8] = {'S', 'L', 'P', 'D', 'L', 'O', 'G', '\0'};
+  uint32_t version = 1u;
+  uint32_t reserved = 0u;
+};
+
+struct DecisionLogRecordHeader final {
+  uint64_t timestamp_us;
+  uint32_t query_length;
+  uint32_t result_length;
+};
+
+class DecisionLogRing final {
+ private:
+  // Not zero-filled, so that the pages of a large ring are only backed by memory once the log gets to them.
+  size_t const size_;
+  std::unique_ptr<char[]> const buffer_;
+  uint64_t const mask_;
+  alignas(64) std::atomic<uint64_t> head_{0u};  // Written by the producer only.
+  uint64_t cached_tail_ = 0u;                   // The producer's view of `tail_`, refreshed when the ring looks full.
+  std::atomic<uint64_t> dropped_{0u};           // Written by the producer only.
+  alignas(64) std::atomic<uint64_t> tail_{0u};  // Written by the consumer only.
+
+  static uint64_t RoundUpToPowerOfTwo(uint64_t x) {
+    uint64_t result = 64u;
+    while (result < x) {
+      result <<= 1;
+    }
+    return result;
+  }
+  static uint64_t Padded(uint64_t n) { return (n + 7u) & ~static_cast<uint64_t>(7u); }
+
+  void CopyIn(uint64_t position, void const* data, size_t n) {
+    size_t const offset = static_cast<size_t>(position & mask_);
+    size_t const first = std::min(n, size_ - offset);
+    std::memcpy(&buffer_[offset], data, first);
+    std::memcpy(&buffer_[0], static_cast<char const*>(data) + first, n - first);
+  }
+  void CopyOut(uint64_t position, void* data, size_t n) const {
+    size_t const offset = static_cast<size_t>(position & mask_);
+    size_t const first = std::min(n, size_ - offset);
+    std::memcpy(data, &buffer_[offset], first);
+    std::memcpy(static_cast<char*>(data) + first, &buffer_[0], n - first);
+  }
+
+ public:
+  std::atomic<bool> closed{false};  // Set once the producer thread has exited.
+
+  explicit DecisionLogRing(size_t capacity)
+      : size_(RoundUpToPowerOfTwo(capacity)), buffer_(new char[size_]), mask_(size_ - 1u) {}
+
+  // Producer side. Returns `false`, and counts the decision as dropped, if it does not fit.
+  bool TryPush(uint64_t timestamp_us, std::string_view query, std::string_view result) {
+    uint64_t const size = Padded(sizeof(DecisionLogRecordHeader) + query.length() + result.length());
+    uint64_t const head = head_.load(std::memory_order_relaxed);
+    if (head + size - cached_tail_ > size_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head + size - cached_tail_ > size_) {
+        dropped_.store(dropped_.load(std::memory_order_relaxed) + 1u, std::memory_order_relaxed);
+        return false;
+      }
+    }
+    DecisionLogRecordHeader const header{
+        timestamp_us, static_cast<uint32_t>(query.length()), static_cast<uint32_t>(result.length())};
+    CopyIn(head, &header, sizeof(header));
+    CopyIn(head + sizeof(header), query.data(), query.length());
+    CopyIn(head + sizeof(header) + query.length(), result.data(), result.length());
+    head_.store(head + size, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Calls `f(header, query, result)` for each record available, and returns their number.
+  template <class F>
+  size_t Drain(std::string& scratch, F&& f) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t const head = head_.load(std::memory_order_acquire);
+    size_t n = 0u;
+    while (tail < head) {
+      DecisionLogRecordHeader header;
+      CopyOut(tail, &header, sizeof(header));
+      scratch.resize(header.query_length + header.result_length);
+      CopyOut(tail + sizeof(header), &scratch[0], scratch.length());
+      std::string_view const payload(scratch);
+      f(header, payload.substr(0u, header.query_length), payload.substr(header.query_length));
+      tail += Padded(sizeof(header) + scratch.length());
+      // Freed record by record, as `f` may take a while to flush a batch.
+      tail_.store(tail, std::memory_order_release);
+      ++n;
+    }
+    return n;
+  }
+
+  bool Empty() const { return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire); }
+  uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+};
+
+struct DecisionLogConfig final {
+  std::string filename;
+  bool binary = false;
+  // Enough for the 100K queries of `gen_example_queries.js`, some 9MB of records, even if the writer thread never gets
+  // to run until they are all in, as on a single core.
+  size_t ring_bytes = 1u << 24;
+  uint32_t fsync_ms = 1000u;
+};
+
+class DecisionLog final {
+ private:
+  DecisionLogConfig const config_;
+  int fd_;
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<DecisionLogRing>> rings_;
+  uint64_t retired_dropped_ = 0u;  // From the rings of the exited threads, guarded by `mutex_`.
+  std::atomic<uint64_t> written_{0u};
+  std::atomic<bool> stop_{false};
+  std::string pending_;
+  std::thread writer_;
+
+  DecisionLogRing& LocalRing() {
+    struct Holder final {
+      DecisionLog* owner = nullptr;
+      std::shared_ptr<DecisionLogRing> ring;
+      ~Holder() {
+        if (ring) {
+          ring->closed.store(true, std::memory_order_release);
+        }
+      }
+    };
+    thread_local Holder holder;
+    if (holder.owner != this) {
+      if (holder.ring) {
+        holder.ring->closed.store(true, std::memory_order_release);
+      }
+      holder.owner = this;
+      holder.ring = std::make_shared<DecisionLogRing>(config_.ring_bytes);
+      std::lock_guard<std::mutex> lock(mutex_);
+      rings_.push_back(holder.ring);
+    }
+    return *holder.ring;
+  }
+
+  void Flush() {
+    for (size_t offset = 0u; offset < pending_.length();) {
+      ssize_t const n = ::write(fd_, pending_.data() + offset, pending_.length() - offset);
+      if (n <= 0) {
+        break;
+      }
+      offset += static_cast<size_t>(n);
+    }
+    pending_.clear();
+  }
+
+  void Append(DecisionLogRecordHeader const& header, std::string_view query, std::string_view result) {
+    if (config_.binary) {
+      pending_.append(reinterpret_cast<char const*>(&header), sizeof(header));
+      pending_.append(query.data(), query.length());
+      pending_.append(result.data(), result.length());
+    } else {
+      pending_ += "{\"ts\":";
+      pending_ += std::to_string(header.timestamp_us);
+      pending_ += ",\"query\":";
+      size_t const begin = pending_.length();
+      pending_.append(query.data(), query.length());
+      // A valid JSON query may span lines, but only outside its strings, so this keeps it valid and on one line.
+      std::replace_if(
+          pending_.begin() + begin, pending_.end(), [](char c) { return c == '\n' || c == '\r'; }, ' ');
+      pending_ += ",\"result\":";
+      pending_.append(result.data(), result.length());
+      pending_ += "}\n";
+    }
+  }
+
+  // Drains all the rings once, forgetting the ones of the exited threads once they are empty.
+  size_t DrainAll(std::string& scratch) {
+    std::vector<std::shared_ptr<DecisionLogRing>> rings;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      rings = rings_;
+    }
+    size_t n = 0u;
+    for (auto const& ring : rings) {
+      n += ring->Drain(scratch, [this](DecisionLogRecordHeader const& header, std::string_view q, std::string_view r) {
+        Append(header, q, r);
+        if (pending_.length() >= (1u << 20)) {
+          Flush();
+        }
+      });
+    }
+    Flush();
+    written_.store(written_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mutex_);
+    rings_.erase(std::remove_if(rings_.begin(),
+                                rings_.end(),
+                                [this](std::shared_ptr<DecisionLogRing> const& ring) {
+                                  if (ring->closed.load(std::memory_order_acquire) && ring->Empty()) {
+                                    retired_dropped_ += ring->Dropped();
+                                    return true;
+                                  }
+                                  return false;
+                                }),
+                 rings_.end());
+    return n;
+  }
+
+  void WriterThread() {
+    std::string scratch;
+    auto last_sync = std::chrono::steady_clock::now();
+    while (!stop_.load(std::memory_order_acquire)) {
+      if (!DrainAll(scratch)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      auto const now = std::chrono::steady_clock::now();
+      if (now - last_sync >= std::chrono::milliseconds(config_.fsync_ms)) {
+        ::fdatasync(fd_);
+        last_sync = now;
+      }
+    }
+    DrainAll(scratch);
+    ::fdatasync(fd_);
+  }
+
+ public:
+  explicit DecisionLog(DecisionLogConfig config) : config_(std::move(config)) {
+    fd_ = ::open(config_.filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd_ < 0) {
+      throw std::runtime_error("Can not open the decision log `" + config_.filename + "`.");
+    }
+    if (config_.binary && ::lseek(fd_, 0, SEEK_END) == 0) {
+      DecisionLogFileHeader const header;
+      pending_.assign(reinterpret_cast<char const*>(&header), sizeof(header));
+      Flush();
+    }
+    writer_ = std::thread([this]() { WriterThread(); });
+  }
+
+  // Writes out all the decisions logged so far, and closes the file.
+  ~DecisionLog() {
+    stop_.store(true, std::memory_order_release);
+    writer_.join();
+    ::close(fd_);
+  }
+
+  DecisionLog(DecisionLog const&) = delete;
+  DecisionLog& operator=(DecisionLog const&) = delete;
+
+  // Never blocks. Returns `false` if the decision was dropped because this thread's ring is full.
+  bool Log(std::string_view query, std::string_view result) {
+    uint64_t const now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                                std::chrono::system_clock::now().time_since_epoch())
+                                .count();
+    return LocalRing().TryPush(now_us, query, result);
+  }
+
+  uint64_t Written() const { return written_.load(std::memory_order_relaxed); }
+
+  uint64_t Dropped() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t dropped = retired_dropped_;
+    for (auto const& ring : rings_) {
+      dropped += ring->Dropped();
+    }
+    return dropped;
+  }
+};
+
+#endif  // SLEIPNIR_DECISION_LOG_H
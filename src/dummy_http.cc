@@ -1,9 +1,28 @@
 // g++ -O3 -DNDEBUG -pthread -std=c++17 dummy_http.cc -o dummy_http
 
 #include "current/blocks/http/api.h"
+#include "current/bricks/dflags/dflags.h"
 
-int main() {
-  auto& http = HTTP(current::net::BarePort(8181));
+#include "bench_stages.h"
+
+DEFINE_uint16(p, 8181u, "The port to listen on.");
+DEFINE_bool(d, true, "Ignored, as this binary always runs the HTTP server, accepted for uniformity with `transpiled`.");
+DEFINE_string(queries, "", "Set along with `--stages_json` to measure the in-process stages over these queries.");
+DEFINE_string(stages_json, "", "Set to write the in-process per-stage timings over `--queries` into this file.");
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+  if (!FLAGS_stages_json.empty()) {
+    // The "echo server" does not look at the request, so only the response is "serialized".
+    WriteBenchStages(FLAGS_stages_json,
+                     MeasureBenchStages(
+                         FLAGS_queries,
+                         [](std::string const&) { return true; },
+                         [](bool) { return false; },
+                         [](bool) { return std::string("{\"result\":false}"); }));
+    return 0;
+  }
+  auto& http = HTTP(current::net::BarePort(FLAGS_p));
   auto const http_scope = http.Register("/", URLPathArgs::CountMask::Any, [](Request r) {
     r("{\"result\":false}");
   });
@@ -0,0 +1,216 @@
+// g++ -O3 -DNDEBUG -pthread -std=c++17 gen_workload.cc -o gen_workload
+//
+// Generates a synthetic RBAC data document, in the shape of `rbac_example.rego`, and a matching query corpus.
+//
+// The data document is `{"user_roles":{"user0":["role7",...],...},"role_permissions":{"role7":[{"action":...,
+// "object":...},...],...}}`, and each query is `{"input":{"user":...,"action":...,"object":...}}`, as in
+// `gen_example_queries.js`. Users, roles, actions and objects are drawn either uniformly or from a Zipf distribution,
+// and the share of the queries that should be allowed is set explicitly.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+#include "current/bricks/dflags/dflags.h"
+#include "current/blocks/xterm/vt100.h"
+
+using namespace current::vt100;
+
+DEFINE_uint32(users, 1000u, "The number of users.");
+DEFINE_uint32(roles, 100u, "The number of roles.");
+DEFINE_uint32(roles_per_user, 2u, "The number of roles of each user.");
+DEFINE_uint32(grants_per_role, 4u, "The number of `{action, object}` permissions of each role.");
+DEFINE_uint32(actions, 3u, "The number of distinct actions.");
+DEFINE_uint32(objects, 1000u, "The number of distinct objects.");
+DEFINE_string(distribution, "zipf", "How users, roles, actions and objects are drawn, `uniform` or `zipf`.");
+DEFINE_double(zipf_s, 1.0, "The exponent of the Zipf distribution, the higher the more skewed.");
+DEFINE_double(allow_ratio, 0.5, "The share of the queries that should be allowed by the policy.");
+DEFINE_uint64(queries, 100000u, "The number of queries to generate.");
+DEFINE_uint64(seed, 42u, "The random seed.");
+DEFINE_string(data_output, "data.json", "The file to write the data document into.");
+DEFINE_string(queries_output, "queries.txt", "The file to write the queries into.");
+
+// Draws from `[0, n)`, either uniformly or following Zipf's law, with `0` being the most popular.
+// Zipf sampling is by binary search over the precomputed CDF, so it costs O(log n) per draw and 8 bytes per item.
+class Popularity final {
+ private:
+  uint32_t const n_;
+  std::vector<double> cdf_;
+
+ public:
+  Popularity(uint32_t n, bool zipf, double s) : n_(n) {
+    if (zipf) {
+      cdf_.resize(n);
+      double sum = 0.0;
+      for (uint32_t i = 0u; i < n; ++i) {
+        sum += 1.0 / std::pow(i + 1.0, s);
+        cdf_[i] = sum;
+      }
+      for (double& x : cdf_) {
+        x /= sum;
+      }
+    }
+  }
+
+  template <class RNG>
+  uint32_t operator()(RNG& rng) const {
+    if (cdf_.empty()) {
+      return std::uniform_int_distribution<uint32_t>(0u, n_ - 1u)(rng);
+    }
+    double const u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    auto const it = std::lower_bound(cdf_.begin(), cdf_.end(), u);
+    return it == cdf_.end() ? n_ - 1u : static_cast<uint32_t>(it - cdf_.begin());
+  }
+};
+
+// Draws `k` distinct items of `[0, n)`, `k <= n`, into `output`, by calling `draw` while it keeps finding new ones.
+// Once `draw` mostly repeats, which a skewed distribution does long before it covers its tail, the rest of the items
+// are picked uniformly among the ones not drawn yet: by rejection while at least half of them are left, which takes
+// two draws per item on average, and by a partial Fisher-Yates shuffle of the remaining items otherwise.
+template <typename T, class DRAW, class RNG>
+void DrawDistinct(uint64_t k, uint64_t n, DRAW&& draw, RNG& rng, std::unordered_set<uint64_t>& seen, T* output) {
+  seen.clear();
+  uint64_t drawn = 0u;
+  for (uint64_t attempts = 4u * k + 16u; drawn < k && attempts; --attempts) {
+    uint64_t const x = draw();
+    if (seen.insert(x).second) {
+      output[drawn++] = static_cast<T>(x);
+    }
+  }
+  if (drawn < k && 2u * k <= n) {
+    std::uniform_int_distribution<uint64_t> uniform(0u, n - 1u);
+    while (drawn < k) {
+      uint64_t const x = uniform(rng);
+      if (seen.insert(x).second) {
+        output[drawn++] = static_cast<T>(x);
+      }
+    }
+  } else if (drawn < k) {
+    std::vector<uint64_t> rest;
+    rest.reserve(n - drawn);
+    for (uint64_t x = 0u; x < n; ++x) {
+      if (!seen.count(x)) {
+        rest.push_back(x);
+      }
+    }
+    for (size_t i = 0u; drawn < k; ++i) {
+      std::swap(rest[i], rest[std::uniform_int_distribution<size_t>(i, rest.size() - 1u)(rng)]);
+      output[drawn++] = static_cast<T>(rest[i]);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  if (!FLAGS_users || !FLAGS_roles || !FLAGS_actions || !FLAGS_objects) {
+    std::cerr << "The `--users`, `--roles`, `--actions` and `--objects` must all be positive." << std::endl;
+    return 1;
+  }
+  if (FLAGS_distribution != "uniform" && FLAGS_distribution != "zipf") {
+    std::cerr << "The `--distribution` must be `uniform` or `zipf`." << std::endl;
+    return 1;
+  }
+  bool const zipf = FLAGS_distribution == "zipf";
+  std::mt19937_64 rng(FLAGS_seed);
+  Popularity const users(FLAGS_users, zipf, FLAGS_zipf_s);
+  Popularity const roles(FLAGS_roles, zipf, FLAGS_zipf_s);
+  Popularity const actions(FLAGS_actions, zipf, FLAGS_zipf_s);
+  Popularity const objects(FLAGS_objects, zipf, FLAGS_zipf_s);
+
+  // The grants are stored as `action * objects + object`.
+  uint32_t const roles_per_user = std::min(FLAGS_roles_per_user, FLAGS_roles);
+  uint64_t const grants_per_role = std::min(static_cast<uint64_t>(FLAGS_grants_per_role),
+                                            static_cast<uint64_t>(FLAGS_actions) * FLAGS_objects);
+  std::vector<uint32_t> user_roles(static_cast<size_t>(FLAGS_users) * roles_per_user);
+  std::vector<uint64_t> role_grants(static_cast<size_t>(FLAGS_roles) * grants_per_role);
+  {
+    std::unordered_set<uint64_t> seen;
+    auto const draw_grant = [&]() { return static_cast<uint64_t>(actions(rng)) * FLAGS_objects + objects(rng); };
+    auto const draw_role = [&]() { return static_cast<uint64_t>(roles(rng)); };
+    for (uint32_t r = 0u; r < FLAGS_roles; ++r) {
+      DrawDistinct(grants_per_role,
+                   static_cast<uint64_t>(FLAGS_actions) * FLAGS_objects,
+                   draw_grant,
+                   rng,
+                   seen,
+                   &role_grants[r * grants_per_role]);
+    }
+    for (uint32_t u = 0u; u < FLAGS_users; ++u) {
+      DrawDistinct(roles_per_user, FLAGS_roles, draw_role, rng, seen, &user_roles[static_cast<size_t>(u) * roles_per_user]);
+    }
+  }
+
+  {
+    std::ofstream fo(FLAGS_data_output);
+    fo << "{\"user_roles\":{";
+    for (uint32_t u = 0u; u < FLAGS_users; ++u) {
+      fo << (u ? ",\"user" : "\"user") << u << "\":[";
+      for (uint32_t k = 0u; k < roles_per_user; ++k) {
+        fo << (k ? ",\"role" : "\"role") << user_roles[static_cast<size_t>(u) * roles_per_user + k] << '"';
+      }
+      fo << ']';
+    }
+    fo << "},\"role_permissions\":{";
+    for (uint32_t r = 0u; r < FLAGS_roles; ++r) {
+      fo << (r ? ",\"role" : "\"role") << r << "\":[";
+      for (uint64_t g = 0u; g < grants_per_role; ++g) {
+        uint64_t const grant = role_grants[r * grants_per_role + g];
+        fo << (g ? ",{\"action\":\"action" : "{\"action\":\"action") << grant / FLAGS_objects
+           << "\",\"object\":\"object" << grant % FLAGS_objects << "\"}";
+      }
+      fo << ']';
+    }
+    fo << "}}\n";
+  }
+
+  auto const is_allowed = [&](uint32_t user, uint64_t grant) {
+    for (uint32_t k = 0u; k < roles_per_user; ++k) {
+      uint32_t const role = user_roles[static_cast<size_t>(user) * roles_per_user + k];
+      for (uint64_t g = 0u; g < grants_per_role; ++g) {
+        if (role_grants[role * grants_per_role + g] == grant) {
+          return true;
+        }
+      }
+    }
+    return false;
+  };
+
+  uint64_t allowed = 0u;
+  {
+    std::ofstream fo(FLAGS_queries_output);
+    std::bernoulli_distribution should_allow(std::min(std::max(FLAGS_allow_ratio, 0.0), 1.0));
+    for (uint64_t q = 0u; q < FLAGS_queries; ++q) {
+      uint32_t user = users(rng);
+      uint64_t grant = 0u;
+      bool allow = should_allow(rng) && roles_per_user && grants_per_role;
+      if (allow) {
+        uint32_t const role = user_roles[static_cast<size_t>(user) * roles_per_user + rng() % roles_per_user];
+        grant = role_grants[role * grants_per_role + rng() % grants_per_role];
+      } else {
+        // Redraw until the query is denied; give up after a few attempts if the data allows nearly everything.
+        for (int attempt = 0; attempt < 100; ++attempt) {
+          grant = static_cast<uint64_t>(actions(rng)) * FLAGS_objects + objects(rng);
+          if (!is_allowed(user, grant)) {
+            break;
+          }
+          user = users(rng);
+        }
+        allow = is_allowed(user, grant);
+      }
+      allowed += allow;
+      fo << "{\"input\":{\"user\":\"user" << user << "\",\"action\":\"action" << grant / FLAGS_objects
+         << "\",\"object\":\"object" << grant % FLAGS_objects << "\"}}\n";
+    }
+  }
+
+  std::cout << "Generated " << cyan << FLAGS_data_output << reset << ", " << magenta << FLAGS_users << reset
+            << " users and " << magenta << FLAGS_roles << reset << " roles, and " << cyan << FLAGS_queries_output
+            << reset << ", " << magenta << FLAGS_queries << reset << " queries, " << allowed << " of them allowed."
+            << std::endl;
+}
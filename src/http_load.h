@@ -0,0 +1,512 @@
+// An HTTP/1.1 load generator over keep-alive connections, open-loop or closed-loop.
+//
+// In the open-loop mode requests are scheduled at a fixed arrival rate regardless of how fast the server responds,
+// and each latency is measured from the time the request was *scheduled* to be sent, not from when it was actually
+// sent. Thus, the time a request spends waiting for a free connection is counted, which corrects for the
+// coordinated omission that closed-loop tools, `dperftest` included, suffer from.
+
+#ifndef SLEIPNIR_HTTP_LOAD_H
+#define SLEIPNIR_HTTP_LOAD_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+inline uint64_t LoadNowNS() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// A log-linear histogram: 64 linear sub-buckets per power of two, so that any percentile is within ~1.6%.
+class LatencyHistogram final {
+ private:
+  constexpr static size_t kSubBucketsLog2 = 6u;
+  constexpr static size_t kSubBuckets = 1u << kSubBucketsLog2;
+  std::array<uint64_t, 64u * kSubBuckets> counts_{};
+  uint64_t total_ = 0u;
+  uint64_t max_ = 0u;
+  long double sum_ = 0;
+
+  static size_t IndexOf(uint64_t v) {
+    if (v < kSubBuckets) {
+      return static_cast<size_t>(v);
+    }
+    size_t const e = 63u - static_cast<size_t>(__builtin_clzll(v));
+    size_t const shift = e - kSubBucketsLog2;
+    return ((shift + 1u) << kSubBucketsLog2) + static_cast<size_t>((v >> shift) - kSubBuckets);
+  }
+
+  static uint64_t UpperBoundOf(size_t index) {
+    if (index < kSubBuckets) {
+      return index;
+    }
+    size_t const shift = (index >> kSubBucketsLog2) - 1u;
+    uint64_t const mantissa = (index & (kSubBuckets - 1u)) + kSubBuckets;
+    return ((mantissa + 1u) << shift) - 1u;
+  }
+
+ public:
+  void Record(uint64_t v) {
+    ++counts_[IndexOf(v)];
+    ++total_;
+    max_ = std::max(max_, v);
+    sum_ += v;
+  }
+
+  void Merge(LatencyHistogram const& rhs) {
+    for (size_t i = 0u; i < counts_.size(); ++i) {
+      counts_[i] += rhs.counts_[i];
+    }
+    total_ += rhs.total_;
+    max_ = std::max(max_, rhs.max_);
+    sum_ += rhs.sum_;
+  }
+
+  uint64_t Count() const { return total_; }
+  uint64_t Max() const { return max_; }
+  double Mean() const { return total_ ? static_cast<double>(sum_ / total_) : 0.0; }
+
+  uint64_t Percentile(double q) const {
+    if (!total_) {
+      return 0u;
+    }
+    uint64_t const rank = std::max(static_cast<uint64_t>(1u), static_cast<uint64_t>(std::ceil(q * total_)));
+    uint64_t seen = 0u;
+    for (size_t i = 0u; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::min(UpperBoundOf(i), max_);
+      }
+    }
+    return max_;
+  }
+};
+
+inline std::string BuildHTTPPostRequest(std::string const& path, std::string_view body) {
+  std::string request = "POST " + path + " HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\n";
+  request += "Content-Length: " + std::to_string(body.length()) + "\r\n\r\n";
+  request.append(body.data(), body.length());
+  return request;
+}
+
+// Returns the number of bytes of the first complete HTTP response in `buffer`, zero if it is not complete yet,
+// or `std::string::npos` if the bytes are not an HTTP response. Handles both `Content-Length` and chunked bodies.
+inline size_t ParseHTTPResponse(std::string_view buffer, int& status) {
+  size_t const headers_end = buffer.find("\r\n\r\n");
+  if (headers_end == std::string_view::npos) {
+    return 0u;
+  }
+  if (buffer.substr(0u, 5u) != "HTTP/" || buffer.length() < 12u) {
+    return std::string::npos;
+  }
+  status = std::atoi(buffer.data() + 9u);
+  size_t content_length = 0u;
+  bool chunked = false;
+  for (size_t i = buffer.find("\r\n"); i < headers_end;) {
+    size_t const next = buffer.find("\r\n", i + 2u);
+    std::string_view const header = buffer.substr(i + 2u, next - i - 2u);
+    if (header.length() > 15u && !strncasecmp(header.data(), "Content-Length:", 15u)) {
+      content_length = static_cast<size_t>(std::atoll(header.data() + 15u));
+    } else if (header.length() > 18u && !strncasecmp(header.data(), "Transfer-Encoding:", 18u) &&
+               header.find("chunked") != std::string_view::npos) {
+      chunked = true;
+    }
+    i = next;
+  }
+  size_t const body_begin = headers_end + 4u;
+  if (!chunked) {
+    return buffer.length() >= body_begin + content_length ? body_begin + content_length : 0u;
+  }
+  for (size_t i = body_begin;;) {
+    size_t const line_end = buffer.find("\r\n", i);
+    if (line_end == std::string_view::npos) {
+      return 0u;
+    }
+    size_t const chunk_size = std::strtoull(buffer.data() + i, nullptr, 16);
+    size_t const chunk_end = line_end + 2u + chunk_size + 2u;
+    if (buffer.length() < chunk_end) {
+      return 0u;
+    }
+    if (!chunk_size) {
+      return chunk_end;
+    }
+    i = chunk_end;
+  }
+}
+
+struct HTTPLoadConfig final {
+  std::string host = "127.0.0.1";
+  uint16_t port = 8181u;
+  size_t threads = 1u;
+  size_t connections = 64u;  // In total, across all threads.
+  size_t pipeline_depth = 1u;  // The number of requests in flight per connection.
+  double rate = 0.0;  // Requests per second in total; zero for closed-loop, as fast as the server responds.
+  double warmup_seconds = 1.0;
+  double duration_seconds = 10.0;
+  double drain_seconds = 5.0;  // How long to wait for outstanding requests once the scheduling stops.
+  double slo_seconds = 0.0;  // The latency within which a `2xx` response counts towards the goodput; zero for any.
+};
+
+struct HTTPLoadResult final {
+  double offered_rate = 0.0;
+  double achieved_rate = 0.0;
+  double goodput_rate = 0.0;  // Of the `good` responses, per second.
+  uint64_t ok = 0u;  // Responses with a `2xx` status.
+  uint64_t good = 0u;  // The `ok` ones within `slo_seconds`.
+  uint64_t rejected = 0u;  // Responses with a `503` status, i.e. load that was shed.
+  uint64_t failed = 0u;  // Other statuses, broken connections, and requests not completed by the end of the drain.
+  uint64_t connect_errors = 0u;  // Failed attempts to (re)connect, each retried after a backoff.
+  uint64_t completed_in_window = 0u;  // Responses of any kind received within the measurement window.
+  LatencyHistogram latency_ns;  // Of the `2xx` responses, from their scheduled times.
+};
+
+inline int ConnectTCP(std::string const& host, uint16_t port) {
+  int const fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    throw std::runtime_error("socket() failed.");
+  }
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    ::close(fd);
+    throw std::runtime_error("Invalid IPv4 address `" + host + "`.");
+  }
+  if (::connect(fd, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Can not connect to " + host + ':' + std::to_string(port) + '.');
+  }
+  int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+namespace http_load_impl {
+
+struct Connection final {
+  int fd = -1;
+  std::string out;
+  size_t out_offset = 0u;
+  std::string in;
+  std::deque<uint64_t> scheduled_at;  // Of the requests sent over this connection and not yet responded to.
+  bool wants_write = false;
+  uint64_t retry_at_ns = 0u;  // When to try connecting again, if `fd` is `-1`.
+  uint64_t backoff_ns = 0u;  // The current backoff after failed connects, doubling up to `kMaxBackoffNS`.
+};
+
+constexpr uint64_t kMinBackoffNS = 1000000u;
+constexpr uint64_t kMaxBackoffNS = 1000000000u;
+
+inline void RunThread(HTTPLoadConfig const& config,
+                      std::vector<std::string> const& requests,
+                      size_t thread_index,
+                      size_t connections,
+                      uint64_t start_ns,
+                      HTTPLoadResult& result) {
+  uint64_t const measure_from_ns = start_ns + static_cast<uint64_t>(config.warmup_seconds * 1e9);
+  uint64_t const stop_ns = measure_from_ns + static_cast<uint64_t>(config.duration_seconds * 1e9);
+  uint64_t const drain_until_ns = stop_ns + static_cast<uint64_t>(config.drain_seconds * 1e9);
+  uint64_t const slo_ns = static_cast<uint64_t>(config.slo_seconds * 1e9);
+  bool const open_loop = config.rate > 0;
+  // Each thread sends its share of the load, with the threads' schedules interleaved.
+  uint64_t const interval_ns = open_loop ? static_cast<uint64_t>(1e9 * config.threads / config.rate) : 0u;
+  uint64_t next_scheduled_ns = start_ns + (open_loop ? interval_ns * thread_index / config.threads : 0u);
+  size_t next_request = thread_index * 7919u;
+
+  int const epoll_fd = ::epoll_create1(0);
+  std::vector<Connection> pool(connections);
+  std::deque<size_t> free_slots;  // A connection index per request that connection can take right now.
+  std::deque<uint64_t> backlog;  // The scheduled times of the requests waiting for a free connection.
+  size_t disconnected = 0u;
+  // A server that is overloaded or restarting refuses connections, and so can the local file descriptor limit.
+  // Neither ends the run: the failure is counted, and the connection is retried after an exponential backoff, with
+  // its requests waiting in the `backlog` meanwhile, and timing out at the end of the drain if it never comes back.
+  auto const connect = [&](size_t i, uint64_t now_ns) {
+    Connection& c = pool[i];
+    try {
+      c.fd = ConnectTCP(config.host, config.port);
+    } catch (std::exception const&) {
+      ++result.connect_errors;
+      c.fd = -1;
+      c.backoff_ns = c.backoff_ns ? std::min(c.backoff_ns * 2u, kMaxBackoffNS) : kMinBackoffNS;
+      c.retry_at_ns = now_ns + c.backoff_ns;
+      ++disconnected;
+      return;
+    }
+    c.backoff_ns = 0u;
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = i;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.fd, &ev);
+    for (size_t j = 0u; j < config.pipeline_depth; ++j) {
+      free_slots.push_back(i);
+    }
+  };
+  for (size_t i = 0u; i < pool.size(); ++i) {
+    connect(i, LoadNowNS());
+  }
+
+  // Counted as scheduled, not as sent, so that the requests that never get a connection count as failed too.
+  uint64_t measured_scheduled = 0u;
+  auto const schedule = [&](uint64_t scheduled_ns) {
+    backlog.push_back(scheduled_ns);
+    if (scheduled_ns >= measure_from_ns && scheduled_ns < stop_ns) {
+      ++measured_scheduled;
+    }
+  };
+  auto const record = [&](uint64_t scheduled_ns, int status, uint64_t now_ns) {
+    if (status && now_ns >= measure_from_ns && now_ns < stop_ns) {
+      ++result.completed_in_window;
+    }
+    if (scheduled_ns < measure_from_ns || scheduled_ns >= stop_ns) {
+      return;
+    }
+    if (status >= 200 && status < 300) {
+      ++result.ok;
+      if (!slo_ns || now_ns - scheduled_ns <= slo_ns) {
+        ++result.good;
+      }
+      result.latency_ns.Record(now_ns - scheduled_ns);
+    } else if (status == 503) {
+      ++result.rejected;
+    } else {
+      ++result.failed;
+    }
+  };
+  auto const flush = [&](size_t i) {
+    Connection& c = pool[i];
+    while (c.out_offset < c.out.length()) {
+      // With no `SIGPIPE`, which would end the run, as a server that closes the connection is to be reconnected to.
+      ssize_t const n = ::send(c.fd, c.out.data() + c.out_offset, c.out.length() - c.out_offset, MSG_NOSIGNAL);
+      if (n <= 0) {
+        break;
+      }
+      c.out_offset += static_cast<size_t>(n);
+    }
+    if (c.out_offset == c.out.length()) {
+      c.out.clear();
+      c.out_offset = 0u;
+    }
+    bool const wants_write = !c.out.empty();
+    if (wants_write != c.wants_write) {
+      c.wants_write = wants_write;
+      epoll_event ev;
+      ev.events = EPOLLIN | (wants_write ? EPOLLOUT : 0u);
+      ev.data.u64 = i;
+      ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+  };
+  auto const reconnect = [&](size_t i, uint64_t now_ns) {
+    Connection& c = pool[i];
+    for (uint64_t scheduled_ns : c.scheduled_at) {
+      record(scheduled_ns, 0, now_ns);
+    }
+    c.scheduled_at.clear();
+    c.in.clear();
+    c.out.clear();
+    c.out_offset = 0u;
+    c.wants_write = false;
+    free_slots.erase(std::remove(free_slots.begin(), free_slots.end(), i), free_slots.end());
+    ::close(c.fd);
+    connect(i, now_ns);
+  };
+
+  // The `timerfd` of `CLOCK_MONOTONIC`, which `std::chrono::steady_clock` and so `LoadNowNS()` are on.
+  int const timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  uint64_t armed_ns = 0u;
+  {
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = pool.size();
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+  }
+
+  std::vector<epoll_event> events(pool.size() + 1u);
+  std::vector<char> buffer(1u << 16);
+  std::vector<size_t> touched;
+  while (true) {
+    uint64_t now_ns = LoadNowNS();
+    uint64_t next_retry_ns = std::numeric_limits<uint64_t>::max();
+    if (disconnected) {
+      disconnected = 0u;
+      for (size_t i = 0u; i < pool.size(); ++i) {
+        if (pool[i].fd < 0) {
+          if (pool[i].retry_at_ns <= now_ns) {
+            connect(i, now_ns);
+          } else {
+            ++disconnected;
+          }
+          if (pool[i].fd < 0) {
+            next_retry_ns = std::min(next_retry_ns, pool[i].retry_at_ns);
+          }
+        }
+      }
+    }
+    if (open_loop) {
+      while (next_scheduled_ns <= now_ns && next_scheduled_ns < stop_ns) {
+        schedule(next_scheduled_ns);
+        next_scheduled_ns += interval_ns;
+      }
+    } else if (now_ns < stop_ns) {
+      while (backlog.size() < free_slots.size()) {
+        schedule(now_ns);
+      }
+    }
+    touched.clear();
+    while (!backlog.empty() && !free_slots.empty()) {
+      size_t const i = free_slots.front();
+      free_slots.pop_front();
+      std::string const& request = requests[next_request++ % requests.size()];
+      pool[i].out.append(request);
+      pool[i].scheduled_at.push_back(backlog.front());
+      backlog.pop_front();
+      touched.push_back(i);
+    }
+    // Requests sent back-to-back over one connection go out with a single `write()`.
+    for (size_t i : touched) {
+      flush(i);
+    }
+    bool outstanding = !backlog.empty();
+    for (Connection const& c : pool) {
+      outstanding |= !c.scheduled_at.empty();
+    }
+    if (now_ns >= stop_ns && (!outstanding || now_ns >= drain_until_ns)) {
+      break;
+    }
+    // Sleep until the next request is due, a connection is to be retried, or the run or its drain ends. The
+    // `epoll_wait()` timeout is in milliseconds, too coarse for the schedule, so the wakeup is a `timerfd` instead.
+    uint64_t wake_ns = std::min(next_retry_ns, now_ns < stop_ns ? stop_ns : drain_until_ns);
+    if (open_loop && next_scheduled_ns < stop_ns) {
+      wake_ns = std::min(wake_ns, next_scheduled_ns);
+    }
+    if (wake_ns <= now_ns) {
+      continue;
+    }
+    if (wake_ns != armed_ns) {
+      armed_ns = wake_ns;
+      itimerspec when;
+      std::memset(&when, 0, sizeof(when));
+      when.it_value.tv_sec = static_cast<time_t>(wake_ns / 1000000000u);
+      when.it_value.tv_nsec = static_cast<long>(wake_ns % 1000000000u);
+      ::timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &when, nullptr);
+    }
+    int const n = ::epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), -1);
+    now_ns = LoadNowNS();
+    for (int e = 0; e < n; ++e) {
+      size_t const i = static_cast<size_t>(events[e].data.u64);
+      if (i == pool.size()) {
+        uint64_t expirations;
+        if (::read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+          armed_ns = 0u;
+        }
+        continue;
+      }
+      Connection& c = pool[i];
+      if (events[e].events & EPOLLOUT) {
+        flush(i);
+      }
+      if (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        ssize_t const r = ::read(c.fd, buffer.data(), buffer.size());
+        if (r <= 0) {
+          if (r < 0 && errno == EAGAIN) {
+            continue;
+          }
+          reconnect(i, now_ns);
+          continue;
+        }
+        c.in.append(buffer.data(), static_cast<size_t>(r));
+        size_t consumed = 0u;
+        while (!c.scheduled_at.empty()) {
+          int status = 0;
+          size_t const bytes = ParseHTTPResponse(std::string_view(c.in).substr(consumed), status);
+          if (!bytes) {
+            break;
+          }
+          if (bytes == std::string::npos) {
+            consumed = c.in.length();
+            reconnect(i, now_ns);
+            break;
+          }
+          consumed += bytes;
+          record(c.scheduled_at.front(), status, now_ns);
+          c.scheduled_at.pop_front();
+          free_slots.push_back(i);
+        }
+        c.in.erase(0u, std::min(consumed, c.in.length()));
+      }
+    }
+  }
+  // Whatever was scheduled within the measurement window and has not completed by now, sent or still in the `backlog`,
+  // has timed out.
+  result.failed += measured_scheduled - std::min(measured_scheduled, result.ok + result.rejected + result.failed);
+  for (Connection& c : pool) {
+    if (c.fd >= 0) {
+      ::close(c.fd);
+    }
+  }
+  ::close(timer_fd);
+  ::close(epoll_fd);
+}
+
+}  // namespace http_load_impl
+
+// Runs one load step, replaying `requests`, the complete serialized HTTP requests, round-robin.
+inline HTTPLoadResult RunHTTPLoad(HTTPLoadConfig const& config, std::vector<std::string> const& requests) {
+  if (requests.empty()) {
+    throw std::invalid_argument("No requests to send.");
+  }
+  size_t const threads = std::max(static_cast<size_t>(1u), std::min(config.threads, config.connections));
+  HTTPLoadConfig thread_config = config;
+  thread_config.threads = threads;
+  std::vector<HTTPLoadResult> results(threads);
+  std::vector<std::thread> workers;
+  uint64_t const start_ns = LoadNowNS() + 100000000u;  // Give all the threads the time to connect.
+  for (size_t t = 0u; t < threads; ++t) {
+    size_t const connections = config.connections / threads + (t < config.connections % threads ? 1u : 0u);
+    workers.emplace_back([&, t, connections]() {
+      http_load_impl::RunThread(thread_config, requests, t, connections, start_ns, results[t]);
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  HTTPLoadResult total;
+  total.offered_rate = config.rate;
+  for (HTTPLoadResult const& r : results) {
+    total.ok += r.ok;
+    total.good += r.good;
+    total.rejected += r.rejected;
+    total.failed += r.failed;
+    total.connect_errors += r.connect_errors;
+    total.completed_in_window += r.completed_in_window;
+    total.latency_ns.Merge(r.latency_ns);
+  }
+  total.achieved_rate = total.completed_in_window / config.duration_seconds;
+  total.goodput_rate = total.good / config.duration_seconds;
+  return total;
+}
+
+#endif  // SLEIPNIR_HTTP_LOAD_H
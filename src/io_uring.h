@@ -0,0 +1,187 @@
+// A minimal io_uring: the submission and completion rings over the raw system calls, as this repo does not depend on
+// liburing. One thread owns each `IOURing`; `NextSQE()` queues the requests, and `Submit()` submits all of them with
+// one system call, which also waits for the completions, to be reaped by `ForEachCompletion()`. The requests queued
+// while the submission queue is full, and the kernel can not take any, wait in order in an overflow queue of their
+// own, and move into the submission queue as it makes room, so that no request is ever overwritten, nor dropped.
+//
+// The constructor throws on the kernels without io_uring, or where it is disabled, for the callers to fall back.
+
+#ifndef SLEIPNIR_IO_URING_H
+#define SLEIPNIR_IO_URING_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+class IOURing final {
+ private:
+  int fd_ = -1;
+  void* sq_ring_ = MAP_FAILED;
+  size_t sq_ring_bytes_ = 0u;
+  void* cq_ring_ = MAP_FAILED;  // The same mapping as `sq_ring_` with `IORING_FEAT_SINGLE_MMAP`.
+  size_t cq_ring_bytes_ = 0u;
+  io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+  size_t sqes_bytes_ = 0u;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe* cqes_;
+  unsigned queued_ = 0u;  // Filled in by `NextSQE()`, not submitted yet.
+  std::deque<io_uring_sqe> overflow_;  // Filled in by `NextSQE()` while the submission queue was full, in order.
+
+  template <typename T>
+  static T* At(void* base, uint32_t offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+  }
+
+  bool SQFull() const { return *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_; }
+
+  // The next entry of the submission queue, which must not be full, as queued.
+  io_uring_sqe* PushSQE() {
+    unsigned const tail = *sq_tail_;
+    unsigned const index = tail & sq_mask_;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1u, __ATOMIC_RELEASE);
+    ++queued_;
+    return &sqes_[index];
+  }
+
+  // Moves what fits of `overflow_` into the submission queue.
+  void DrainOverflow() {
+    while (!overflow_.empty() && !SQFull()) {
+      *PushSQE() = overflow_.front();
+      overflow_.pop_front();
+    }
+  }
+
+  void Unmap() {
+    if (sqes_ != MAP_FAILED) {
+      ::munmap(sqes_, sqes_bytes_);
+    }
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+      ::munmap(cq_ring_, cq_ring_bytes_);
+    }
+    if (sq_ring_ != MAP_FAILED) {
+      ::munmap(sq_ring_, sq_ring_bytes_);
+    }
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+  }
+
+ public:
+  explicit IOURing(unsigned entries) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0) {
+      throw std::runtime_error("No io_uring: " + std::string(std::strerror(errno)) + '.');
+    }
+    sq_ring_bytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_bytes_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool const single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_ring_bytes_ = cq_ring_bytes_ = std::max(sq_ring_bytes_, cq_ring_bytes_);
+    }
+    auto const map = [this](size_t bytes, off_t offset) {
+      return ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+    };
+    sq_ring_ = map(sq_ring_bytes_, IORING_OFF_SQ_RING);
+    cq_ring_ = single_mmap ? sq_ring_ : map(cq_ring_bytes_, IORING_OFF_CQ_RING);
+    sqes_bytes_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(map(sqes_bytes_, IORING_OFF_SQES));
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+      Unmap();
+      throw std::runtime_error("Can not map the io_uring rings.");
+    }
+    sq_head_ = At<unsigned>(sq_ring_, params.sq_off.head);
+    sq_tail_ = At<unsigned>(sq_ring_, params.sq_off.tail);
+    sq_mask_ = *At<unsigned>(sq_ring_, params.sq_off.ring_mask);
+    sq_entries_ = *At<unsigned>(sq_ring_, params.sq_off.ring_entries);
+    sq_array_ = At<unsigned>(sq_ring_, params.sq_off.array);
+    cq_head_ = At<unsigned>(cq_ring_, params.cq_off.head);
+    cq_tail_ = At<unsigned>(cq_ring_, params.cq_off.tail);
+    cq_mask_ = *At<unsigned>(cq_ring_, params.cq_off.ring_mask);
+    cqes_ = At<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+  }
+
+  ~IOURing() { Unmap(); }
+
+  IOURing(IOURing const&) = delete;
+  IOURing& operator=(IOURing const&) = delete;
+
+  // Registers `buffers` for `IORING_OP_READ_FIXED` and `IORING_OP_WRITE_FIXED`, by their indexes. Returns `false` if
+  // the kernel refuses, typically as they would exceed `RLIMIT_MEMLOCK`, for the caller to do without.
+  bool RegisterBuffers(std::vector<iovec> const& buffers) {
+    return !::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size());
+  }
+
+  // A zeroed submission queue entry to fill in. Submits the ones queued so far first if the queue is full, and, should
+  // the kernel not take any of them, returns an entry of the overflow queue instead, to be submitted later.
+  io_uring_sqe* NextSQE() {
+    if (overflow_.empty() && SQFull()) {
+      Submit(0u);
+    }
+    if (!overflow_.empty() || SQFull()) {
+      overflow_.emplace_back();
+      std::memset(&overflow_.back(), 0, sizeof(io_uring_sqe));
+      return &overflow_.back();
+    }
+    io_uring_sqe* const sqe = PushSQE();
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+  }
+
+  // Submits all the queued entries, the overflown ones included, as far as the kernel takes them, and waits for at
+  // least `wait_for` completions.
+  void Submit(unsigned wait_for) {
+    DrainOverflow();
+    while (true) {
+      int const n = static_cast<int>(::syscall(
+          __NR_io_uring_enter, fd_, queued_, wait_for, wait_for ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0u));
+      if (n >= 0) {
+        queued_ -= static_cast<unsigned>(n);
+        DrainOverflow();
+        if (!queued_ || wait_for) {
+          return;
+        }
+      } else if (errno == EBUSY || errno == EAGAIN) {
+        return;  // The completion queue is full; reaping it makes room.
+      } else if (errno != EINTR) {
+        throw std::runtime_error("io_uring_enter: " + std::string(std::strerror(errno)) + '.');
+      }
+    }
+  }
+
+  // Calls `f(io_uring_cqe const&)` for each completion available, and returns their number.
+  template <class F>
+  unsigned ForEachCompletion(F&& f) {
+    unsigned head = *cq_head_;
+    unsigned const tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    unsigned const n = tail - head;
+    for (; head != tail; ++head) {
+      io_uring_cqe const cqe = cqes_[head & cq_mask_];
+      __atomic_store_n(cq_head_, head + 1u, __ATOMIC_RELEASE);
+      f(cqe);
+    }
+    return n;
+  }
+};
+
+#endif  // SLEIPNIR_IO_URING_H
@@ -0,0 +1,169 @@
+// g++ -O3 -DNDEBUG -pthread -std=c++17 loadgen.cc -o loadgen
+//
+// An open-loop load generator with coordinated-omission-corrected latencies, see `http_load.h`.
+// Steps through the arrival rates to find the saturation knee of the server under test.
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "current/bricks/dflags/dflags.h"
+#include "current/blocks/xterm/vt100.h"
+#include "current/typesystem/serialization/json.h"
+
+#include "http_load.h"
+#include "mmap_lines.h"
+
+using namespace current::vt100;
+
+DEFINE_string(host, "127.0.0.1", "The IPv4 address of the server under test.");
+DEFINE_uint16(port, 8181u, "The port of the server under test.");
+DEFINE_string(path, "/v1/data/rbac/allow", "The URL path to `POST` the queries to.");
+DEFINE_string(queries, "queries.txt", "The corpus of request bodies, one per line, replayed round-robin.");
+DEFINE_uint32(threads, 1u, "The number of load generator threads.");
+DEFINE_uint32(connections, 64u, "The number of keep-alive connections, in total.");
+DEFINE_uint32(pipeline, 1u, "The number of requests in flight per connection, i.e. the HTTP/1.1 pipelining depth.");
+DEFINE_string(rates, "", "The comma-separated arrival rates, in requests per second, to step through.");
+DEFINE_double(rate_start, 1000.0, "Unless `--rates` is set, the first arrival rate to step through.");
+DEFINE_double(rate_factor, 1.5, "Unless `--rates` is set, the ratio between the consecutive arrival rates.");
+DEFINE_double(rate_max, 1e7, "Unless `--rates` is set, the arrival rate to stop at.");
+DEFINE_bool(closed_loop, false, "Set to run a single closed-loop step instead, as fast as the server responds.");
+DEFINE_double(warmup, 1.0, "The number of seconds of each step to not measure.");
+DEFINE_double(duration, 10.0, "The number of seconds of each step to measure.");
+DEFINE_double(knee_p99_ms, 10.0, "The p99 latency, in milliseconds, beyond which the server is considered saturated.");
+DEFINE_double(slo_ms, 10.0, "The latency within which a successful response counts towards the goodput.");
+DEFINE_bool(stop_at_knee, true, "Set to stop stepping up the rate once the saturation knee is found.");
+DEFINE_string(json_output, "", "Set to write the results of all steps into this JSON file.");
+
+CURRENT_STRUCT(LoadStep) {
+  CURRENT_FIELD(offered_rate, double);
+  CURRENT_FIELD(achieved_rate, double);
+  CURRENT_FIELD(goodput_rate, double);
+  CURRENT_FIELD(ok, uint64_t);
+  CURRENT_FIELD(rejected, uint64_t);
+  CURRENT_FIELD(failed, uint64_t);
+  CURRENT_FIELD(connect_errors, uint64_t);
+  CURRENT_FIELD(mean_us, double);
+  CURRENT_FIELD(p50_us, double);
+  CURRENT_FIELD(p90_us, double);
+  CURRENT_FIELD(p99_us, double);
+  CURRENT_FIELD(p999_us, double);
+  CURRENT_FIELD(max_us, double);
+  CURRENT_FIELD(saturated, bool);
+};
+
+CURRENT_STRUCT(LoadReport) {
+  CURRENT_FIELD(url, std::string);
+  CURRENT_FIELD(connections, uint32_t);
+  CURRENT_FIELD(pipeline, uint32_t);
+  CURRENT_FIELD(steps, std::vector<LoadStep>);
+  CURRENT_FIELD(knee_rate, double, 0.0);
+};
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  std::vector<std::string> requests;
+  {
+    MMappedFile const file(FLAGS_queries);
+    LinesCursor lines(file.Contents());
+    std::string_view line;
+    while (lines.Next(line)) {
+      if (!line.empty()) {
+        requests.push_back(BuildHTTPPostRequest(FLAGS_path, line));
+      }
+    }
+  }
+  if (requests.empty()) {
+    std::cerr << "No queries in `" << FLAGS_queries << "`." << std::endl;
+    return 1;
+  }
+
+  std::vector<double> rates;
+  if (FLAGS_closed_loop) {
+    rates.push_back(0.0);
+  } else if (!FLAGS_rates.empty()) {
+    for (std::string const& rate : current::strings::Split(FLAGS_rates, ',')) {
+      rates.push_back(current::strings::FromString<double>(rate));
+    }
+  } else {
+    for (double rate = FLAGS_rate_start; rate <= FLAGS_rate_max; rate *= std::max(FLAGS_rate_factor, 1.01)) {
+      rates.push_back(rate);
+    }
+  }
+
+  LoadReport report;
+  report.url = FLAGS_host + ':' + current::strings::ToString(FLAGS_port) + FLAGS_path;
+  report.connections = FLAGS_connections;
+  report.pipeline = FLAGS_pipeline;
+
+  std::cout << "Loading " << cyan << report.url << reset << ", " << FLAGS_connections << " connections, pipeline depth "
+            << FLAGS_pipeline << ", " << requests.size() << " distinct queries." << std::endl;
+  std::cout << "   offered    achieved     goodput     mean      p50      p90      p99    p99.9      max   rejected   failed  conn.err"
+            << std::endl;
+  for (double const rate : rates) {
+    HTTPLoadConfig config;
+    config.host = FLAGS_host;
+    config.port = FLAGS_port;
+    config.threads = FLAGS_threads;
+    config.connections = FLAGS_connections;
+    config.pipeline_depth = std::max(FLAGS_pipeline, 1u);
+    config.rate = rate;
+    config.warmup_seconds = FLAGS_warmup;
+    config.duration_seconds = FLAGS_duration;
+    config.slo_seconds = FLAGS_slo_ms * 1e-3;
+    HTTPLoadResult const result = RunHTTPLoad(config, requests);
+
+    LoadStep step;
+    step.offered_rate = rate;
+    step.achieved_rate = result.achieved_rate;
+    step.goodput_rate = result.goodput_rate;
+    step.ok = result.ok;
+    step.rejected = result.rejected;
+    step.failed = result.failed;
+    step.connect_errors = result.connect_errors;
+    step.mean_us = result.latency_ns.Mean() * 1e-3;
+    step.p50_us = result.latency_ns.Percentile(0.5) * 1e-3;
+    step.p90_us = result.latency_ns.Percentile(0.9) * 1e-3;
+    step.p99_us = result.latency_ns.Percentile(0.99) * 1e-3;
+    step.p999_us = result.latency_ns.Percentile(0.999) * 1e-3;
+    step.max_us = result.latency_ns.Max() * 1e-3;
+    uint64_t const total = result.ok + result.rejected + result.failed;
+    step.saturated = rate > 0 && (result.achieved_rate < 0.95 * rate || step.p99_us > FLAGS_knee_p99_ms * 1e3 ||
+                                  (result.rejected + result.failed) * 100u > total);
+    report.steps.push_back(step);
+
+    auto const us = [](double v) { return current::strings::RoundDoubleToString(v, 1); };
+    std::printf("%10s  %10s  %10s",
+                rate > 0 ? current::strings::RoundDoubleToString(rate, 0).c_str() : "closed",
+                current::strings::RoundDoubleToString(step.achieved_rate, 0).c_str(),
+                current::strings::RoundDoubleToString(step.goodput_rate, 0).c_str());
+    for (double v : {step.mean_us, step.p50_us, step.p90_us, step.p99_us, step.p999_us, step.max_us}) {
+      std::printf(" %8s", us(v).c_str());
+    }
+    std::printf("  %9llu %8llu  %8llu%s\n",
+                static_cast<unsigned long long>(step.rejected),
+                static_cast<unsigned long long>(step.failed),
+                static_cast<unsigned long long>(step.connect_errors),
+                step.saturated ? "  <- saturated" : "");
+    std::fflush(stdout);
+
+    if (step.saturated) {
+      if (!report.knee_rate && report.steps.size() > 1u) {
+        report.knee_rate = report.steps[report.steps.size() - 2u].offered_rate;
+      }
+      if (FLAGS_stop_at_knee) {
+        break;
+      }
+    }
+  }
+  std::cout << "Latencies are in microseconds, measured from the scheduled send times." << std::endl;
+  std::cout << "The goodput is the rate of the successful responses within `--slo_ms`." << std::endl;
+  if (report.knee_rate) {
+    std::cout << "Saturation knee: " << bold << green << current::strings::RoundDoubleToString(report.knee_rate, 0)
+              << reset << " requests per second." << std::endl;
+  }
+  if (!FLAGS_json_output.empty()) {
+    std::ofstream(FLAGS_json_output) << JSON(report) << std::endl;
+  }
+}
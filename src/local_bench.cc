@@ -0,0 +1,289 @@
+// g++ -O3 -DNDEBUG -pthread -std=c++17 local_bench.cc -o local_bench
+//
+// Compares the transports of a sidecar policy server: JSON over HTTP, the compact binary protocol over TCP, the Unix
+// domain socket, and the shared-memory channel. Start the server with all of them, e.g.
+//   ./transpiled_strongly_typed -p 8181 --binary_port 8182 --unix_socket /tmp/sleipnir.sock --shm_channel sleipnir -d
+// and run `./local_bench --queries queries.txt`. Each transport is driven by one client for `--duration` seconds, with
+// `--pipeline` requests in flight, and the round-trip latencies and the throughput are reported side by side.
+//
+// With `--early_close N`, checks instead that the binary protocol and the Unix socket transports survive the clients
+// that pipeline `N` requests and close their connections without reading the responses, and exits non-zero if not.
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+
+#include "current/blocks/json/json.h"
+#include "current/bricks/dflags/dflags.h"
+#include "current/blocks/xterm/vt100.h"
+
+#include "binary_protocol.h"
+#include "http_load.h"
+#include "mmap_lines.h"
+#include "shm_channel.h"
+#include "unix_socket_server.h"
+
+using namespace current::json;
+using namespace current::vt100;
+
+DEFINE_string(queries, "queries.txt", "The corpus of `{\"input\":{...}}` queries, one per line, replayed round-robin.");
+DEFINE_uint16(port, 8181u, "The HTTP port of the server, zero to skip HTTP.");
+DEFINE_uint16(binary_port, 0u, "The binary protocol port of the server, zero to skip it.");
+DEFINE_bool(binary_named, false, "Set to send named objects, for `transpiled`, not fields in order, as `Struct`-s.");
+DEFINE_string(unix_socket, "/tmp/sleipnir.sock", "The Unix socket of the server, empty to skip it.");
+DEFINE_string(shm_channel, "sleipnir", "The shared-memory channel of the server, empty to skip it.");
+DEFINE_uint32(pipeline, 1u, "The number of requests in flight.");
+DEFINE_double(warmup, 0.5, "The number of seconds of each run to not measure.");
+DEFINE_double(duration, 3.0, "The number of seconds of each run to measure.");
+DEFINE_uint32(early_close, 0u, "Set to check the server survives clients closing with this many requests unread.");
+
+struct LocalBenchResult final {
+  uint64_t requests = 0u;
+  LatencyHistogram latency_ns;
+};
+
+// Keeps `--pipeline` requests in flight via `send(query)`, and completes them in order via `receive()`, which returns
+// the number of responses that have arrived. Measures each round trip from its send to its response.
+template <class SEND, class RECEIVE>
+LocalBenchResult RunWindowed(std::vector<std::string> const& queries, SEND&& send, RECEIVE&& receive) {
+  LocalBenchResult result;
+  std::deque<uint64_t> in_flight;
+  size_t next = 0u;
+  uint64_t const begin_ns = LoadNowNS() + static_cast<uint64_t>(FLAGS_warmup * 1e9);
+  uint64_t const end_ns = begin_ns + static_cast<uint64_t>(FLAGS_duration * 1e9);
+  bool sending = true;
+  while (sending || !in_flight.empty()) {
+    while (sending && in_flight.size() < FLAGS_pipeline) {
+      in_flight.push_back(LoadNowNS());
+      send(queries[next]);
+      next = (next + 1u) % queries.size();
+    }
+    for (size_t n = receive(); n; --n) {
+      uint64_t const now = LoadNowNS();
+      if (now >= begin_ns && now < end_ns) {
+        ++result.requests;
+        result.latency_ns.Record(now - in_flight.front());
+      }
+      in_flight.pop_front();
+      sending = now < end_ns;
+    }
+  }
+  return result;
+}
+
+int ConnectUnixSocket() {
+  int const fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_un const address = UnixSocketAddress(FLAGS_unix_socket);
+  if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr const*>(&address), sizeof(address))) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    throw std::runtime_error("Can not connect to `" + FLAGS_unix_socket + "`.");
+  }
+  return fd;
+}
+
+LocalBenchResult RunUnixSocket(std::vector<std::string> const& queries) {
+  int const fd = ConnectUnixSocket();
+  std::string line;
+  std::vector<char> buffer(1u << 16);
+  LocalBenchResult const result = RunWindowed(
+      queries,
+      [&](std::string const& query) {
+        line.assign(query);
+        line += '\n';
+        WriteAll(fd, line.data(), line.length());
+      },
+      [&]() -> size_t {
+        ssize_t const n = ::read(fd, buffer.data(), buffer.size());
+        if (n <= 0) {
+          throw std::runtime_error("The Unix socket connection was closed.");
+        }
+        return static_cast<size_t>(std::count(buffer.data(), buffer.data() + n, '\n'));
+      });
+  ::close(fd);
+  return result;
+}
+
+LocalBenchResult RunShmChannel(std::vector<std::string> const& queries) {
+  ShmPolicyClient client(FLAGS_shm_channel);
+  std::string response;
+  ShmChannelBackoff backoff;
+  return RunWindowed(
+      queries,
+      [&](std::string const& query) {
+        while (!client.TrySubmit(query)) {
+          backoff.Wait();
+        }
+        backoff.Reset();
+      },
+      [&]() -> size_t {
+        while (!client.TryReceive(response)) {
+          backoff.Wait();
+        }
+        backoff.Reset();
+        return 1u;
+      });
+}
+
+// The queries are encoded upfront, as a binary client would build its requests without any JSON.
+std::vector<std::string> EncodeBinaryRequests(std::vector<std::string> const& queries) {
+  std::vector<std::string> requests;
+  std::string payload;
+  for (std::string const& query : queries) {
+    payload.clear();
+    BinaryProtocolWriter writer(payload);
+    BinaryProtocolCodec<JSONValue>::Write(writer, ParseJSONUniversally(query), !FLAGS_binary_named);
+    requests.emplace_back();
+    AppendBinaryRequest(requests.back(), payload);
+  }
+  return requests;
+}
+
+// Connected and past the handshake.
+int ConnectBinary() {
+  int const fd = ConnectTCP("127.0.0.1", FLAGS_binary_port);
+  ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  WriteAll(fd, kBinaryProtocolMagic, sizeof(kBinaryProtocolMagic));
+  return fd;
+}
+
+LocalBenchResult RunBinary(std::vector<std::string> const& queries) {
+  std::vector<std::string> const requests = EncodeBinaryRequests(queries);
+  int const fd = ConnectBinary();
+  BinaryResponseStream responses;
+  size_t invalid = 0u;
+  std::vector<char> buffer(1u << 16);
+  LocalBenchResult const result = RunWindowed(
+      requests,
+      [fd](std::string const& request) { WriteAll(fd, request.data(), request.length()); },
+      [&]() -> size_t {
+        ssize_t const n = ::read(fd, buffer.data(), buffer.size());
+        if (n <= 0) {
+          throw std::runtime_error("The binary protocol connection was closed.");
+        }
+        return responses.Feed(buffer.data(), static_cast<size_t>(n), [&invalid](BinaryProtocolDecision d, auto) {
+          invalid += d == BinaryProtocolDecision::Invalid;
+        });
+      });
+  ::close(fd);
+  if (invalid) {
+    std::cerr << red << invalid << " binary requests were rejected as invalid." << reset
+              << (FLAGS_binary_named ? "" : " Is the server `transpiled`? Then run with `--binary_named`.")
+              << std::endl;
+  }
+  return result;
+}
+
+// Pipelines `--early_close` of the `requests` on a few connections of `connect()`, closing each without reading a
+// response, then checks that a new connection still gets its first request answered within a second.
+bool SurvivesEarlyClose(std::vector<std::string> const& requests, int (*connect)()) {
+  std::string pipelined;
+  for (uint32_t i = 0u; i < FLAGS_early_close; ++i) {
+    pipelined += requests[i % requests.size()];
+  }
+  try {
+    for (int round = 0; round < 3; ++round) {
+      int const fd = connect();
+      // Non-blocking, as the server stops reading once its responses fill the socket buffers.
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+      WriteAll(fd, pipelined.data(), pipelined.length());
+      ::close(fd);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    int const fd = connect();
+    timeval const timeout = {1, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char response;
+    bool const answered = WriteAll(fd, requests[0].data(), requests[0].length()) && ::read(fd, &response, 1u) == 1;
+    ::close(fd);
+    return answered;
+  } catch (std::exception const&) {
+    return false;
+  }
+}
+
+LocalBenchResult RunHTTP(std::vector<std::string> const& queries) {
+  std::vector<std::string> requests;
+  for (std::string const& query : queries) {
+    requests.push_back(BuildHTTPPostRequest("/v1/data/rbac/allow", query));
+  }
+  HTTPLoadConfig config;
+  config.port = FLAGS_port;
+  config.connections = 1u;
+  config.pipeline_depth = FLAGS_pipeline;
+  config.warmup_seconds = FLAGS_warmup;
+  config.duration_seconds = FLAGS_duration;
+  HTTPLoadResult const load = RunHTTPLoad(config, requests);
+  LocalBenchResult result;
+  result.requests = load.completed_in_window;
+  result.latency_ns = load.latency_ns;
+  return result;
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  std::vector<std::string> queries;
+  {
+    MMappedFile const file(FLAGS_queries);
+    LinesCursor lines(file.Contents());
+    std::string_view line;
+    while (lines.Next(line)) {
+      queries.emplace_back(line);
+    }
+  }
+  if (queries.empty()) {
+    std::cerr << "No queries in `" << FLAGS_queries << "`." << std::endl;
+    return 1;
+  }
+
+  if (FLAGS_early_close) {
+    bool survived = true;
+    auto const check = [&survived](char const* name, std::vector<std::string> const& requests, int (*connect)()) {
+      bool const ok = SurvivesEarlyClose(requests, connect);
+      if (ok) {
+        std::cout << name << ": " << green << "survived" << reset << " the clients closing early." << std::endl;
+      } else {
+        std::cout << name << ": " << red << "did not survive" << reset << " the clients closing early." << std::endl;
+      }
+      survived = survived && ok;
+    };
+    if (FLAGS_binary_port) {
+      check("binary", EncodeBinaryRequests(queries), ConnectBinary);
+    }
+    if (!FLAGS_unix_socket.empty()) {
+      std::vector<std::string> lines;
+      for (std::string const& query : queries) {
+        lines.push_back(query + '\n');
+      }
+      check("unix", lines, ConnectUnixSocket);
+    }
+    return survived ? 0 : 1;
+  }
+
+  std::cout << "  transport      req/s    mean_us     p50_us     p99_us" << std::endl;
+  auto const run = [&queries](char const* name, LocalBenchResult (*f)(std::vector<std::string> const&)) {
+    LocalBenchResult const r = f(queries);
+    std::printf("%11s %10.0f %10.3f %10.3f %10.3f\n",
+                name,
+                r.requests / FLAGS_duration,
+                r.latency_ns.Mean() * 1e-3,
+                r.latency_ns.Percentile(0.5) * 1e-3,
+                r.latency_ns.Percentile(0.99) * 1e-3);
+    std::fflush(stdout);
+  };
+  if (FLAGS_port) {
+    run("http", RunHTTP);
+  }
+  if (FLAGS_binary_port) {
+    run("binary", RunBinary);
+  }
+  if (!FLAGS_unix_socket.empty()) {
+    run("unix", RunUnixSocket);
+  }
+  if (!FLAGS_shm_channel.empty()) {
+    run("shm", RunShmChannel);
+  }
+}
@@ -7,8 +7,18 @@
 #include <thread>
 
 #include "current/blocks/http/api.h"
+#include "current/bricks/dflags/dflags.h"
+#include "current/bricks/file/file.h"
 #include "current/typesystem/serialization/json.h"
 
+#include "bench_stages.h"
+
+DEFINE_uint16(p, 8181u, "The port to listen on.");
+DEFINE_bool(d, true, "Ignored, as this binary always runs the HTTP server, accepted for uniformity with `transpiled`.");
+DEFINE_string(queries, "", "Set along with `--stages_json` to measure the in-process stages over these queries.");
+DEFINE_string(stages_json, "", "Set to write the in-process per-stage timings over `--queries` into this file.");
+DEFINE_string(data, "", "Set to replace the built-in data with this document, e.g. the one from `gen_workload`.");
+
 std::map<std::string, std::vector<std::string>> user_roles = {
   {"alice", {"eng", "web"}},
   {"bob", {"hr"}}
@@ -20,6 +30,16 @@ std::map<std::string, std::vector<std::pair<std::string, std::string>>> role_per
   {"hr", {{"read", "database456"}}}
 };
 
+CURRENT_STRUCT(RBACPermission) {
+  CURRENT_FIELD(action, std::string);
+  CURRENT_FIELD(object, std::string);
+};
+
+CURRENT_STRUCT(RBACData) {
+  CURRENT_FIELD(user_roles, (std::map<std::string, std::vector<std::string>>));
+  CURRENT_FIELD(role_permissions, (std::map<std::string, std::vector<RBACPermission>>));
+};
+
 CURRENT_STRUCT(OPARequest) {
   CURRENT_FIELD(user, std::string);
   CURRENT_FIELD(action, std::string);
@@ -34,26 +54,55 @@ CURRENT_STRUCT(OPAResult) {
   CURRENT_FIELD(result, bool, false);
 };
 
-int main() {
-  auto& http = HTTP(current::net::BarePort(8181));
-  auto const http_scope = http.Register("/", URLPathArgs::CountMask::Any, [](Request r) {
-    auto const in = ParseJSON<OPAInput>(r.body);
-    OPAResult out;
-    auto const cit = user_roles.find(in.input.user);
-    if (cit != user_roles.end()) {
-      for (auto const& role : cit->second) {
-        for (auto const& action_object : role_permissions[role]) {
-          if (action_object.first == in.input.action && action_object.second == in.input.object) {
-            out.result = true;
-            break;
-          }
-        }
-        if (out.result) {
+OPAResult Evaluate(OPARequest const& in) {
+  OPAResult out;
+  auto const cit = user_roles.find(in.user);
+  if (cit != user_roles.end()) {
+    for (auto const& role : cit->second) {
+      for (auto const& action_object : role_permissions[role]) {
+        if (action_object.first == in.action && action_object.second == in.object) {
+          out.result = true;
           break;
         }
       }
+      if (out.result) {
+        break;
+      }
+    }
+  }
+  return out;
+}
+
+void LoadData(std::string const& filename) {
+  auto data = ParseJSON<RBACData>(current::FileSystem::ReadFileAsString(filename));
+  user_roles = std::move(data.user_roles);
+  role_permissions.clear();
+  for (auto const& role : data.role_permissions) {
+    auto& permissions = role_permissions[role.first];
+    for (auto const& permission : role.second) {
+      permissions.emplace_back(permission.action, permission.object);
     }
-    r(out);
+  }
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+  if (!FLAGS_data.empty()) {
+    LoadData(FLAGS_data);
+  }
+  if (!FLAGS_stages_json.empty()) {
+    WriteBenchStages(FLAGS_stages_json,
+                     MeasureBenchStages(
+                         FLAGS_queries,
+                         [](std::string const& line) { return ParseJSON<OPAInput>(line); },
+                         [](OPAInput const& in) { return Evaluate(in.input); },
+                         [](OPAResult const& out) { return JSON(out); }));
+    return 0;
+  }
+  auto& http = HTTP(current::net::BarePort(FLAGS_p));
+  auto const http_scope = http.Register("/", URLPathArgs::CountMask::Any, [](Request r) {
+    auto const in = ParseJSON<OPAInput>(r.body);
+    r(Evaluate(in.input));
   });
   http.Join();
 }
@@ -7,8 +7,16 @@
 #include <thread>
 
 #include "current/blocks/http/api.h"
+#include "current/bricks/dflags/dflags.h"
 #include "current/typesystem/serialization/json.h"
 
+#include "bench_stages.h"
+
+DEFINE_uint16(p, 8181u, "The port to listen on.");
+DEFINE_bool(d, true, "Ignored, as this binary always runs the HTTP server, accepted for uniformity with `transpiled`.");
+DEFINE_string(queries, "", "Set along with `--stages_json` to measure the in-process stages over these queries.");
+DEFINE_string(stages_json, "", "Set to write the in-process per-stage timings over `--queries` into this file.");
+
 std::map<std::string, std::vector<std::string>> user_roles = {
   {"alice", {"eng", "web"}},
   {"bob", {"hr"}}
@@ -34,8 +42,22 @@ CURRENT_STRUCT(OPAResult) {
   CURRENT_FIELD(result, bool, false);
 };
 
-int main() {
-  auto& http = HTTP(current::net::BarePort(8181));
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+  if (!FLAGS_stages_json.empty()) {
+    WriteBenchStages(FLAGS_stages_json,
+                     MeasureBenchStages(
+                         FLAGS_queries,
+                         [](std::string const& line) { return ParseJSON<OPAInput>(line); },
+                         [](OPAInput const&) {
+                           OPAResult out;
+                           out.result = false;
+                           return out;
+                         },
+                         [](OPAResult const& out) { return JSON(out); }));
+    return 0;
+  }
+  auto& http = HTTP(current::net::BarePort(FLAGS_p));
   auto const http_scope = http.Register("/", URLPathArgs::CountMask::Any, [](Request r) {
     auto const unused_parsed_json = ParseJSON<OPAInput>(r.body);
     static_cast<void>(unused_parsed_json);
@@ -0,0 +1,82 @@
+// A read-only memory-mapped file, and a zero-copy cursor over its lines.
+
+#ifndef SLEIPNIR_MMAP_LINES_H
+#define SLEIPNIR_MMAP_LINES_H
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class MMappedFile final {
+ private:
+  int fd_ = -1;
+  void* data_ = nullptr;
+  size_t size_ = 0u;
+
+ public:
+  explicit MMappedFile(std::string const& filename) {
+    fd_ = ::open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      throw std::runtime_error("Can not open `" + filename + "`.");
+    }
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+      ::close(fd_);
+      throw std::runtime_error("Can not stat `" + filename + "`.");
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_) {
+      data_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (data_ == MAP_FAILED) {
+        ::close(fd_);
+        throw std::runtime_error("Can not mmap `" + filename + "`.");
+      }
+      ::madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+  }
+
+  ~MMappedFile() {
+    if (size_) {
+      ::munmap(data_, size_);
+    }
+    ::close(fd_);
+  }
+
+  MMappedFile(MMappedFile const&) = delete;
+  MMappedFile& operator=(MMappedFile const&) = delete;
+
+  std::string_view Contents() const { return std::string_view(static_cast<char const*>(data_), size_); }
+};
+
+// Yields the lines of the buffer without their `\n` or `\r\n`. The final newline, if present, does not start a line.
+class LinesCursor final {
+ private:
+  std::string_view const contents_;
+  size_t offset_ = 0u;
+
+ public:
+  explicit LinesCursor(std::string_view contents) : contents_(contents) {}
+
+  bool Next(std::string_view& line) {
+    if (offset_ >= contents_.length()) {
+      return false;
+    }
+    size_t end = contents_.find('\n', offset_);
+    if (end == std::string_view::npos) {
+      end = contents_.length();
+    }
+    line = contents_.substr(offset_, end - offset_);
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1u);
+    }
+    offset_ = end + 1u;
+    return true;
+  }
+};
+
+#endif  // SLEIPNIR_MMAP_LINES_H
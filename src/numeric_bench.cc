@@ -0,0 +1,146 @@
+// g++ -O3 -DNDEBUG -pthread -std=c++17 numeric_bench.cc -o numeric_bench
+//
+// The numeric runtime of the transpiled policies under an arithmetic-heavy rule, written as the transpiler emits it:
+//
+//   allow {
+//     total := sum([input.weights[i] * input.limits[j] - input.discounts[i] | j := numbers.range(0, n - 1)[i]])
+//     total == input.expected
+//   }
+//
+// with `n` the `count(input.weights)`. It evaluates `--inputs` random inputs of `--elements` numbers each: with the loop
+// keys and the sum as untyped `OPAValue`-s, whose numbers are `JSONNumber` doubles, as the integer-tagged `OPANumber`
+// locals, and, on top of the latter, with the range kept lazy, see `OPARange`, rather than materialized into an array.
+// Then it times `sum(numbers.range(1, --range))` alone, materialized and lazy. The runtime is that of `transpiled.cc`,
+// included as the in-process library does.
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#define SLEIPNIR_NO_MAIN
+#include "transpiled.cc"
+
+DEFINE_uint32(inputs, 1000u, "The number of random inputs.");
+DEFINE_uint32(elements, 64u, "The number of weights, limits and discounts per input.");
+DEFINE_uint32(magnitude, 1000u, "The numbers of the inputs are under this.");
+DEFINE_uint32(range, 1000000u, "The length of the range of the `sum(numbers.range(1, N))` benchmark.");
+DEFINE_uint32(repeat, 5u, "The number of passes over the inputs per representation, the fastest one reported.");
+
+// The `allow` of the rule above, with the loop key and the sum of type `K`, and the range of type `R`.
+template <typename K, typename R>
+bool Allow(OPAValue const& input) {
+  OPAValue x1;
+  OPAValue x2;
+  OPAValue x3;
+  R x4;
+  K x5;
+  OPAValue x6;
+  OPAValue x7;
+  OPAValue x8;
+  OPAValue x9;
+  K x10;
+  decltype(opa_mul(x7, x8)) x11;
+  decltype(opa_minus(x11, x9)) x12;
+  x1 = GetValueByKey(input, "weights");
+  x2 = GetValueByKey(input, "limits");
+  x3 = GetValueByKey(input, "discounts");
+  x4 = opa_range(OPAValue(0), opa_minus(OPAValue(static_cast<int>(Len(x1))), OPAValue(1)));
+  x10 = 0;
+  Scan(x4, x5, x6, [&]() {
+    x7 = GetValueByKey(x1, x5);
+    x8 = GetValueByKey(x2, x6);
+    x9 = GetValueByKey(x3, x5);
+    x11 = opa_mul(x7, x8);
+    x12 = opa_minus(x11, x9);
+    x10 = opa_plus(x10, x12);
+  });
+  return AreLocalsEqual(x10, GetValueByKey(input, "expected"));
+}
+
+// `sum(numbers.range(1, n))`, with the range of type `R`, and its elements as numbers if it is lazy.
+template <typename R>
+bool SumOfRange(OPAValue const& n) {
+  R x1;
+  OPANumber x2;
+  std::conditional_t<std::is_same_v<R, OPARange>, OPANumber, OPAValue> x3;
+  OPANumber x4;
+  x1 = opa_range(OPAValue(1), n);
+  x4 = 0;
+  Scan(x1, x2, x3, [&]() { x4 = opa_plus(x4, x3); });
+  int64_t const m = static_cast<int64_t>(Value(NumberOf(n)));
+  return AreLocalsEqual(x4, OPANumber(m * (m + 1) / 2));
+}
+
+// Evaluates all of `inputs` `--repeat` times, and reports the best nanoseconds per input and the number of `allow`-s.
+template <class F>
+void Measure(char const* name, std::vector<OPAValue> const& inputs, size_t elements, F&& f) {
+  double best_ns = 0.0;
+  size_t allowed = 0u;
+  for (uint32_t r = 0u; r < std::max(FLAGS_repeat, 1u); ++r) {
+    auto const t0 = std::chrono::steady_clock::now();
+    allowed = 0u;
+    for (OPAValue const& input : inputs) {
+      allowed += f(input);
+    }
+    auto const t1 = std::chrono::steady_clock::now();
+    double const ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / inputs.size();
+    best_ns = r ? std::min(best_ns, ns) : ns;
+  }
+  std::printf("%22s %12.1f %12.2f %10zu\n", name, best_ns, best_ns / elements, allowed);
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  if (!FLAGS_inputs || !FLAGS_elements || !FLAGS_magnitude) {
+    std::cerr << "The `--inputs`, `--elements` and `--magnitude` must be positive." << std::endl;
+    return 1;
+  }
+
+  std::mt19937_64 random(42u);
+  std::uniform_int_distribution<int64_t> number(0, static_cast<int64_t>(FLAGS_magnitude) - 1);
+  std::vector<OPAValue> inputs;
+  inputs.reserve(FLAGS_inputs);
+  for (uint32_t i = 0u; i < FLAGS_inputs; ++i) {
+    JSONArray weights;
+    JSONArray limits;
+    JSONArray discounts;
+    int64_t expected = 0;
+    for (uint32_t j = 0u; j < FLAGS_elements; ++j) {
+      int64_t const w = number(random);
+      int64_t const l = number(random);
+      int64_t const d = number(random);
+      weights.push_back(JSONNumber(static_cast<double>(w)));
+      limits.push_back(JSONNumber(static_cast<double>(l)));
+      discounts.push_back(JSONNumber(static_cast<double>(d)));
+      expected += w * l - d;
+    }
+    JSONObject input;
+    input.push_back("weights", weights);
+    input.push_back("limits", limits);
+    input.push_back("discounts", discounts);
+    input.push_back("expected", JSONNumber(static_cast<double>(expected)));
+    inputs.push_back(OPAValue(JSONValue(input)));
+  }
+
+  std::cout << "Over " << FLAGS_inputs << " inputs of " << FLAGS_elements << " elements:" << std::endl;
+  std::cout << "   keys and sum, range     ns/input   ns/element    allowed" << std::endl;
+  Measure("OPAValue, array", inputs, FLAGS_elements, [](OPAValue const& input) {
+    return Allow<OPAValue, OPAValue>(input);
+  });
+  Measure("OPANumber, array", inputs, FLAGS_elements, [](OPAValue const& input) {
+    return Allow<OPANumber, OPAValue>(input);
+  });
+  Measure("OPANumber, lazy", inputs, FLAGS_elements, [](OPAValue const& input) {
+    return Allow<OPANumber, OPARange>(input);
+  });
+
+  std::vector<OPAValue> const range = {OPAValue(static_cast<double>(FLAGS_range))};
+  std::cout << "Over `sum(numbers.range(1, " << FLAGS_range << "))`:" << std::endl;
+  std::cout << "                 range       ns/sum   ns/element    allowed" << std::endl;
+  Measure("array", range, FLAGS_range, [](OPAValue const& n) { return SumOfRange<OPAValue>(n); });
+  Measure("lazy", range, FLAGS_range, [](OPAValue const& n) { return SumOfRange<OPARange>(n); });
+}
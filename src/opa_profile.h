@@ -0,0 +1,143 @@
+// Opt-in per-rule profiling of the transpiled policies.
+//
+// Build with `-DOPA_PROFILE` to have each `function_body_N` and each `Scan` site count its calls, its iterations, and
+// the CPU ticks spent in it, inclusive of what it calls. The counters are per thread, see `per_thread.h`, and are
+// summed up only by `OPAProfile::Report()`. Without `-DOPA_PROFILE`, `OPAProfile` is `OPAProfiler<false>`, whose
+// sites and scopes are empty, and the instrumentation compiles away entirely.
+
+#ifndef SLEIPNIR_OPA_PROFILE_H
+#define SLEIPNIR_OPA_PROFILE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "per_thread.h"
+
+#ifdef OPA_PROFILE
+constexpr static bool kOPAProfilingEnabled = true;
+#else
+constexpr static bool kOPAProfilingEnabled = false;
+#endif
+
+template <bool ENABLED>
+class OPAProfiler;
+
+template <>
+class OPAProfiler<false> final {
+ public:
+  struct Site final {
+    constexpr explicit Site(char const*) {}
+  };
+  struct Scope final {
+    constexpr explicit Scope(Site const&) {}
+    void Iteration() {}
+  };
+  static std::string Report() { return "Profiling is compiled out, rebuild with `-DOPA_PROFILE`.\n"; }
+};
+
+template <>
+class OPAProfiler<true> final {
+ private:
+  constexpr static size_t kMaxSites = 256u;
+
+  struct SiteCounters final {
+    LocalCounter calls;
+    LocalCounter iterations;
+    LocalCounter ticks;
+  };
+
+  struct ThreadCounters final {
+    SiteCounters sites[kMaxSites];
+    void Absorb(ThreadCounters const& other) {
+      for (size_t i = 0u; i < kMaxSites; ++i) {
+        sites[i].calls.Add(other.sites[i].calls.Load());
+        sites[i].iterations.Add(other.sites[i].iterations.Load());
+        sites[i].ticks.Add(other.sites[i].ticks.Load());
+      }
+    }
+  };
+
+  // The sites are registered during the static initialization, before any thread could be profiling.
+  static std::vector<char const*>& SiteNames() {
+    static std::vector<char const*> names;
+    return names;
+  }
+
+ public:
+  class Site final {
+   private:
+    size_t const index_;
+
+   public:
+    explicit Site(char const* name) : index_(SiteNames().size()) {
+      if (index_ >= kMaxSites) {
+        std::cerr << "More than " << kMaxSites << " profiling sites." << std::endl;
+        std::abort();
+      }
+      SiteNames().push_back(name);
+    }
+    size_t Index() const { return index_; }
+  };
+
+  class Scope final {
+   private:
+    SiteCounters& counters_;
+    uint64_t const begin_;
+    uint64_t iterations_ = 0u;
+
+   public:
+    explicit Scope(Site const& site)
+        : counters_(PerThread<ThreadCounters>::Local().sites[site.Index()]), begin_(CPUTicks()) {}
+    void Iteration() { ++iterations_; }
+    ~Scope() {
+      counters_.calls.Add(1u);
+      counters_.iterations.Add(iterations_);
+      counters_.ticks.Add(CPUTicks() - begin_);
+    }
+  };
+
+  // A text table of all the sites, the most expensive first.
+  static std::string Report() {
+    std::vector<char const*> const& names = SiteNames();
+    struct Row final {
+      char const* name;
+      uint64_t calls = 0u;
+      uint64_t iterations = 0u;
+      uint64_t ticks = 0u;
+    };
+    std::vector<Row> rows(names.size());
+    for (size_t i = 0u; i < names.size(); ++i) {
+      rows[i].name = names[i];
+    }
+    PerThread<ThreadCounters>::ForEach([&rows](ThreadCounters const& counters) {
+      for (size_t i = 0u; i < rows.size(); ++i) {
+        rows[i].calls += counters.sites[i].calls.Load();
+        rows[i].iterations += counters.sites[i].iterations.Load();
+        rows[i].ticks += counters.sites[i].ticks.Load();
+      }
+    });
+    std::stable_sort(rows.begin(), rows.end(), [](Row const& a, Row const& b) { return a.ticks > b.ticks; });
+    std::string report = "                          site        calls   iterations        ticks   ticks/call\n";
+    for (Row const& row : rows) {
+      char line[256];
+      std::snprintf(line,
+                    sizeof(line),
+                    "%30s %12llu %12llu %12llu %12.1f\n",
+                    row.name,
+                    static_cast<unsigned long long>(row.calls),
+                    static_cast<unsigned long long>(row.iterations),
+                    static_cast<unsigned long long>(row.ticks),
+                    row.calls ? 1.0 * row.ticks / row.calls : 0.0);
+      report += line;
+    }
+    return report;
+  }
+};
+
+using OPAProfile = OPAProfiler<kOPAProfilingEnabled>;
+
+#endif  // SLEIPNIR_OPA_PROFILE_H
@@ -0,0 +1,157 @@
+// A staged, multi-threaded, order-preserving line processor.
+//
+// The reader thread reads large blocks and cuts them into chunks of whole lines, the worker threads process chunks
+// in parallel, and the writer thread emits their outputs strictly in input order, one `write()` per chunk.
+// At most `max_chunks_in_flight` chunks exist at any moment, which bounds the memory used.
+
+#ifndef SLEIPNIR_ORDERED_PIPELINE_H
+#define SLEIPNIR_ORDERED_PIPELINE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+struct OrderedPipelineConfig final {
+  size_t threads = 0u;  // Zero stands for `std::thread::hardware_concurrency()`.
+  size_t chunk_bytes = 1u << 20;
+  size_t max_chunks_in_flight = 0u;  // Zero stands for four chunks per worker thread.
+};
+
+// Calls `process(lines, output)` for each chunk, where `lines` is an `std::vector<std::string_view>` with no
+// trailing newlines, and `output` is an empty `std::string` to append the output of this chunk to.
+// Returns once `in_fd` is exhausted and all the outputs have been written into `out_fd`.
+template <class F>
+void RunOrderedLinePipeline(int in_fd, int out_fd, OrderedPipelineConfig config, F&& process) {
+  size_t const threads = config.threads ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+  size_t const max_in_flight = config.max_chunks_in_flight ? config.max_chunks_in_flight : threads * 4u;
+
+  struct Chunk final {
+    size_t index;
+    std::string data;
+  };
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Chunk> pending;
+  std::map<size_t, std::string> done;
+  size_t in_flight = 0u;
+  size_t next_to_write = 0u;
+  size_t total_chunks = 0u;
+  bool reader_done = false;
+
+  std::thread reader([&]() {
+    std::string carry;
+    std::vector<char> buffer(config.chunk_bytes);
+    size_t index = 0u;
+    auto const push = [&](std::string data) {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&]() { return in_flight < max_in_flight; });
+      ++in_flight;
+      pending.push_back(Chunk{index++, std::move(data)});
+      cv.notify_all();
+    };
+    while (true) {
+      ssize_t const n = ::read(in_fd, buffer.data(), buffer.size());
+      if (n <= 0) {
+        break;
+      }
+      carry.append(buffer.data(), static_cast<size_t>(n));
+      size_t const last_newline = carry.rfind('\n');
+      if (last_newline != std::string::npos) {
+        std::string rest = carry.substr(last_newline + 1u);
+        carry.resize(last_newline + 1u);
+        push(std::move(carry));
+        carry = std::move(rest);
+      }
+    }
+    if (!carry.empty()) {
+      push(std::move(carry));
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    total_chunks = index;
+    reader_done = true;
+    cv.notify_all();
+  });
+
+  std::vector<std::thread> workers;
+  for (size_t t = 0u; t < threads; ++t) {
+    workers.emplace_back([&]() {
+      std::vector<std::string_view> lines;
+      while (true) {
+        Chunk chunk;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&]() { return !pending.empty() || reader_done; });
+          if (pending.empty()) {
+            return;
+          }
+          chunk = std::move(pending.front());
+          pending.pop_front();
+        }
+        lines.clear();
+        std::string_view const data(chunk.data);
+        for (size_t begin = 0u; begin < data.length();) {
+          size_t end = data.find('\n', begin);
+          if (end == std::string_view::npos) {
+            end = data.length();
+          }
+          std::string_view line = data.substr(begin, end - begin);
+          if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1u);
+          }
+          lines.push_back(line);
+          begin = end + 1u;
+        }
+        std::string output;
+        process(lines, output);
+        std::lock_guard<std::mutex> lock(mutex);
+        done.emplace(chunk.index, std::move(output));
+        cv.notify_all();
+      }
+    });
+  }
+
+  std::thread writer([&]() {
+    while (true) {
+      std::string output;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() {
+          return (!done.empty() && done.begin()->first == next_to_write) || (reader_done && next_to_write == total_chunks);
+        });
+        if (done.empty() || done.begin()->first != next_to_write) {
+          return;
+        }
+        output = std::move(done.begin()->second);
+        done.erase(done.begin());
+      }
+      for (size_t offset = 0u; offset < output.length();) {
+        ssize_t const n = ::write(out_fd, output.data() + offset, output.length() - offset);
+        if (n <= 0) {
+          break;
+        }
+        offset += static_cast<size_t>(n);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      ++next_to_write;
+      --in_flight;
+      cv.notify_all();
+    }
+  });
+
+  reader.join();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  writer.join();
+}
+
+#endif  // SLEIPNIR_ORDERED_PIPELINE_H
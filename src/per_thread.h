@@ -0,0 +1,88 @@
+// Per-thread counters that cost a plain load and store to update, and are only summed up when read.
+//
+// Each thread lazily gets its own instance of `T`, registered in a global list under a mutex once per thread.
+// The owner thread is the only writer of its instance, so `LocalCounter::Add()` needs no read-modify-write atomics;
+// the relaxed atomics are there only to make the concurrent reads from `ForEach()` well-defined.
+// When a thread exits, its counts are folded into a retired instance, so that nothing is lost or leaked.
+// `CPUTicks()` is the matching cheap clock, for the counters that accumulate time.
+
+#ifndef SLEIPNIR_PER_THREAD_H
+#define SLEIPNIR_PER_THREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// The time stamp counter where available, nanoseconds otherwise.
+inline uint64_t CPUTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+class LocalCounter final {
+ private:
+  std::atomic<uint64_t> value_{0u};
+
+ public:
+  void Add(uint64_t delta) { value_.store(value_.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed); }
+  uint64_t Load() const { return value_.load(std::memory_order_relaxed); }
+};
+
+// `T` must be default-constructible, and have `void Absorb(T const& other)` to add the counts of `other` to its own.
+template <class T>
+class PerThread final {
+ private:
+  struct Registry final {
+    std::mutex mutex;
+    std::unordered_set<T*> live;
+    T retired;
+  };
+  // Never destroyed, as the threads may outlive the static destructors.
+  static Registry& GetRegistry() {
+    static Registry* registry = new Registry();
+    return *registry;
+  }
+
+  struct Holder final {
+    T instance;
+    Holder() {
+      Registry& registry = GetRegistry();
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      registry.live.insert(&instance);
+    }
+    ~Holder() {
+      Registry& registry = GetRegistry();
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      registry.retired.Absorb(instance);
+      registry.live.erase(&instance);
+    }
+  };
+
+ public:
+  static T& Local() {
+    thread_local Holder holder;
+    return holder.instance;
+  }
+
+  // Calls `f(T const&)` for the instance of each live thread, and for the one with the counts of the exited threads.
+  template <class F>
+  static void ForEach(F&& f) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    f(static_cast<T const&>(registry.retired));
+    for (T const* instance : registry.live) {
+      f(*instance);
+    }
+  }
+};
+
+#endif  // SLEIPNIR_PER_THREAD_H
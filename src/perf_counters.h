@@ -0,0 +1,148 @@
+// Hardware performance counters around a stage of the `--queries` mode, via a `perf_event_open` group.
+// Counts cycles, instructions, L1D read misses, LLC misses and branch misses of the calling thread, in user space only.
+// Containers and VMs often do not expose some or all of them; the missing ones are reported as such, and the run goes on.
+
+#ifndef SLEIPNIR_PERF_COUNTERS_H
+#define SLEIPNIR_PERF_COUNTERS_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "current/blocks/xterm/vt100.h"
+#include "current/bricks/strings/strings.h"
+
+class PerfCounters final {
+ public:
+  enum Counter : size_t { Cycles = 0u, Instructions, L1DMisses, LLCMisses, BranchMisses, Count };
+
+ private:
+  struct Spec final {
+    char const* name;
+    uint32_t type;
+    uint64_t config;
+  };
+  static Spec const& Describe(size_t i) {
+    static Spec const specs[Count] = {
+        {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {"L1D misses",
+         PERF_TYPE_HW_CACHE,
+         PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {"LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+    return specs[i];
+  }
+
+  int fd_[Count];
+  size_t index_[Count];  // The position of each counter in the group read, valid if `fd_[i] >= 0`.
+  size_t opened_ = 0u;
+  uint64_t totals_[Count] = {};
+  std::string error_;
+
+  static int Open(Spec const& spec, int group_fd) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = spec.type;
+    attr.config = spec.config;
+    attr.disabled = group_fd < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+  }
+
+ public:
+  // The cycles counter leads the group; without it there is nothing to measure, and `Available()` is false.
+  PerfCounters() {
+    for (size_t i = 0u; i < Count; ++i) {
+      fd_[i] = Open(Describe(i), i ? fd_[Cycles] : -1);
+      if (fd_[i] >= 0) {
+        index_[i] = opened_++;
+      } else if (!i) {
+        error_ = std::strerror(errno);
+        for (size_t j = 1u; j < Count; ++j) {
+          fd_[j] = -1;
+        }
+        break;
+      }
+    }
+  }
+
+  ~PerfCounters() {
+    for (int fd : fd_) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+
+  PerfCounters(PerfCounters const&) = delete;
+  PerfCounters& operator=(PerfCounters const&) = delete;
+
+  bool Available() const { return fd_[Cycles] >= 0; }
+  bool Has(Counter c) const { return fd_[c] >= 0; }
+  std::string const& Error() const { return error_; }
+  uint64_t Total(Counter c) const { return totals_[c]; }
+
+  void Start() {
+    if (Available()) {
+      ::ioctl(fd_[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ::ioctl(fd_[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+  }
+
+  // Adds the counts since the last `Start()` to the totals, scaled up if the kernel had to multiplex the group.
+  void Stop() {
+    if (!Available()) {
+      return;
+    }
+    ::ioctl(fd_[Cycles], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    uint64_t buffer[3 + Count];
+    if (::read(fd_[Cycles], buffer, sizeof(buffer)) < static_cast<ssize_t>(sizeof(uint64_t) * (3 + opened_))) {
+      return;
+    }
+    uint64_t const enabled = buffer[1];
+    uint64_t const running = buffer[2];
+    double const scale = running ? static_cast<double>(enabled) / running : 0.0;
+    for (size_t i = 0u; i < Count; ++i) {
+      if (fd_[i] >= 0) {
+        totals_[i] += static_cast<uint64_t>(buffer[3 + index_[i]] * scale);
+      }
+    }
+  }
+
+  // Prints IPC and the per-query counts, e.g. `Parse: IPC 2.31, 1841.2 cycles, 4253.7 instructions, ... per query.`
+  void Print(char const* title, size_t n) const {
+    using namespace current::vt100;
+    if (!Available() || !n) {
+      return;
+    }
+    auto const per_query = [n](uint64_t x) { return current::strings::RoundDoubleToString(1.0 * x / n, 3); };
+    std::cout << title;
+    if (Has(Instructions) && totals_[Cycles]) {
+      std::cout << "IPC " << bold << magenta
+                << current::strings::RoundDoubleToString(1.0 * totals_[Instructions] / totals_[Cycles], 3) << reset
+                << ", ";
+    }
+    for (size_t i = 0u; i < Count; ++i) {
+      if (i) {
+        std::cout << ", ";
+      }
+      std::cout << (Has(static_cast<Counter>(i)) ? per_query(totals_[i]) : std::string("n/a")) << ' '
+                << Describe(i).name;
+    }
+    std::cout << " per query." << std::endl;
+  }
+};
+
+#endif  // SLEIPNIR_PERF_COUNTERS_H
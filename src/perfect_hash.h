@@ -0,0 +1,145 @@
+// A static perfect hash table from strings, built once at startup, so that a lookup is one hash of the key, two array
+// reads, and one comparison, with no probing and no chains.
+//
+// It is "hash and displace": the keys are grouped into buckets by their hash, and, from the largest bucket down, each
+// bucket gets the smallest seed that sends all its keys into free slots. A lookup remixes the hash of the key with the
+// seed of its bucket to find its slot, and then compares the key, so that unknown keys are told apart.
+
+#ifndef SLEIPNIR_PERFECT_HASH_H
+#define SLEIPNIR_PERFECT_HASH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class PerfectHashTable final {
+ private:
+  constexpr static uint32_t kEmpty = static_cast<uint32_t>(-1);
+
+  std::vector<uint32_t> seeds_;   // Per bucket.
+  std::vector<uint32_t> slots_;   // Indexes into `entries_`, or `kEmpty`.
+  std::vector<std::pair<std::string, T>> entries_;
+  uint64_t mask_ = 0u;
+  uint64_t bucket_mask_ = 0u;
+
+  // Hashes to buckets by the higher bits, which the hashes to slots, by the remixed lower bits, are independent of.
+  uint64_t BucketOf(uint64_t h) const { return (h >> 40) & bucket_mask_; }
+
+  // Eight bytes at a time; the key is short, and the remixing with the seed does the avalanche.
+  static uint64_t Hash(std::string_view key) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ key.length();
+    size_t i = 0u;
+    for (; i + 8u <= key.length(); i += 8u) {
+      uint64_t word;
+      std::memcpy(&word, key.data() + i, 8u);
+      h = (h ^ word) * 0xff51afd7ed558ccdull;
+      h ^= h >> 32;
+    }
+    if (i < key.length()) {
+      // Byte by byte, as a `memcpy()` of a variable length is a call, which costs more than the whole lookup otherwise.
+      uint64_t word = 0u;
+      for (size_t j = i; j < key.length(); ++j) {
+        word |= static_cast<uint64_t>(static_cast<uint8_t>(key[j])) << (8u * (j - i));
+      }
+      h = (h ^ word) * 0xff51afd7ed558ccdull;
+      h ^= h >> 32;
+    }
+    return h;
+  }
+  static uint64_t Mix(uint64_t h, uint32_t seed) {
+    h ^= seed * 0x9e3779b97f4a7c15ull;  // The finalizer of SplitMix64.
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+  }
+
+ public:
+  PerfectHashTable() = default;
+
+  // Throws on duplicate keys, or on the astronomically unlikely collision of the 64-bit hashes of two keys.
+  explicit PerfectHashTable(std::vector<std::pair<std::string, T>> entries) : entries_(std::move(entries)) {
+    size_t const n = entries_.size();
+    size_t slots = 1u;
+    while (slots < 2u * n) {
+      slots <<= 1;
+    }
+    mask_ = slots - 1u;
+    slots_.assign(slots, kEmpty);
+    size_t buckets_count = 1u;
+    while (buckets_count < n / 2u) {
+      buckets_count <<= 1;
+    }
+    bucket_mask_ = buckets_count - 1u;
+    seeds_.assign(buckets_count, 0u);
+
+    std::vector<uint64_t> hashes(n);
+    std::vector<std::vector<uint32_t>> buckets(seeds_.size());
+    for (size_t i = 0u; i < n; ++i) {
+      hashes[i] = Hash(entries_[i].first);
+      buckets[BucketOf(hashes[i])].push_back(static_cast<uint32_t>(i));
+    }
+    std::vector<uint64_t> sorted(hashes);
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+      throw std::invalid_argument("Duplicate keys in the perfect hash table.");
+    }
+    std::vector<uint32_t> order(buckets.size());
+    for (uint32_t b = 0u; b < order.size(); ++b) {
+      order[b] = b;
+    }
+    std::sort(order.begin(), order.end(), [&buckets](uint32_t a, uint32_t b) {
+      return buckets[a].size() > buckets[b].size();
+    });
+
+    std::vector<uint64_t> taken;
+    for (uint32_t const b : order) {
+      std::vector<uint32_t> const& keys = buckets[b];
+      if (keys.empty()) {
+        break;
+      }
+      // Terminates, as the hashes are distinct, and each bucket has but a few keys for the half empty table.
+      for (uint32_t seed = 0u;; ++seed) {
+        taken.clear();
+        bool fits = true;
+        for (uint32_t const i : keys) {
+          uint64_t const slot = Mix(hashes[i], seed) & mask_;
+          if (slots_[slot] != kEmpty || std::find(taken.begin(), taken.end(), slot) != taken.end()) {
+            fits = false;
+            break;
+          }
+          taken.push_back(slot);
+        }
+        if (fits) {
+          seeds_[b] = seed;
+          for (size_t k = 0u; k < keys.size(); ++k) {
+            slots_[taken[k]] = keys[k];
+          }
+          break;
+        }
+      }
+    }
+  }
+
+  // Returns `nullptr` for the keys not in the table.
+  T const* Find(std::string_view key) const {
+    if (entries_.empty()) {
+      return nullptr;
+    }
+    uint64_t const h = Hash(key);
+    uint32_t const index = slots_[Mix(h, seeds_[BucketOf(h)]) & mask_];
+    if (index == kEmpty || entries_[index].first != key) {
+      return nullptr;
+    }
+    return &entries_[index].second;
+  }
+
+  std::vector<std::pair<std::string, T>> const& Entries() const { return entries_; }
+};
+
+#endif  // SLEIPNIR_PERFECT_HASH_H
@@ -0,0 +1,214 @@
+// g++ -O3 -DNDEBUG -pthread -std=c++17 policy_host.cc -o policy_host -ldl
+//
+// The host server of hot-swappable policies: serves the policy module from `--module`, a shared object built from
+// `capi/sleipnir_policy.cc`, and switches to a new version on `POST /admin/policy`, with no restart and no dropped
+// connections. The new version is loaded and warmed up with `--warmup_queries` on the side, then swapped in atomically,
+// while the requests in flight on the previous version complete on it.
+//
+// The admin endpoint is served on `--admin_port`, on the loopback interface only, and rolls out `--module`, or the
+// modules in `--module_dir`, and nothing else, as loading a module runs its code.
+//
+// With `--rollout_bench N`, runs the queries against itself instead, rolling out `--module` again `N` times while
+// doing so, and reports the evaluation latencies, to show what a rollout costs the requests.
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#include "current/blocks/http/api.h"
+#include "current/blocks/xterm/vt100.h"
+#include "current/bricks/dflags/dflags.h"
+#include "current/bricks/file/file.h"
+
+#include "http_load.h"
+#include "mmap_lines.h"
+#include "policy_module.h"
+#include "thread_per_core_server.h"
+
+using namespace current::vt100;
+
+DEFINE_string(module, "libsleipnir_policy.so", "The policy module to serve first, and to roll out by default.");
+DEFINE_string(data, "", "The file of the `data` document for the policy, in JSON, if any.");
+DEFINE_uint16(p, 8181u, "The port to serve `/` on.");
+DEFINE_uint16(admin_port, 8180u, "The port to serve `/admin/policy` on, on the loopback interface only.");
+DEFINE_string(module_dir, "", "Set to also allow `/admin/policy` to roll out the modules in this directory.");
+DEFINE_string(warmup_queries, "", "The `{\"input\":{...}}` queries to warm up each new version with, one per line.");
+DEFINE_uint32(warmup_rounds, 3u, "The number of passes over `--warmup_queries` per new version.");
+DEFINE_uint32(rollout_bench, 0u, "Set to benchmark this many rollouts under a local load, instead of serving.");
+DEFINE_uint32(bench_threads, 2u, "The number of threads to evaluate `--warmup_queries` on in `--rollout_bench`.");
+DEFINE_double(bench_interval, 0.25, "The number of seconds between the rollouts in `--rollout_bench`.");
+
+CURRENT_STRUCT(PolicyHostStatus) {
+  CURRENT_FIELD(version, uint64_t);
+  CURRENT_FIELD(path, std::string);
+};
+
+CURRENT_STRUCT(PolicyHostRollout) {
+  CURRENT_FIELD(version, uint64_t);
+  CURRENT_FIELD(path, std::string);
+  CURRENT_FIELD(load_ms, double);
+  CURRENT_FIELD(warmup_ms, double);
+  CURRENT_FIELD(drain_ms, double);
+};
+
+void PrintRollout(std::string const& path, PolicyRollout const& rollout) {
+  std::cout << "Rolled out " << cyan << path << reset << " as version " << magenta << rollout.version << reset
+            << ": loaded in " << current::strings::RoundDoubleToString(rollout.load_ms, 3) << "ms, warmed up in "
+            << current::strings::RoundDoubleToString(rollout.warmup_ms, 3) << "ms, the previous version drained in "
+            << current::strings::RoundDoubleToString(rollout.drain_ms, 3) << "ms." << std::endl;
+}
+
+// Evaluates the queries round-robin on `--bench_threads` threads, while the main thread rolls out `--module` again and
+// again. The latencies of the evaluations that overlap a swap, or follow it closely, are reported separately.
+int RunRolloutBench(PolicyModuleRegistry& registry,
+                    std::string const& data_json,
+                    std::vector<std::string> const& queries) {
+  constexpr static uint64_t kAfterSwapNS = 10'000'000u;
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> last_swap_ns{0u};
+  std::vector<LatencyHistogram> steady(FLAGS_bench_threads);
+  std::vector<LatencyHistogram> swapping(FLAGS_bench_threads);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0u; t < FLAGS_bench_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      std::string result;
+      for (size_t i = t; !done.load(std::memory_order_relaxed); i = (i + 1u) % queries.size()) {
+        uint64_t const t0 = LoadNowNS();
+        registry.Current()->Evaluate(queries[i], result);
+        uint64_t const t1 = LoadNowNS();
+        uint64_t const swap = last_swap_ns.load(std::memory_order_relaxed);
+        (swap && t1 >= swap && t0 < swap + kAfterSwapNS ? swapping[t] : steady[t]).Record(t1 - t0);
+      }
+    });
+  }
+  for (uint32_t i = 0u; i < FLAGS_rollout_bench; ++i) {
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<uint64_t>(FLAGS_bench_interval * 1e6)));
+    uint64_t const t0 = LoadNowNS();
+    PolicyRollout const rollout = registry.Load(FLAGS_module, data_json, queries, FLAGS_warmup_rounds);
+    // The swap itself is right before the drain, which is the last stage of the rollout.
+    last_swap_ns.store(std::max(t0, LoadNowNS() - static_cast<uint64_t>(rollout.drain_ms * 1e6)));
+    PrintRollout(FLAGS_module, rollout);
+  }
+  std::this_thread::sleep_for(std::chrono::microseconds(static_cast<uint64_t>(FLAGS_bench_interval * 1e6)));
+  done = true;
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (uint32_t t = 1u; t < FLAGS_bench_threads; ++t) {
+    steady[0].Merge(steady[t]);
+    swapping[0].Merge(swapping[t]);
+  }
+  std::cout << "                 evaluations     p50_us     p99_us   p99.9_us     max_us" << std::endl;
+  auto const print = [](char const* name, LatencyHistogram const& h) {
+    std::printf("%16s %12llu %10.3f %10.3f %10.3f %10.3f\n",
+                name,
+                static_cast<unsigned long long>(h.Count()),
+                h.Percentile(0.5) * 1e-3,
+                h.Percentile(0.99) * 1e-3,
+                h.Percentile(0.999) * 1e-3,
+                h.Max() * 1e-3);
+  };
+  print("steady", steady[0]);
+  print("after a rollout", swapping[0]);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  std::string const data_json = FLAGS_data.empty() ? std::string() : current::FileSystem::ReadFileAsString(FLAGS_data);
+  std::vector<std::string> warmup_queries;
+  if (!FLAGS_warmup_queries.empty()) {
+    MMappedFile const file(FLAGS_warmup_queries);
+    LinesCursor lines(file.Contents());
+    std::string_view line;
+    while (lines.Next(line)) {
+      warmup_queries.emplace_back(line);
+    }
+  }
+
+  PolicyModuleRegistry registry;
+  try {
+    PrintRollout(FLAGS_module, registry.Load(FLAGS_module, data_json, warmup_queries, FLAGS_warmup_rounds));
+  } catch (std::exception const& e) {
+    std::cerr << red << e.what() << reset << std::endl;
+    return 1;
+  }
+
+  if (FLAGS_rollout_bench) {
+    if (warmup_queries.empty()) {
+      std::cerr << "The `--rollout_bench` mode requires `--warmup_queries`." << std::endl;
+      return 1;
+    }
+    return RunRolloutBench(registry, data_json, warmup_queries);
+  }
+
+  auto& http = HTTP(current::net::BarePort(FLAGS_p));
+  HTTPRoutesScope http_routes;
+  http_routes += http.Register("/", URLPathArgs::CountMask::Any, [&registry](Request r) {
+    thread_local std::string result;
+    std::shared_ptr<PolicyModule const> const module = registry.Current();
+    int const decision = module->Evaluate(r.body, result);
+    if (decision == SLEIPNIR_INVALID_INPUT) {
+      r("Synopsis: `{\"input\":{...}}`.\n", HTTPResponseCode.BadRequest);
+    } else if (decision < 0) {
+      r("Policy evaluation failed.\n", HTTPResponseCode.InternalServerError);
+    } else {
+      r("{\"result\":" + result + '}',
+        HTTPResponseCode.OK,
+        current::net::http::Headers(),
+        current::net::constants::kDefaultJSONContentType);
+    }
+  });
+  // `GET` returns the version served, `POST` rolls out the module at the path in the body, or `--module` if empty.
+  ThreadPerCoreConfig admin_config;
+  admin_config.threads = 1u;
+  admin_config.pin = false;
+  admin_config.address = "127.0.0.1";
+  ThreadPerCoreHTTPServer admin(
+      FLAGS_admin_port,
+      admin_config,
+      [&registry, &data_json, &warmup_queries](HTTPServerRequest const& request, HTTPServerResponse& response) {
+        if (request.path != "/admin/policy") {
+          response.status = 404;
+          response.content_type = "text/plain";
+          response.body = "Only `/admin/policy` is served here.\n";
+        } else if (request.method == "GET") {
+          std::shared_ptr<PolicyModule const> const module = registry.Current();
+          PolicyHostStatus status;
+          status.version = module->Version();
+          status.path = module->Path();
+          response.body = JSON(status);
+        } else if (request.method == "POST") {
+          std::string const path = request.body.empty() ? FLAGS_module : std::string(request.body);
+          response.content_type = "text/plain";
+          if (!IsAllowedPolicyModule(path, FLAGS_module, FLAGS_module_dir)) {
+            response.status = 403;
+            response.body = "Only `--module`, or the modules in `--module_dir`, can be rolled out.\n";
+            return;
+          }
+          try {
+            PolicyRollout const rollout = registry.Load(path, data_json, warmup_queries, FLAGS_warmup_rounds);
+            PrintRollout(path, rollout);
+            PolicyHostRollout rolled_out;
+            rolled_out.version = rollout.version;
+            rolled_out.path = path;
+            rolled_out.load_ms = rollout.load_ms;
+            rolled_out.warmup_ms = rollout.warmup_ms;
+            rolled_out.drain_ms = rollout.drain_ms;
+            response.content_type = "application/json";
+            response.body = JSON(rolled_out);
+          } catch (std::exception const& e) {
+            response.status = 400;
+            response.body = std::string(e.what()) + '\n';
+          }
+        } else {
+          response.status = 400;
+          response.content_type = "text/plain";
+          response.body = "Synopsis: `GET` the version served, or `POST` the path of the module to roll out.\n";
+        }
+      });
+  std::cout << "Serving on " << cyan << "localhost:" << FLAGS_p << reset << ", the admin endpoint on " << cyan
+            << "127.0.0.1:" << FLAGS_admin_port << reset << "." << std::endl;
+  http.Join();
+}
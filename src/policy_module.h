@@ -0,0 +1,238 @@
+// Transpiled policies loaded at runtime as shared objects, built from `capi/sleipnir_policy.cc`, so that the host server
+// switches to a new policy version without a restart.
+//
+// Each version is `dlopen()`-ed from a private copy of its file, as the dynamic loader would otherwise hand out the
+// already loaded object again once the same path is overwritten with the next build. The copy is an anonymous file of
+// `memfd_create()`, loaded via `/proc/self/fd/N`, so that no other process can get at it, let alone replace it.
+// `PolicyModuleRegistry` publishes the current version as an atomic `shared_ptr`. Each evaluation holds on to the
+// version it started with, and the version swapped out is only destroyed, and `dlclose()`-d, by the thread that has
+// swapped it out, once its last evaluation is done, so that no request ever pays for the unloading.
+//
+// Build the modules with `-fvisibility=hidden -fno-gnu-unique`. The former keeps the globals and the statics of each
+// version, the `policy_singletons` included, its own, rather than shared with the previous version, and the latter
+// lets `dlclose()` actually unload the versions retired, which the `STB_GNU_UNIQUE` symbols of `std::` would prevent.
+//
+// Loading a module runs its code, so the hosts only roll out the modules that `IsAllowedPolicyModule()` lets them.
+
+#ifndef SLEIPNIR_POLICY_MODULE_H
+#define SLEIPNIR_POLICY_MODULE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "capi/sleipnir_policy.h"
+
+class PolicyModule final {
+ private:
+  std::string const path_;
+  uint64_t const version_;
+  int copy_fd_ = -1;
+  void* library_ = nullptr;
+  sleipnir_policy* policy_ = nullptr;
+
+  decltype(&sleipnir_abi_version) abi_version_ = nullptr;
+  decltype(&sleipnir_policy_create) create_ = nullptr;
+  decltype(&sleipnir_policy_destroy) destroy_ = nullptr;
+  decltype(&sleipnir_policy_evaluate_json_result) evaluate_json_result_ = nullptr;
+
+  template <typename F>
+  void Resolve(F& f, char const* name) {
+    f = reinterpret_cast<F>(::dlsym(library_, name));
+    if (!f) {
+      throw std::runtime_error("The policy module `" + path_ + "` has no `" + name + "`.");
+    }
+  }
+
+  // Copies `path_` into an anonymous file, and `dlopen()`-s that. The copy is kept open for as long as the module is
+  // loaded, as the dynamic loader tells the objects apart by their paths, and `/proc/self/fd/N` must stay unique.
+  void Open() {
+    int const in = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+      throw std::runtime_error("Can not read the policy module `" + path_ + "`: " + std::strerror(errno) + '.');
+    }
+    copy_fd_ = ::memfd_create("sleipnir-policy", MFD_CLOEXEC);
+    bool copied = copy_fd_ >= 0;
+    char buffer[1 << 16];
+    while (copied) {
+      ssize_t const n = ::read(in, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        copied = !n;
+        break;
+      }
+      for (ssize_t offset = 0; copied && offset < n;) {
+        ssize_t const written = ::write(copy_fd_, buffer + offset, static_cast<size_t>(n - offset));
+        if (written > 0) {
+          offset += written;
+        } else if (!(written < 0 && errno == EINTR)) {
+          copied = false;
+        }
+      }
+    }
+    ::close(in);
+    if (copied) {
+      library_ = ::dlopen(("/proc/self/fd/" + std::to_string(copy_fd_)).c_str(), RTLD_NOW | RTLD_LOCAL);
+    }
+    if (!library_) {
+      std::string const error = copied ? ::dlerror() : "can not copy it into memory.";
+      if (copy_fd_ >= 0) {
+        ::close(copy_fd_);
+      }
+      throw std::runtime_error("Can not load the policy module `" + path_ + "`: " + error);
+    }
+  }
+
+ public:
+  // Loads the module, and creates its policy over the `data` document in JSON, empty for `{}`.
+  PolicyModule(std::string path, uint64_t version, std::string const& data_json)
+      : path_(std::move(path)), version_(version) {
+    Open();
+    try {
+      Resolve(abi_version_, "sleipnir_abi_version");
+      Resolve(create_, "sleipnir_policy_create");
+      Resolve(destroy_, "sleipnir_policy_destroy");
+      Resolve(evaluate_json_result_, "sleipnir_policy_evaluate_json_result");
+      if (abi_version_() != SLEIPNIR_ABI_VERSION) {
+        throw std::runtime_error("The policy module `" + path_ + "` is of ABI version " +
+                                 std::to_string(abi_version_()) + ", not " + std::to_string(SLEIPNIR_ABI_VERSION) + '.');
+      }
+      policy_ = data_json.empty() ? create_(nullptr, 0u) : create_(data_json.data(), data_json.length());
+      if (!policy_) {
+        throw std::runtime_error("The policy module `" + path_ + "` rejected the data document.");
+      }
+    } catch (...) {
+      ::dlclose(library_);
+      ::close(copy_fd_);
+      throw;
+    }
+  }
+
+  ~PolicyModule() {
+    if (policy_) {
+      destroy_(policy_);
+    }
+    ::dlclose(library_);
+    ::close(copy_fd_);
+  }
+
+  PolicyModule(PolicyModule const&) = delete;
+  PolicyModule& operator=(PolicyModule const&) = delete;
+
+  std::string const& Path() const { return path_; }
+  uint64_t Version() const { return version_; }
+
+  // Evaluates one `{"input":{...}}` query, setting `result` to the JSON of its result, and returns the `SLEIPNIR_*`
+  // decision, or error, of `sleipnir_policy_evaluate_json_result()`.
+  int Evaluate(std::string_view query, std::string& result) const {
+    result.resize(std::max(result.capacity(), static_cast<size_t>(64u)));
+    size_t length = 0u;
+    int decision = evaluate_json_result_(policy_, query.data(), query.length(), &result[0], result.size(), &length);
+    if (decision == SLEIPNIR_BUFFER_TOO_SMALL) {
+      result.resize(length);
+      decision = evaluate_json_result_(policy_, query.data(), query.length(), &result[0], result.size(), &length);
+    }
+    result.resize(decision >= 0 ? length : 0u);
+    return decision;
+  }
+
+  // Runs `queries` through the policy `rounds` times, so that the first requests of this version find its code and data
+  // in the caches. Its singletons are already materialized, by `sleipnir_policy_create()`.
+  void WarmUp(std::vector<std::string> const& queries, uint32_t rounds) const {
+    std::string result;
+    for (uint32_t round = 0u; round < rounds; ++round) {
+      for (std::string const& query : queries) {
+        Evaluate(query, result);
+      }
+    }
+  }
+};
+
+// Whether the admin endpoints of the hosts may roll out the module at `path`: the module the host was configured with,
+// `configured`, or any module in `directory`, if not empty, the symbolic links resolved. As loading a module runs its
+// code, no other paths are.
+inline bool IsAllowedPolicyModule(std::string const& path,
+                                  std::string const& configured,
+                                  std::string const& directory) {
+  auto const resolve = [](std::string const& p) {
+    std::unique_ptr<char, decltype(&std::free)> const resolved(::realpath(p.c_str(), nullptr), &std::free);
+    return resolved ? std::string(resolved.get()) : std::string();
+  };
+  std::string const resolved = resolve(path);
+  if (resolved.empty()) {
+    return false;
+  }
+  if (resolved == resolve(configured)) {
+    return true;
+  }
+  std::string const allowed = directory.empty() ? std::string() : resolve(directory);
+  return !allowed.empty() && resolved.length() > allowed.length() + 1u &&
+         resolved.compare(0u, allowed.length() + 1u, allowed + '/') == 0;
+}
+
+struct PolicyRollout final {
+  uint64_t version = 0u;
+  double load_ms = 0.0;
+  double warmup_ms = 0.0;
+  double drain_ms = 0.0;  // Waiting for the evaluations in flight on the previous version.
+};
+
+class PolicyModuleRegistry final {
+ private:
+  std::shared_ptr<PolicyModule const> current_;
+  std::mutex rollout_mutex_;
+  uint64_t next_version_ = 1u;  // Guarded by `rollout_mutex_`.
+
+  static double MillisecondsSince(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+  }
+
+ public:
+  // The version to evaluate a request with, to hold on to for the duration of the request. `nullptr` before `Load()`.
+  std::shared_ptr<PolicyModule const> Current() const { return std::atomic_load(&current_); }
+
+  // Loads the module at `path`, warms it up, and switches to it. One rollout at a time; the requests never wait.
+  // Throws, keeping the current version, if the module can not be loaded.
+  PolicyRollout Load(std::string const& path,
+                     std::string const& data_json,
+                     std::vector<std::string> const& warmup_queries,
+                     uint32_t warmup_rounds) {
+    std::lock_guard<std::mutex> lock(rollout_mutex_);
+    PolicyRollout rollout;
+    rollout.version = next_version_++;
+    auto t = std::chrono::steady_clock::now();
+    auto next = std::make_shared<PolicyModule const>(path, rollout.version, data_json);
+    rollout.load_ms = MillisecondsSince(t);
+    t = std::chrono::steady_clock::now();
+    next->WarmUp(warmup_queries, warmup_rounds);
+    rollout.warmup_ms = MillisecondsSince(t);
+    t = std::chrono::steady_clock::now();
+    std::shared_ptr<PolicyModule const> previous = std::atomic_exchange(&current_, std::move(next));
+    // No new evaluation can pick up `previous` now, so its use count only goes down.
+    while (previous && previous.use_count() > 1) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    previous = nullptr;
+    rollout.drain_ms = MillisecondsSince(t);
+    return rollout;
+  }
+};
+
+#endif  // SLEIPNIR_POLICY_MODULE_H
@@ -0,0 +1,228 @@
+// g++ -O3 -DNDEBUG -pthread -std=c++17 policy_router.cc -o policy_router -ldl
+//
+// The multi-policy server: one process for many transpiled policies, each a module built from `capi/sleipnir_policy.cc`,
+// see `policy_module.h`. The `--policies` manifest lists one policy per line, as `package/rule module.so`, optionally
+// followed by the queries file to warm it up with. `POST /v1/data/<package>/<rule>` evaluates the policy of that route.
+// The routes are dispatched via a perfect hash table, built once at startup, and the `--data` document is read once for
+// all the policies. Each route is rolled out on its own, as with `policy_host`, via `POST /admin/policy/<package>/<rule>`.
+// That is served on `--admin_port`, on the loopback interface only, and only rolls out the module of the route in the
+// manifest, or the modules in `--module_dir`.
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+#include "current/blocks/http/api.h"
+#include "current/blocks/xterm/vt100.h"
+#include "current/bricks/dflags/dflags.h"
+#include "current/bricks/file/file.h"
+
+#include "mmap_lines.h"
+#include "perfect_hash.h"
+#include "policy_module.h"
+#include "thread_per_core_server.h"
+
+using namespace current::vt100;
+
+DEFINE_string(policies, "policies.txt", "The manifest, one `package/rule module.so [warmup_queries]` per line.");
+DEFINE_string(data, "", "The file of the `data` document shared by all the policies, in JSON, if any.");
+DEFINE_uint16(p, 8181u, "The port to serve `/v1/data/<package>/<rule>` on.");
+DEFINE_uint16(admin_port, 8180u, "The port to serve `/admin/policy/<package>/<rule>` on, on the loopback only.");
+DEFINE_string(module_dir, "", "Set to also allow `/admin/policy` to roll out the modules in this directory.");
+DEFINE_uint32(warmup_rounds, 3u, "The number of passes over the warm-up queries of each policy per new version.");
+DEFINE_uint32(dispatch_bench, 0u, "Set to time this many route lookups, vs. `std::unordered_map`, instead of serving.");
+
+CURRENT_STRUCT(PolicyRouteStatus) {
+  CURRENT_FIELD(route, std::string);
+  CURRENT_FIELD(path, std::string);
+  CURRENT_FIELD(version, uint64_t);
+};
+
+CURRENT_STRUCT(PolicyRoutesStatus) {
+  CURRENT_FIELD(policies, std::vector<PolicyRouteStatus>);
+};
+
+struct PolicyRoute final {
+  std::string module_path;
+  std::vector<std::string> warmup_queries;
+  PolicyModuleRegistry registry;
+};
+
+// Joins the path arguments after the registered prefix, so that `/v1/data/rbac/allow` yields `rbac/allow`.
+std::string RouteOf(URLPathArgs const& args) {
+  std::string route;
+  for (size_t i = 0u; i < args.size(); ++i) {
+    if (i) {
+      route += '/';
+    }
+    route += args[i];
+  }
+  return route;
+}
+
+void RunDispatchBench(PerfectHashTable<uint32_t> const& table) {
+  std::unordered_map<std::string, uint32_t> map;
+  std::vector<std::string> keys;
+  for (auto const& entry : table.Entries()) {
+    map.emplace(entry.first, entry.second);
+    keys.push_back(entry.first);
+  }
+  auto const time = [&keys](auto&& find) {
+    uint64_t sum = 0u;
+    auto const t0 = std::chrono::steady_clock::now();
+    for (uint32_t i = 0u; i < FLAGS_dispatch_bench; ++i) {
+      sum += find(keys[i % keys.size()]);
+    }
+    auto const t1 = std::chrono::steady_clock::now();
+    return std::make_pair(std::chrono::duration<double, std::nano>(t1 - t0).count() / FLAGS_dispatch_bench, sum);
+  };
+  auto const perfect = time([&table](std::string const& key) { return *table.Find(key); });
+  auto const unordered = time([&map](std::string const& key) { return map.find(key)->second; });
+  std::cout << "Route lookup over " << keys.size() << " routes: perfect hash " << magenta
+            << current::strings::RoundDoubleToString(perfect.first, 3) << "ns" << reset << ", std::unordered_map "
+            << magenta << current::strings::RoundDoubleToString(unordered.first, 3) << "ns" << reset << '.'
+            << (perfect.second == unordered.second ? "" : " MISMATCH!") << std::endl;
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  std::string const data_json = FLAGS_data.empty() ? std::string() : current::FileSystem::ReadFileAsString(FLAGS_data);
+
+  // Loaded in the order of the manifest, the table of routes maps each one to its index here.
+  std::vector<std::unique_ptr<PolicyRoute>> routes;
+  std::vector<std::pair<std::string, uint32_t>> entries;
+  {
+    std::ifstream fi(FLAGS_policies);
+    if (!fi) {
+      std::cerr << "Can not read `" << FLAGS_policies << "`." << std::endl;
+      return 1;
+    }
+    std::string line;
+    while (std::getline(fi, line)) {
+      std::istringstream fields(line);
+      std::string route;
+      std::string module_path;
+      std::string warmup_queries;
+      if (!(fields >> route) || route[0] == '#') {
+        continue;
+      }
+      if (!(fields >> module_path)) {
+        std::cerr << "No module for `" << route << "` in `" << FLAGS_policies << "`." << std::endl;
+        return 1;
+      }
+      routes.push_back(std::make_unique<PolicyRoute>());
+      PolicyRoute& policy = *routes.back();
+      policy.module_path = module_path;
+      if (fields >> warmup_queries) {
+        MMappedFile const file(warmup_queries);
+        LinesCursor lines(file.Contents());
+        std::string_view query;
+        while (lines.Next(query)) {
+          policy.warmup_queries.emplace_back(query);
+        }
+      }
+      try {
+        PolicyRollout const rollout =
+            policy.registry.Load(module_path, data_json, policy.warmup_queries, FLAGS_warmup_rounds);
+        std::cout << "Loaded " << cyan << route << reset << " from " << module_path << " in "
+                  << current::strings::RoundDoubleToString(rollout.load_ms + rollout.warmup_ms, 3) << "ms."
+                  << std::endl;
+      } catch (std::exception const& e) {
+        std::cerr << red << route << ": " << e.what() << reset << std::endl;
+        return 1;
+      }
+      entries.emplace_back(route, static_cast<uint32_t>(routes.size() - 1u));
+    }
+  }
+  PerfectHashTable<uint32_t> table;
+  try {
+    table = PerfectHashTable<uint32_t>(std::move(entries));
+  } catch (std::invalid_argument const&) {
+    std::cerr << "Duplicate routes in `" << FLAGS_policies << "`." << std::endl;
+    return 1;
+  }
+
+  if (FLAGS_dispatch_bench) {
+    if (!routes.empty()) {
+      RunDispatchBench(table);
+    }
+    return 0;
+  }
+
+  auto& http = HTTP(current::net::BarePort(FLAGS_p));
+  HTTPRoutesScope http_routes;
+  http_routes += http.Register("/v1/data", URLPathArgs::CountMask::Any, [&routes, &table](Request r) {
+    uint32_t const* const index = table.Find(RouteOf(r.url_path_args));
+    if (!index) {
+      r("No policy at `" + RouteOf(r.url_path_args) + "`.\n", HTTPResponseCode.NotFound);
+      return;
+    }
+    thread_local std::string result;
+    std::shared_ptr<PolicyModule const> const module = routes[*index]->registry.Current();
+    int const decision = module->Evaluate(r.body, result);
+    if (decision == SLEIPNIR_INVALID_INPUT) {
+      r("Synopsis: `{\"input\":{...}}`.\n", HTTPResponseCode.BadRequest);
+    } else if (decision < 0) {
+      r("Policy evaluation failed.\n", HTTPResponseCode.InternalServerError);
+    } else {
+      r("{\"result\":" + result + '}',
+        HTTPResponseCode.OK,
+        current::net::http::Headers(),
+        current::net::constants::kDefaultJSONContentType);
+    }
+  });
+  http_routes += http.Register("/v1/policies", [&routes, &table](Request r) {
+    PolicyRoutesStatus status;
+    for (auto const& entry : table.Entries()) {
+      std::shared_ptr<PolicyModule const> const module = routes[entry.second]->registry.Current();
+      PolicyRouteStatus route;
+      route.route = entry.first;
+      route.path = module->Path();
+      route.version = module->Version();
+      status.policies.push_back(route);
+    }
+    r(status);
+  });
+  // `POST`-ing the path of a module rolls it out for the route, an empty body reloads the module of the manifest.
+  ThreadPerCoreConfig admin_config;
+  admin_config.threads = 1u;
+  admin_config.pin = false;
+  admin_config.address = "127.0.0.1";
+  ThreadPerCoreHTTPServer admin(
+      FLAGS_admin_port,
+      admin_config,
+      [&routes, &table, &data_json](HTTPServerRequest const& request, HTTPServerResponse& response) {
+        constexpr static std::string_view kPrefix = "/admin/policy/";
+        response.content_type = "text/plain";
+        uint32_t const* const index = request.path.substr(0u, kPrefix.length()) == kPrefix
+                                          ? table.Find(request.path.substr(kPrefix.length()))
+                                          : nullptr;
+        if (request.method != "POST" || !index) {
+          response.status = 400;
+          response.body = "Synopsis: `POST /admin/policy/<package>/<rule>` the path of the module to roll out.\n";
+          return;
+        }
+        PolicyRoute& policy = *routes[*index];
+        std::string const path = request.body.empty() ? policy.module_path : std::string(request.body);
+        if (!IsAllowedPolicyModule(path, policy.module_path, FLAGS_module_dir)) {
+          response.status = 403;
+          response.body = "Only the module of the manifest, or the modules in `--module_dir`, can be rolled out.\n";
+          return;
+        }
+        try {
+          PolicyRollout const rollout =
+              policy.registry.Load(path, data_json, policy.warmup_queries, FLAGS_warmup_rounds);
+          response.body = "Rolled out `" + path + "` as version " + std::to_string(rollout.version) + ".\n";
+        } catch (std::exception const& e) {
+          response.status = 400;
+          response.body = std::string(e.what()) + '\n';
+        }
+      });
+  std::cout << "Serving " << magenta << routes.size() << reset << " policies on " << cyan << "localhost:" << FLAGS_p
+            << reset << ", the admin endpoint on " << cyan << "127.0.0.1:" << FLAGS_admin_port << reset << "."
+            << std::endl;
+  http.Join();
+}
@@ -0,0 +1,370 @@
+// A compact binary corpus of pre-parsed policy inputs, so that `--queries_bin` measures evaluation only.
+//
+// The layout, in native byte order, is the `QueryCorpusHeader`, then `strings + 1` `uint64_t` offsets into the string
+// blob, then the string blob itself, padded to eight bytes, then the records. Each string is stored once and records
+// refer to strings by their `uint32_t` index. Records are typed: the fields of a `CURRENT_STRUCT` are written in their
+// declaration order with no names or tags, while a `JSONValue` is written as a tagged tree. The reader trusts none of
+// it: the sizes, offsets, indexes and counts are all checked against the file before use, and the untyped values may be
+// nested at most `kQueryCorpusMaxDepth` deep, so that decoding them can not overflow the stack.
+
+#ifndef SLEIPNIR_QUERY_CORPUS_H
+#define SLEIPNIR_QUERY_CORPUS_H
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "current/blocks/json/json.h"
+#include "current/typesystem/reflection/reflection.h"
+
+#include "mmap_lines.h"
+
+constexpr static uint32_t kQueryCorpusMaxDepth = 64u;
+
+struct QueryCorpusHeader final {
+  constexpr static char const* kMagic = "SLPQBIN";
+  constexpr static uint32_t kVersion = 1u;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t strings;
+  uint64_t string_bytes;
+  uint64_t records;
+  uint64_t record_bytes;
+};
+
+class QueryCorpusWriter final {
+ private:
+  std::unordered_map<std::string, uint32_t> ids_;
+  std::vector<std::string const*> strings_;
+  std::string records_;
+  uint64_t count_ = 0u;
+
+ public:
+  template <typename T>
+  void Add(T const& input);
+
+  template <typename T>
+  void WritePOD(T value) {
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    records_.append(reinterpret_cast<char const*>(&value), sizeof(T));
+  }
+
+  void WriteString(std::string const& s) {
+    auto const it = ids_.emplace(s, static_cast<uint32_t>(strings_.size()));
+    if (it.second) {
+      strings_.push_back(&it.first->first);
+    }
+    WritePOD(it.first->second);
+  }
+
+  uint64_t Records() const { return count_; }
+  uint64_t Strings() const { return strings_.size(); }
+
+  // Returns the size of the corpus file, in bytes.
+  uint64_t Save(std::string const& filename) const {
+    QueryCorpusHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::strncpy(header.magic, QueryCorpusHeader::kMagic, sizeof(header.magic));
+    header.version = QueryCorpusHeader::kVersion;
+    header.strings = strings_.size();
+    header.records = count_;
+    header.record_bytes = records_.size();
+    std::vector<uint64_t> offsets;
+    offsets.reserve(strings_.size() + 1u);
+    offsets.push_back(0u);
+    for (std::string const* s : strings_) {
+      offsets.push_back(offsets.back() + s->length());
+    }
+    header.string_bytes = offsets.back();
+    std::ofstream fo(filename, std::ios::binary);
+    fo.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    fo.write(reinterpret_cast<char const*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    for (std::string const* s : strings_) {
+      fo.write(s->data(), s->length());
+    }
+    uint64_t const padding = (8u - header.string_bytes % 8u) % 8u;
+    fo.write("\0\0\0\0\0\0\0", padding);
+    fo.write(records_.data(), records_.size());
+    if (!fo) {
+      throw std::runtime_error("Can not write `" + filename + "`.");
+    }
+    return sizeof(header) + offsets.size() * sizeof(uint64_t) + header.string_bytes + padding + records_.size();
+  }
+};
+
+class QueryCorpusCursor final {
+ private:
+  uint64_t const* const offsets_;
+  char const* const blob_;
+  uint64_t const strings_;
+  char const* p_;
+  char const* const end_;
+
+ public:
+  QueryCorpusCursor(uint64_t const* offsets, char const* blob, uint64_t strings, char const* begin, char const* end)
+      : offsets_(offsets), blob_(blob), strings_(strings), p_(begin), end_(end) {}
+
+  template <typename T>
+  T ReadPOD() {
+    static_assert(std::is_trivially_copyable<T>::value, "");
+    if (static_cast<size_t>(end_ - p_) < sizeof(T)) {
+      throw std::runtime_error("Truncated binary queries corpus.");
+    }
+    T value;
+    std::memcpy(&value, p_, sizeof(T));
+    p_ += sizeof(T);
+    return value;
+  }
+
+  // The offsets are validated by `QueryCorpusReader`, so a valid index is a valid string.
+  std::string_view ReadString() {
+    uint32_t const id = ReadPOD<uint32_t>();
+    if (id >= strings_) {
+      throw std::runtime_error("Invalid string index in the binary queries corpus.");
+    }
+    return std::string_view(blob_ + offsets_[id], offsets_[id + 1u] - offsets_[id]);
+  }
+
+  // Reads the number of elements that follow, each at least `min_element_bytes` long, so that a corrupt count fails
+  // here rather than in a multi-gigabyte `reserve()`.
+  uint32_t ReadCount(size_t min_element_bytes) {
+    uint32_t const n = ReadPOD<uint32_t>();
+    if (static_cast<uint64_t>(n) * min_element_bytes > Remaining()) {
+      throw std::runtime_error("Truncated binary queries corpus.");
+    }
+    return n;
+  }
+
+  size_t Remaining() const { return static_cast<size_t>(end_ - p_); }
+};
+
+// The codec of `CURRENT_STRUCT`-s: all fields, in order, no names.
+template <typename T, typename ENABLE = void>
+struct QueryCorpusCodec final {
+  static void Write(QueryCorpusWriter& w, T const& value) {
+    current::reflection::VisitAllFields<T, current::reflection::FieldNameAndImmutableValue>::WithObject(
+        value, [&w](auto const&, auto const& field) { QueryCorpusCodec<std::decay_t<decltype(field)>>::Write(w, field); });
+  }
+  static void Read(QueryCorpusCursor& c, T& value) {
+    current::reflection::VisitAllFields<T, current::reflection::FieldNameAndMutableValue>::WithObject(
+        value, [&c](auto const&, auto& field) { QueryCorpusCodec<std::decay_t<decltype(field)>>::Read(c, field); });
+  }
+};
+
+template <>
+struct QueryCorpusCodec<std::string> final {
+  static void Write(QueryCorpusWriter& w, std::string const& value) { w.WriteString(value); }
+  static void Read(QueryCorpusCursor& c, std::string& value) {
+    std::string_view const s = c.ReadString();
+    value.assign(s.data(), s.length());
+  }
+};
+
+template <typename T>
+struct QueryCorpusCodec<T, std::enable_if_t<std::is_arithmetic<T>::value>> final {
+  static void Write(QueryCorpusWriter& w, T value) { w.WritePOD(value); }
+  static void Read(QueryCorpusCursor& c, T& value) { value = c.ReadPOD<T>(); }
+};
+
+template <typename T>
+struct QueryCorpusCodec<std::vector<T>> final {
+  static void Write(QueryCorpusWriter& w, std::vector<T> const& value) {
+    w.WritePOD(static_cast<uint32_t>(value.size()));
+    for (T const& e : value) {
+      QueryCorpusCodec<T>::Write(w, e);
+    }
+  }
+  static void Read(QueryCorpusCursor& c, std::vector<T>& value) {
+    uint32_t const n = c.ReadPOD<uint32_t>();
+    value.clear();
+    value.reserve(std::min(static_cast<size_t>(n), c.Remaining()));
+    for (uint32_t i = 0u; i < n; ++i) {
+      T e;
+      QueryCorpusCodec<T>::Read(c, e);
+      value.push_back(std::move(e));
+    }
+  }
+};
+
+template <typename T>
+struct QueryCorpusCodec<Optional<T>> final {
+  static void Write(QueryCorpusWriter& w, Optional<T> const& value) {
+    w.WritePOD(static_cast<uint8_t>(Exists(value)));
+    if (Exists(value)) {
+      QueryCorpusCodec<T>::Write(w, Value(value));
+    }
+  }
+  static void Read(QueryCorpusCursor& c, Optional<T>& value) {
+    if (c.ReadPOD<uint8_t>()) {
+      T v;
+      QueryCorpusCodec<T>::Read(c, v);
+      value = v;
+    } else {
+      value = nullptr;
+    }
+  }
+};
+
+// The codec of untyped inputs: a tagged tree.
+template <>
+struct QueryCorpusCodec<current::json::JSONValue> final {
+  enum class Tag : uint8_t { Null = 0, False = 1, True = 2, Number = 3, String = 4, Array = 5, Object = 6 };
+
+  static void Write(QueryCorpusWriter& w, current::json::JSONValue const& value, uint32_t depth = 0u) {
+    using namespace current::json;
+    if (depth >= kQueryCorpusMaxDepth) {
+      throw std::runtime_error("Too deeply nested query for the binary queries corpus.");
+    }
+    if (Exists<JSONNumber>(value)) {
+      w.WritePOD(Tag::Number);
+      w.WritePOD(Value<JSONNumber>(value).number);
+    } else if (Exists<JSONString>(value)) {
+      w.WritePOD(Tag::String);
+      w.WriteString(Value<JSONString>(value).string);
+    } else if (Exists<JSONBoolean>(value)) {
+      w.WritePOD(Value<JSONBoolean>(value).boolean ? Tag::True : Tag::False);
+    } else if (Exists<JSONArray>(value)) {
+      JSONArray const& array = Value<JSONArray>(value);
+      w.WritePOD(Tag::Array);
+      w.WritePOD(static_cast<uint32_t>(array.size()));
+      for (JSONValue const& e : array.elements) {
+        Write(w, e, depth + 1u);
+      }
+    } else if (Exists<JSONObject>(value)) {
+      JSONObject const& object = Value<JSONObject>(value);
+      w.WritePOD(Tag::Object);
+      w.WritePOD(static_cast<uint32_t>(object.size()));
+      for (auto const& field : object.fields) {
+        w.WriteString(field.first);
+        Write(w, field.second, depth + 1u);
+      }
+    } else {
+      w.WritePOD(Tag::Null);
+    }
+  }
+
+  static void Read(QueryCorpusCursor& c, current::json::JSONValue& value, uint32_t depth = 0u) {
+    using namespace current::json;
+    if (depth >= kQueryCorpusMaxDepth) {
+      throw std::runtime_error("Too deeply nested value in the binary queries corpus.");
+    }
+    Tag const tag = c.ReadPOD<Tag>();
+    if (tag == Tag::Null) {
+      value = JSONNull();
+    } else if (tag == Tag::False || tag == Tag::True) {
+      value = JSONBoolean(tag == Tag::True);
+    } else if (tag == Tag::Number) {
+      value = JSONNumber(c.ReadPOD<double>());
+    } else if (tag == Tag::String) {
+      std::string_view const s = c.ReadString();
+      value = JSONString(std::string(s.data(), s.length()));
+    } else if (tag == Tag::Array) {
+      uint32_t const n = c.ReadCount(sizeof(Tag));
+      JSONArray array;
+      array.elements.reserve(n);
+      for (uint32_t i = 0u; i < n; ++i) {
+        JSONValue e;
+        Read(c, e, depth + 1u);
+        array.push_back(std::move(e));
+      }
+      value = std::move(array);
+    } else if (tag == Tag::Object) {
+      uint32_t const n = c.ReadCount(sizeof(uint32_t) + sizeof(Tag));
+      JSONObject object;
+      for (uint32_t i = 0u; i < n; ++i) {
+        std::string_view const key = c.ReadString();
+        JSONValue e;
+        Read(c, e, depth + 1u);
+        object.push_back(std::string(key.data(), key.length()), std::move(e));
+      }
+      value = std::move(object);
+    } else {
+      throw std::runtime_error("Invalid tag in the binary queries corpus.");
+    }
+  }
+};
+
+template <typename T>
+void QueryCorpusWriter::Add(T const& input) {
+  QueryCorpusCodec<T>::Write(*this, input);
+  ++count_;
+}
+
+// The memory-mapped corpus. Decoding touches no JSON parser, and the strings are copied straight out of the mapping.
+class QueryCorpusReader final {
+ private:
+  MMappedFile const file_;
+  QueryCorpusHeader header_;
+  uint64_t const* offsets_ = nullptr;
+  char const* blob_ = nullptr;
+  char const* records_ = nullptr;
+
+ public:
+  explicit QueryCorpusReader(std::string const& filename) : file_(filename) {
+    std::string_view const contents = file_.Contents();
+    if (contents.length() < sizeof(header_)) {
+      throw std::runtime_error("`" + filename + "` is not a binary queries corpus.");
+    }
+    std::memcpy(&header_, contents.data(), sizeof(header_));
+    if (std::strncmp(header_.magic, QueryCorpusHeader::kMagic, sizeof(header_.magic)) ||
+        header_.version != QueryCorpusHeader::kVersion) {
+      throw std::runtime_error("`" + filename + "` is not a binary queries corpus of a supported version.");
+    }
+    // Each section is checked against what is left of the file before the next one is sized, so that no header
+    // field, however large, can overflow the sum.
+    std::string const corrupt = "`" + filename + "` is a truncated or corrupt binary queries corpus.";
+    uint64_t left = contents.length() - sizeof(header_);
+    if (header_.strings >= left / sizeof(uint64_t)) {
+      throw std::runtime_error(corrupt);
+    }
+    left -= (header_.strings + 1u) * sizeof(uint64_t);
+    if (header_.string_bytes > left) {
+      throw std::runtime_error(corrupt);
+    }
+    uint64_t const padding = (8u - header_.string_bytes % 8u) % 8u;
+    left -= header_.string_bytes;
+    if (padding > left || left - padding != header_.record_bytes) {
+      throw std::runtime_error(corrupt);
+    }
+    offsets_ = reinterpret_cast<uint64_t const*>(contents.data() + sizeof(header_));
+    blob_ = reinterpret_cast<char const*>(offsets_ + header_.strings + 1u);
+    records_ = blob_ + header_.string_bytes + padding;
+    // The strings must tile the blob exactly: starting at zero, never going back, and ending at its end.
+    if (offsets_[0] != 0u || offsets_[header_.strings] != header_.string_bytes) {
+      throw std::runtime_error(corrupt);
+    }
+    for (uint64_t i = 0u; i < header_.strings; ++i) {
+      if (offsets_[i + 1u] < offsets_[i]) {
+        throw std::runtime_error(corrupt);
+      }
+    }
+  }
+
+  uint64_t size() const { return header_.records; }
+  uint64_t Bytes() const { return file_.Contents().length(); }
+
+  // Throws if the records do not decode into exactly `size()` inputs spanning exactly the records section.
+  template <typename T>
+  void DecodeAll(std::vector<T>& output) const {
+    QueryCorpusCursor cursor(offsets_, blob_, header_.strings, records_, records_ + header_.record_bytes);
+    output.reserve(output.size() + std::min(header_.records, header_.record_bytes));
+    for (uint64_t i = 0u; i < header_.records; ++i) {
+      T input;
+      QueryCorpusCodec<T>::Read(cursor, input);
+      output.push_back(std::move(input));
+    }
+    if (cursor.Remaining()) {
+      throw std::runtime_error("Trailing bytes after the records of the binary queries corpus.");
+    }
+  }
+};
+
+#endif  // SLEIPNIR_QUERY_CORPUS_H
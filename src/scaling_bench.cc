@@ -0,0 +1,222 @@
+// g++ -O3 -DNDEBUG -pthread -std=c++17 scaling_bench.cc -o scaling_bench
+//
+// The scaling curve of the thread-per-core server, see `thread_per_core_server.h`: the closed-loop throughput of
+// `--binary` started with `--thread_per_core` of 1, 2, 4, ... up to `--max_cores` loops, next to that of the default
+// `HTTP()` server of Current, and the CPU time the server takes per request. With `--backends epoll,io_uring`, the
+// curve is measured for each backend of the event loops, and, with `--pipelines 1,8,64`, for each HTTP/1.1 pipelining
+// depth of the load. For the load generator not to compete with the server for the cores, give them disjoint sets,
+// e.g. `--server_cpus 0-31 --load_cpus 32-63` on a 64-core host. The server inherits its set from this process, and
+// pins its loops to the first cores of it.
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include <sched.h>
+#include <signal.h>
+
+#include "current/bricks/dflags/dflags.h"
+#include "current/blocks/xterm/vt100.h"
+#include "current/typesystem/serialization/json.h"
+
+#include "http_load.h"
+#include "mmap_lines.h"
+#include "server_process.h"
+#include "thread_per_core_server.h"
+
+using namespace current::vt100;
+
+DEFINE_string(binary, "./transpiled_strongly_typed", "The policy server to benchmark.");
+DEFINE_string(queries, "queries.txt", "The corpus of `{\"input\":{...}}` queries, one per line.");
+DEFINE_uint16(port, 8181u, "The port to start the server on.");
+DEFINE_uint32(max_cores, 0u, "The most event loops to try, zero for all the cores of `--server_cpus`.");
+DEFINE_string(server_cpus, "", "The cores of the server, as `0-31`, if not all of them.");
+DEFINE_string(load_cpus, "", "The cores of the load generator, as `32-63`, if not all of them.");
+DEFINE_int32(numa_node, -1, "Set to pass `--numa_node` on to the server.");
+DEFINE_uint32(load_threads, 4u, "The number of load generator threads.");
+DEFINE_uint32(connections, 256u, "The number of keep-alive connections.");
+DEFINE_double(warmup, 1.0, "The number of seconds of each run to not measure.");
+DEFINE_double(duration, 5.0, "The number of seconds of each run to measure.");
+DEFINE_string(backends, "epoll", "The comma-separated backends of the event loops to measure, `epoll` and `io_uring`.");
+DEFINE_string(pipelines, "1", "The comma-separated pipelining depths of the load to measure, e.g. `1,8,64`.");
+DEFINE_bool(default_server, true, "Set to also measure the default `HTTP()` server, on all of `--server_cpus`.");
+DEFINE_string(json_output, "", "Set to write the scaling curve into this JSON file.");
+
+CURRENT_STRUCT(ScalingPoint) {
+  CURRENT_FIELD(backend, std::string);
+  CURRENT_FIELD(cores, uint32_t);  // Zero for the default server.
+  CURRENT_FIELD(pipeline, uint32_t);
+  CURRENT_FIELD(throughput_rps, double);
+  CURRENT_FIELD(per_core_rps, double);
+  CURRENT_FIELD(efficiency, double);  // Of the per-core throughput, relative to that of one core.
+  CURRENT_FIELD(cpu_us_per_request, double);  // Of the server, user and system.
+  CURRENT_FIELD(p99_us, double);
+};
+
+CURRENT_STRUCT(ScalingReport) {
+  CURRENT_FIELD(binary, std::string);
+  CURRENT_FIELD(points, std::vector<ScalingPoint>);
+};
+
+void SetAffinity(std::vector<int> const& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int const cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  if (::sched_setaffinity(0, sizeof(set), &set)) {
+    throw std::runtime_error("Can not set the CPU affinity.");
+  }
+}
+
+struct ScalingRun final {
+  HTTPLoadResult load;
+  double cpu_us_per_request = 0.0;
+};
+
+// Starts the server with `extra_args` on `--server_cpus`, and loads it from `--load_cpus`, `pipeline` requests deep.
+ScalingRun Run(std::vector<std::string> const& extra_args,
+               uint32_t pipeline,
+               std::vector<std::string> const& requests,
+               std::vector<int> const& server_cpus,
+               std::vector<int> const& load_cpus) {
+  std::vector<std::string> args = {FLAGS_binary, "-p", current::strings::ToString(FLAGS_port), "-d"};
+  args.insert(args.end(), extra_args.begin(), extra_args.end());
+  SetAffinity(server_cpus);
+  pid_t const server = Spawn(args);
+  SetAffinity(load_cpus);
+  if (!WaitForPort(FLAGS_port, server)) {
+    ::kill(server, SIGKILL);
+    WaitFor(server);
+    throw std::runtime_error("`" + FLAGS_binary + "` did not start listening on port " +
+                             current::strings::ToString(FLAGS_port) + '.');
+  }
+  HTTPLoadConfig config;
+  config.port = FLAGS_port;
+  config.threads = FLAGS_load_threads;
+  config.connections = FLAGS_connections;
+  config.pipeline_depth = pipeline;
+  config.warmup_seconds = FLAGS_warmup;
+  config.duration_seconds = FLAGS_duration;
+  // The CPU time of the server is sampled at the boundaries of the measurement window of the load.
+  double cpu_seconds = 0.0;
+  std::thread sampler([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100) +
+                                std::chrono::microseconds(static_cast<uint64_t>(FLAGS_warmup * 1e6)));
+    double const begin = ProcessCPUSeconds(server);
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<uint64_t>(FLAGS_duration * 1e6)));
+    cpu_seconds = ProcessCPUSeconds(server) - begin;
+  });
+  ScalingRun run;
+  run.load = RunHTTPLoad(config, requests);
+  sampler.join();
+  ::kill(server, SIGTERM);
+  WaitFor(server);
+  WaitForPortFree(FLAGS_port);
+  if (run.load.completed_in_window) {
+    run.cpu_us_per_request = cpu_seconds * 1e6 / run.load.completed_in_window;
+  }
+  return run;
+}
+
+int main(int argc, char** argv) {
+  ParseDFlags(&argc, &argv);
+
+  std::vector<std::string> requests;
+  {
+    MMappedFile const file(FLAGS_queries);
+    LinesCursor lines(file.Contents());
+    std::string_view line;
+    while (lines.Next(line)) {
+      requests.push_back(BuildHTTPPostRequest("/v1/data/rbac/allow", line));
+    }
+  }
+  if (requests.empty()) {
+    std::cerr << "No queries in `" << FLAGS_queries << "`." << std::endl;
+    return 1;
+  }
+
+  std::vector<int> const all_cpus = ThreadPerCoreCPUs(-1);
+  std::vector<int> const server_cpus = FLAGS_server_cpus.empty() ? all_cpus : ParseCPUList(FLAGS_server_cpus);
+  std::vector<int> const load_cpus = FLAGS_load_cpus.empty() ? all_cpus : ParseCPUList(FLAGS_load_cpus);
+  uint32_t const max_cores = FLAGS_max_cores ? FLAGS_max_cores : static_cast<uint32_t>(server_cpus.size());
+  std::vector<uint32_t> cores;
+  for (uint32_t k = 1u; k < max_cores; k *= 2u) {
+    cores.push_back(k);
+  }
+  cores.push_back(max_cores);
+  std::vector<uint32_t> pipelines;
+  for (std::string const& depth : current::strings::Split(FLAGS_pipelines, ',')) {
+    pipelines.push_back(std::max(current::strings::FromString<uint32_t>(depth), 1u));
+  }
+
+  ScalingReport report;
+  report.binary = FLAGS_binary;
+  std::cout << "   backend      cores  pipeline      req/s  req/s/core  efficiency  cpu_us/req     p99_us" << std::endl;
+  auto const print = [&report](ScalingPoint const& point) {
+    std::printf("%10s %10s %9u %10.0f %11.0f %10.1f%% %11.2f %10.1f\n",
+                point.backend.c_str(),
+                point.cores ? current::strings::ToString(point.cores).c_str() : "all",
+                point.pipeline,
+                point.throughput_rps,
+                point.per_core_rps,
+                point.efficiency * 100.0,
+                point.cpu_us_per_request,
+                point.p99_us);
+    std::fflush(stdout);
+    report.points.push_back(point);
+  };
+  if (FLAGS_default_server) {
+    for (uint32_t const pipeline : pipelines) {
+      ScalingRun const run = Run({}, pipeline, requests, server_cpus, load_cpus);
+      ScalingPoint point;
+      point.backend = "default";
+      point.cores = 0u;
+      point.pipeline = pipeline;
+      point.throughput_rps = run.load.achieved_rate;
+      point.per_core_rps = run.load.achieved_rate / server_cpus.size();
+      point.efficiency = 0.0;
+      point.cpu_us_per_request = run.cpu_us_per_request;
+      point.p99_us = run.load.latency_ns.Percentile(0.99) * 1e-3;
+      print(point);
+    }
+  }
+  for (std::string const& backend : current::strings::Split(FLAGS_backends, ',')) {
+    if (backend != "epoll" && backend != "io_uring") {
+      std::cerr << "Unknown backend `" << backend << "`." << std::endl;
+      return 1;
+    }
+    for (uint32_t const pipeline : pipelines) {
+      double one_core_rps = 0.0;
+      for (uint32_t const k : cores) {
+        std::vector<std::string> args = {"--thread_per_core", current::strings::ToString(k)};
+        if (backend == "io_uring") {
+          args.push_back("--io_uring");
+        }
+        if (FLAGS_numa_node >= 0) {
+          args.push_back("--numa_node");
+          args.push_back(current::strings::ToString(FLAGS_numa_node));
+        }
+        ScalingRun const run = Run(args, pipeline, requests, server_cpus, load_cpus);
+        ScalingPoint point;
+        point.backend = backend;
+        point.cores = k;
+        point.pipeline = pipeline;
+        point.throughput_rps = run.load.achieved_rate;
+        point.per_core_rps = run.load.achieved_rate / k;
+        if (k == 1u) {
+          one_core_rps = point.per_core_rps;
+        }
+        point.efficiency = one_core_rps > 0.0 ? point.per_core_rps / one_core_rps : 0.0;
+        point.cpu_us_per_request = run.cpu_us_per_request;
+        point.p99_us = run.load.latency_ns.Percentile(0.99) * 1e-3;
+        print(point);
+      }
+    }
+  }
+  std::cout << "The default server uses all of `--server_cpus`; its `req/s/core` is per core of those." << std::endl;
+  if (!FLAGS_json_output.empty()) {
+    std::ofstream(FLAGS_json_output) << JSON(report) << std::endl;
+  }
+}
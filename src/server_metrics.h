@@ -0,0 +1,322 @@
+// The `/metrics` endpoint of the transpiled servers, in the Prometheus text format.
+//
+// Each handler thread updates its own `ServerMetrics`, see `per_thread.h`, which costs a handful of plain stores per
+// request; the per-thread values are only summed up when `/metrics` is scraped. The stage latencies take four
+// `CPUTicks()` reads, which alone cost around 100ns on a VM, so only one in `MetricsClock::SamplePeriod()` requests per
+// thread is timed, and recorded with that weight. They are kept as power-of-two histograms in nanoseconds, so the
+// bucket is one `clz` away.
+// The startup times, see `StartupMetrics`, are exported as gauges, and printed once each to the standard error.
+// So are the counts of the decisions written to and dropped from the decision log, if there is one.
+
+#ifndef SLEIPNIR_SERVER_METRICS_H
+#define SLEIPNIR_SERVER_METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "decision_log.h"
+#include "per_thread.h"
+
+// Converts `CPUTicks()` into nanoseconds. `Calibrate()` measures the tick rate once, before the server starts.
+// `SetSamplePeriod()` sets how many requests per thread each timed one stands for, one by default, for all of them.
+class MetricsClock final {
+ private:
+  static double& NanosecondsPerTick() {
+    static double value = 1.0;
+    return value;
+  }
+  static inline std::atomic<uint32_t> sample_period_{1u};
+
+ public:
+  static void SetSamplePeriod(uint32_t period) {
+    sample_period_.store(std::max(period, static_cast<uint32_t>(1u)), std::memory_order_relaxed);
+  }
+  static uint32_t SamplePeriod() { return sample_period_.load(std::memory_order_relaxed); }
+
+  static void Calibrate() {
+    auto const t0 = std::chrono::steady_clock::now();
+    uint64_t const ticks0 = CPUTicks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto const t1 = std::chrono::steady_clock::now();
+    uint64_t const ticks1 = CPUTicks();
+    double const ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    if (ticks1 > ticks0) {
+      NanosecondsPerTick() = ns / (ticks1 - ticks0);
+    }
+  }
+  static uint64_t ToNanoseconds(uint64_t ticks) { return static_cast<uint64_t>(ticks * NanosecondsPerTick()); }
+};
+
+// Bucket `k` counts the latencies under `2^k` nanoseconds and at least `2^(k-1)`; the last one is unbounded.
+class LatencyCounters final {
+ public:
+  constexpr static size_t kBuckets = 36u;
+
+ private:
+  LocalCounter buckets_[kBuckets];
+  LocalCounter sum_ns_;
+
+ public:
+  // Records `weight` latencies of `ticks` each, as a sampled one stands for the ones not timed.
+  void Record(uint64_t ticks, uint64_t weight) {
+    uint64_t const ns = MetricsClock::ToNanoseconds(ticks);
+    size_t const bucket = ns ? std::min(static_cast<size_t>(64 - __builtin_clzll(ns)), kBuckets - 1u) : 0u;
+    buckets_[bucket].Add(weight);
+    sum_ns_.Add(ns * weight);
+  }
+  void Absorb(LatencyCounters const& other) {
+    for (size_t i = 0u; i < kBuckets; ++i) {
+      buckets_[i].Add(other.buckets_[i].Load());
+    }
+    sum_ns_.Add(other.sum_ns_.Load());
+  }
+  uint64_t Bucket(size_t i) const { return buckets_[i].Load(); }
+  uint64_t SumNanoseconds() const { return sum_ns_.Load(); }
+};
+
+enum class MetricsRoute : size_t { Policy = 0u, Batch, Count };
+enum class MetricsStage : size_t { Parse = 0u, Eval, Serialize, Count };
+
+struct ServerMetrics final {
+  LocalCounter requests[static_cast<size_t>(MetricsRoute::Count)];
+  LocalCounter errors[static_cast<size_t>(MetricsRoute::Count)];
+  LocalCounter shed[static_cast<size_t>(MetricsRoute::Count)];
+  LocalCounter started;
+  LocalCounter finished;
+  LocalCounter batch_queries;
+  LatencyCounters stages[static_cast<size_t>(MetricsStage::Count)];
+  uint32_t until_sampled = 0u;  // Only ever touched by the owner thread, and not a count to sum up.
+
+  // Returns the weight of this request, `MetricsClock::SamplePeriod()` if it is the one to time, or zero.
+  uint32_t Sample() {
+    if (until_sampled) {
+      --until_sampled;
+      return 0u;
+    }
+    uint32_t const period = MetricsClock::SamplePeriod();
+    until_sampled = period - 1u;
+    return period;
+  }
+
+  void Absorb(ServerMetrics const& other) {
+    for (size_t i = 0u; i < static_cast<size_t>(MetricsRoute::Count); ++i) {
+      requests[i].Add(other.requests[i].Load());
+      errors[i].Add(other.errors[i].Load());
+      shed[i].Add(other.shed[i].Load());
+    }
+    started.Add(other.started.Load());
+    finished.Add(other.finished.Load());
+    batch_queries.Add(other.batch_queries.Load());
+    for (size_t i = 0u; i < static_cast<size_t>(MetricsStage::Count); ++i) {
+      stages[i].Absorb(other.stages[i]);
+    }
+  }
+
+  static ServerMetrics& Local() { return PerThread<ServerMetrics>::Local(); }
+};
+
+// How long the server takes to start: to warm the policy up, to be ready to serve, and to have served its first
+// request. The latter two count from when the process started, per `/proc/self/stat`, so that the dynamic loading and
+// the static initializers are included; thus they are as precise as a clock tick, `sysconf(_SC_CLK_TCK)`, typically
+// ten milliseconds. The state is constant-initialized, so that `RequestServed()` is a relaxed load with no guards.
+class StartupMetrics final {
+ private:
+  static inline std::atomic<uint64_t> warmup_ns_{0u};
+  static inline std::atomic<uint64_t> ready_ns_{0u};
+  static inline std::atomic<uint64_t> first_request_ns_{0u};
+  static inline std::atomic<bool> ready_{false};
+  static inline std::atomic<bool> served_{false};
+
+  // Since the process started, or zero if `/proc` is not there.
+  static uint64_t NanosecondsSinceProcessStart() {
+    std::ifstream fi("/proc/self/stat");
+    std::string stat;
+    std::getline(fi, stat);
+    // The fields after the command, which is in parentheses and may have spaces, start with the third one, the state.
+    size_t const end_of_command = stat.rfind(')');
+    if (end_of_command == std::string::npos) {
+      return 0u;
+    }
+    std::istringstream fields(stat.substr(end_of_command + 2u));
+    std::string field;
+    for (int i = 3; i < 22 && fields >> field; ++i) {
+    }
+    unsigned long long start_ticks = 0u;
+    timespec now;
+    if (!(fields >> start_ticks) || ::clock_gettime(CLOCK_BOOTTIME, &now)) {
+      return 0u;
+    }
+    uint64_t const start_ns = static_cast<uint64_t>(start_ticks * (1e9 / ::sysconf(_SC_CLK_TCK)));
+    uint64_t const now_ns = static_cast<uint64_t>(now.tv_sec) * 1000000000u + static_cast<uint64_t>(now.tv_nsec);
+    return now_ns > start_ns ? now_ns - start_ns : 0u;
+  }
+
+  static void Print(char const* what, uint64_t ns) {
+    std::fprintf(stderr, "%s %.1fms after the process started.\n", what, ns * 1e-6);
+  }
+
+ public:
+  static void WarmedUp(std::chrono::steady_clock::duration took) {
+    warmup_ns_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(took).count(), std::memory_order_relaxed);
+  }
+
+  // To be called once listening, right before serving.
+  static void Ready() {
+    uint64_t const ns = NanosecondsSinceProcessStart();
+    ready_ns_.store(ns, std::memory_order_relaxed);
+    ready_.store(true);
+    std::fprintf(stderr, "Warmed the policy up in %.3fms.\n", warmup_ns_.load(std::memory_order_relaxed) * 1e-6);
+    Print("Ready to serve", ns);
+  }
+
+  // To be called as each request is served; only the first one does more than a relaxed load.
+  static void RequestServed() {
+    if (!served_.load(std::memory_order_relaxed) && !served_.exchange(true)) {
+      uint64_t const ns = NanosecondsSinceProcessStart();
+      first_request_ns_.store(ns, std::memory_order_relaxed);
+      Print("Served the first request", ns);
+    }
+  }
+
+  static bool IsReady() { return ready_.load(); }
+
+  // Zeros for the phases not done yet.
+  static uint64_t WarmUpNanoseconds() { return warmup_ns_.load(std::memory_order_relaxed); }
+  static uint64_t ReadyNanoseconds() { return ready_ns_.load(std::memory_order_relaxed); }
+  static uint64_t FirstRequestNanoseconds() { return first_request_ns_.load(std::memory_order_relaxed); }
+};
+
+// Counts the request and keeps it in flight for its lifetime, also if the handler throws.
+class MetricsRequestScope final {
+ private:
+  ServerMetrics& metrics_;
+  MetricsRoute const route_;
+  uint32_t const weight_;  // Zero unless the stages of this request are timed.
+  uint64_t ticks_;
+
+ public:
+  explicit MetricsRequestScope(MetricsRoute route)
+      : metrics_(ServerMetrics::Local()),
+        route_(route),
+        weight_(metrics_.Sample()),
+        ticks_(weight_ ? CPUTicks() : 0u) {
+    metrics_.requests[static_cast<size_t>(route_)].Add(1u);
+    metrics_.started.Add(1u);
+  }
+  ~MetricsRequestScope() {
+    metrics_.finished.Add(1u);
+    StartupMetrics::RequestServed();
+  }
+
+  // Attributes the time since the previous stage, or since the start of the request, to `stage`.
+  void StageDone(MetricsStage stage) {
+    if (weight_) {
+      uint64_t const now = CPUTicks();
+      metrics_.stages[static_cast<size_t>(stage)].Record(now - ticks_, weight_);
+      ticks_ = now;
+    }
+  }
+  void Error() { metrics_.errors[static_cast<size_t>(route_)].Add(1u); }
+  void BatchQueries(uint64_t n) { metrics_.batch_queries.Add(n); }
+};
+
+inline std::string PrometheusMetrics(DecisionLog* decision_log = nullptr) {
+  ServerMetrics totals;
+  PerThread<ServerMetrics>::ForEach([&totals](ServerMetrics const& metrics) { totals.Absorb(metrics); });
+
+  char const* const routes[] = {"policy", "batch"};
+  char const* const stages[] = {"parse", "eval", "serialize"};
+  std::string out;
+  auto const line = [&out](std::string const& name, std::string const& labels, auto value) {
+    out += name;
+    if (!labels.empty()) {
+      out += '{' + labels + '}';
+    }
+    out += ' ' + std::to_string(value) + '\n';
+  };
+
+  out += "# HELP sleipnir_requests_total The number of HTTP requests, by route.\n";
+  out += "# TYPE sleipnir_requests_total counter\n";
+  for (size_t i = 0u; i < static_cast<size_t>(MetricsRoute::Count); ++i) {
+    line("sleipnir_requests_total", std::string("route=\"") + routes[i] + '"', totals.requests[i].Load());
+  }
+  out += "# HELP sleipnir_errors_total The number of HTTP requests with invalid inputs, by route.\n";
+  out += "# TYPE sleipnir_errors_total counter\n";
+  for (size_t i = 0u; i < static_cast<size_t>(MetricsRoute::Count); ++i) {
+    line("sleipnir_errors_total", std::string("route=\"") + routes[i] + '"', totals.errors[i].Load());
+  }
+  out += "# HELP sleipnir_shed_total The number of HTTP requests shed by the admission control, by route; not in "
+         "sleipnir_requests_total.\n";
+  out += "# TYPE sleipnir_shed_total counter\n";
+  for (size_t i = 0u; i < static_cast<size_t>(MetricsRoute::Count); ++i) {
+    line("sleipnir_shed_total", std::string("route=\"") + routes[i] + '"', totals.shed[i].Load());
+  }
+  out += "# HELP sleipnir_batch_queries_total The number of queries evaluated via the NDJSON batch route.\n";
+  out += "# TYPE sleipnir_batch_queries_total counter\n";
+  line("sleipnir_batch_queries_total", "", totals.batch_queries.Load());
+  out += "# HELP sleipnir_in_flight_requests The number of HTTP requests being handled.\n";
+  out += "# TYPE sleipnir_in_flight_requests gauge\n";
+  // The per-thread values are read one by one, so `finished` may momentarily be ahead.
+  uint64_t const started = totals.started.Load();
+  uint64_t const finished = totals.finished.Load();
+  line("sleipnir_in_flight_requests", "", started > finished ? started - finished : 0u);
+
+  if (decision_log) {
+    out += "# HELP sleipnir_decision_log_written_total The number of decisions written to the decision log.\n";
+    out += "# TYPE sleipnir_decision_log_written_total counter\n";
+    line("sleipnir_decision_log_written_total", "", decision_log->Written());
+    out += "# HELP sleipnir_decision_log_dropped_total The number of decisions not logged as a ring buffer was full.\n";
+    out += "# TYPE sleipnir_decision_log_dropped_total counter\n";
+    line("sleipnir_decision_log_dropped_total", "", decision_log->Dropped());
+  }
+
+  out += "# HELP sleipnir_startup_seconds The time to warm the policy up, and, since the process started, to be ready "
+         "to serve and to have served the first request; zero until done.\n";
+  out += "# TYPE sleipnir_startup_seconds gauge\n";
+  char const* const phases[] = {"warmup", "ready", "first_request"};
+  uint64_t const phase_ns[] = {StartupMetrics::WarmUpNanoseconds(),
+                               StartupMetrics::ReadyNanoseconds(),
+                               StartupMetrics::FirstRequestNanoseconds()};
+  for (size_t i = 0u; i < 3u; ++i) {
+    char seconds[32];
+    std::snprintf(seconds, sizeof(seconds), "%.9g", phase_ns[i] * 1e-9);
+    out += std::string("sleipnir_startup_seconds{phase=\"") + phases[i] + "\"} " + seconds + '\n';
+  }
+
+  out += "# HELP sleipnir_stage_seconds The time spent per request of the policy route, by stage; sampled, with each "
+         "timed request counted for the ones not timed.\n";
+  out += "# TYPE sleipnir_stage_seconds histogram\n";
+  for (size_t s = 0u; s < static_cast<size_t>(MetricsStage::Count); ++s) {
+    LatencyCounters const& h = totals.stages[s];
+    std::string const stage = std::string("stage=\"") + stages[s] + '"';
+    uint64_t cumulative = 0u;
+    for (size_t k = 0u; k + 1u < LatencyCounters::kBuckets; ++k) {
+      cumulative += h.Bucket(k);
+      // Only from 64ns on, as the finer buckets are all but empty.
+      if (k >= 6u) {
+        char le[32];
+        std::snprintf(le, sizeof(le), "%.9g", static_cast<double>(1ull << k) * 1e-9);
+        line("sleipnir_stage_seconds_bucket", stage + ",le=\"" + le + '"', cumulative);
+      }
+    }
+    // The count is derived from the very bucket values reported, so that the histogram is consistent.
+    cumulative += h.Bucket(LatencyCounters::kBuckets - 1u);
+    line("sleipnir_stage_seconds_bucket", stage + ",le=\"+Inf\"", cumulative);
+    char sum[32];
+    std::snprintf(sum, sizeof(sum), "%.9g", h.SumNanoseconds() * 1e-9);
+    out += "sleipnir_stage_seconds_sum{" + stage + "} " + sum + '\n';
+    line("sleipnir_stage_seconds_count", stage, cumulative);
+  }
+  return out;
+}
+
+#endif  // SLEIPNIR_SERVER_METRICS_H
@@ -0,0 +1,110 @@
+// Starting the servers under test as child processes, waiting for them to listen and to let go of their ports, and
+// measuring the CPU time they take, for the benchmark drivers.
+
+#ifndef SLEIPNIR_SERVER_PROCESS_H
+#define SLEIPNIR_SERVER_PROCESS_H
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "http_load.h"
+
+// Starts `args[0]` with its standard output and error discarded.
+inline pid_t Spawn(std::vector<std::string> const& args) {
+  std::vector<char*> argv;
+  for (std::string const& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+  pid_t pid;
+  int const error = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (error) {
+    throw std::runtime_error("Can not run `" + args[0] + "`.");
+  }
+  return pid;
+}
+
+inline int WaitFor(pid_t pid) {
+  int status = 0;
+  ::waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+inline bool WaitForPort(uint16_t port, pid_t pid) {
+  for (int attempt = 0; attempt < 200; ++attempt) {
+    try {
+      ::close(ConnectTCP("127.0.0.1", port));
+      return true;
+    } catch (std::runtime_error const&) {
+      int status;
+      if (::waitpid(pid, &status, WNOHANG) == pid) {
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+  }
+  return false;
+}
+
+// Waits for nothing to be bound to `port` any more. A server that has exited may still hold it for a few milliseconds:
+// the kernel tears down its io_uring in the background, and with it the listening socket its pending `accept()` holds.
+// Starting the next server in the meantime would have `SO_REUSEPORT` share its connections with that socket.
+inline bool WaitForPortFree(uint16_t port) {
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  for (int attempt = 0; attempt < 1000; ++attempt) {
+    int const fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int const one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    bool const free = !::bind(fd, reinterpret_cast<sockaddr const*>(&address), sizeof(address));
+    ::close(fd);
+    if (free) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return false;
+}
+
+// The user and system CPU time the process `pid` has taken so far, in seconds, from `/proc/$PID/stat`.
+inline double ProcessCPUSeconds(pid_t pid) {
+  std::ifstream fi("/proc/" + std::to_string(pid) + "/stat");
+  std::string stat;
+  std::getline(fi, stat);
+  // The fields after the command, which is in parentheses and may have spaces, start with the third one, the state.
+  size_t const end_of_command = stat.rfind(')');
+  if (end_of_command == std::string::npos) {
+    return 0.0;
+  }
+  std::istringstream fields(stat.substr(end_of_command + 2u));
+  std::string field;
+  for (int i = 3; i < 14 && fields >> field; ++i) {
+  }
+  unsigned long long utime = 0u;
+  unsigned long long stime = 0u;
+  fields >> utime >> stime;
+  return static_cast<double>(utime + stime) / ::sysconf(_SC_CLK_TCK);
+}
+
+#endif  // SLEIPNIR_SERVER_PROCESS_H
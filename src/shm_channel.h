@@ -0,0 +1,282 @@
+// A shared-memory request/response channel, for a co-located process to query the policy without syscalls.
+//
+// The server creates `/dev/shm/$NAME`, holding two single-producer, single-consumer rings of fixed-size slots: one of
+// requests, written by the client, and one of responses, written by the server, in the same order. Each request is
+// one `{"input":{...}}` query, and each response is one `{"result":...}`, or `{"error":...}`, as for the NDJSON batch
+// endpoint. Each slot is a message of its own, so a query may span lines, and every request gets exactly one response:
+// one too long for a slot is replaced by an `{"error":...}` that fits.
+// Both sides spin on the ring indexes, so a round trip takes no syscalls while the channel is busy; they back off to
+// yielding, and then to short sleeps, once idle for a while. One channel serves one client, which may have up to
+// `kShmChannelSlots` requests in flight.
+//
+// The client side is `ShmPolicyClient`, which only needs this header.
+
+#ifndef SLEIPNIR_SHM_CHANNEL_H
+#define SLEIPNIR_SHM_CHANNEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+constexpr static uint32_t kShmChannelSlots = 1024u;
+constexpr static uint32_t kShmChannelSlotBytes = 1024u;
+
+// Spins first, then yields the CPU, which matters when the two sides share a core, then sleeps if idle for long.
+class ShmChannelBackoff final {
+ private:
+  uint32_t waits_ = 0u;
+
+ public:
+  void Wait() {
+    ++waits_;
+    if (waits_ < 256u) {
+#if defined(__x86_64__) || defined(__i386__)
+      _mm_pause();
+#endif
+    } else if (waits_ < 100000u) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+  void Reset() { waits_ = 0u; }
+};
+
+struct ShmChannelSlot final {
+  uint32_t length;
+  char data[kShmChannelSlotBytes - sizeof(uint32_t)];
+};
+
+class ShmChannelRing final {
+ private:
+  static_assert(std::atomic<uint64_t>::is_always_lock_free, "The ring indexes must be address-free to be shared.");
+  alignas(64) std::atomic<uint64_t> head_;  // Written by the producer only.
+  alignas(64) std::atomic<uint64_t> tail_;  // Written by the consumer only.
+  alignas(64) ShmChannelSlot slots_[kShmChannelSlots];
+
+ public:
+  ShmChannelRing() : head_(0u), tail_(0u) {}
+
+  constexpr static size_t MaxMessageLength() { return sizeof(ShmChannelSlot::data); }
+
+  bool TryPush(std::string_view message) {
+    if (message.length() > MaxMessageLength()) {
+      throw std::invalid_argument("The message does not fit into a shared-memory channel slot.");
+    }
+    uint64_t const head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= kShmChannelSlots) {
+      return false;
+    }
+    ShmChannelSlot& slot = slots_[head % kShmChannelSlots];
+    slot.length = static_cast<uint32_t>(message.length());
+    std::memcpy(slot.data, message.data(), message.length());
+    head_.store(head + 1u, std::memory_order_release);
+    return true;
+  }
+
+  // The length is written by the other process, so it is read once, and checked. A slot that claims more than it holds,
+  // which only a broken or hostile peer writes, pops as an empty message, invalid as a request and as a response alike,
+  // so that the rings stay in step.
+  bool TryPop(std::string& message) {
+    uint64_t const tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    ShmChannelSlot const& slot = slots_[tail % kShmChannelSlots];
+    uint32_t const length = slot.length;
+    if (length <= MaxMessageLength()) {
+      message.assign(slot.data, length);
+    } else {
+      message.clear();
+    }
+    tail_.store(tail + 1u, std::memory_order_release);
+    return true;
+  }
+};
+
+struct ShmChannelLayout final {
+  char magic[8] = {'S', 'L', 'P', 'S', 'H', 'M', '1', '\0'};
+  uint32_t slots = kShmChannelSlots;
+  uint32_t slot_bytes = kShmChannelSlotBytes;
+  ShmChannelRing requests;
+  ShmChannelRing responses;
+};
+
+// The mapping of `/dev/shm/$NAME`, created by the server, or opened by the client.
+class ShmChannelMapping final {
+ private:
+  std::string const name_;
+  bool const owner_;
+  ShmChannelLayout* layout_ = nullptr;
+
+ public:
+  ShmChannelMapping(std::string name, bool create) : name_(std::move(name)), owner_(create) {
+    std::string const path = '/' + name_;
+    int const fd =
+        create ? ::shm_open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600) : ::shm_open(path.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+      throw std::runtime_error("Can not open the shared memory `" + path + "`: " + std::strerror(errno) + '.');
+    }
+    if (create && ::ftruncate(fd, sizeof(ShmChannelLayout))) {
+      ::close(fd);
+      throw std::runtime_error("Can not size the shared memory `" + path + "`.");
+    }
+    void* const memory = ::mmap(nullptr, sizeof(ShmChannelLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+      throw std::runtime_error("Can not map the shared memory `" + path + "`.");
+    }
+    if (create) {
+      layout_ = new (memory) ShmChannelLayout();
+    } else {
+      layout_ = static_cast<ShmChannelLayout*>(memory);
+      ShmChannelLayout const expected;
+      if (std::memcmp(layout_->magic, expected.magic, sizeof(expected.magic)) || layout_->slots != expected.slots ||
+          layout_->slot_bytes != expected.slot_bytes) {
+        ::munmap(memory, sizeof(ShmChannelLayout));
+        throw std::runtime_error("The shared memory `" + path + "` is not a compatible channel.");
+      }
+    }
+  }
+
+  ~ShmChannelMapping() {
+    ::munmap(layout_, sizeof(ShmChannelLayout));
+    if (owner_) {
+      ::shm_unlink(('/' + name_).c_str());
+    }
+  }
+
+  ShmChannelMapping(ShmChannelMapping const&) = delete;
+  ShmChannelMapping& operator=(ShmChannelMapping const&) = delete;
+
+  ShmChannelRing& Requests() { return layout_->requests; }
+  ShmChannelRing& Responses() { return layout_->responses; }
+};
+
+class ShmPolicyClient final {
+ private:
+  ShmChannelMapping mapping_;
+
+ public:
+  explicit ShmPolicyClient(std::string const& name) : mapping_(name, false) {}
+
+  // Both return `false` instead of waiting, when the request ring is full, or when no response is ready, respectively.
+  bool TrySubmit(std::string_view query) { return mapping_.Requests().TryPush(query); }
+  bool TryReceive(std::string& result) { return mapping_.Responses().TryPop(result); }
+
+  // One round trip, spinning until it is done.
+  std::string Call(std::string_view query) {
+    ShmChannelBackoff backoff;
+    while (!TrySubmit(query)) {
+      backoff.Wait();
+    }
+    backoff.Reset();
+    std::string result;
+    while (!TryReceive(result)) {
+      backoff.Wait();
+    }
+    return result;
+  }
+};
+
+class ShmChannelServer final {
+ public:
+  using respond_t = std::function<void(std::string_view response)>;
+  // Calls `respond` once per request, in order.
+  using handler_t = std::function<void(std::vector<std::string_view> const& requests, respond_t const& respond)>;
+
+ private:
+  ShmChannelMapping mapping_;
+  handler_t const handler_;
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+
+  constexpr static char const* kTooLong = "{\"error\":\"The response does not fit into a shared-memory channel slot.\"}";
+  constexpr static char const* kMissing = "{\"error\":\"No response.\"}";
+
+  // Waits for room in the response ring. Returns `false` if the server is stopped meanwhile.
+  bool Push(std::string_view response, ShmChannelBackoff& backoff) {
+    if (response.length() > ShmChannelRing::MaxMessageLength()) {
+      response = kTooLong;
+    }
+    backoff.Reset();
+    while (!mapping_.Responses().TryPush(response)) {
+      if (stop_.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      backoff.Wait();
+    }
+    return true;
+  }
+
+  void Run() {
+    std::vector<std::string> messages(kShmChannelSlots);
+    std::vector<std::string_view> requests;
+    requests.reserve(kShmChannelSlots);
+    ShmChannelBackoff backoff;
+    while (!stop_.load(std::memory_order_relaxed)) {
+      requests.clear();
+      while (requests.size() < kShmChannelSlots && mapping_.Requests().TryPop(messages[requests.size()])) {
+        requests.push_back(messages[requests.size()]);
+      }
+      if (requests.empty()) {
+        backoff.Wait();
+        continue;
+      }
+      size_t responded = 0u;
+      bool stopped = false;
+      respond_t const respond = [&](std::string_view response) {
+        if (responded < requests.size() && !stopped) {
+          ++responded;
+          stopped = !Push(response, backoff);
+        }
+      };
+      handler_(requests, respond);
+      // Should the handler fall short, the responses still have to stay in step with the requests.
+      while (responded < requests.size() && !stopped) {
+        respond(kMissing);
+      }
+      if (stopped) {
+        return;
+      }
+      backoff.Reset();
+    }
+  }
+
+ public:
+  ShmChannelServer(std::string name, handler_t handler)
+      : mapping_(std::move(name), true), handler_(std::move(handler)), thread_([this]() { Run(); }) {}
+
+  ~ShmChannelServer() {
+    stop_.store(true, std::memory_order_relaxed);
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  ShmChannelServer(ShmChannelServer const&) = delete;
+  ShmChannelServer& operator=(ShmChannelServer const&) = delete;
+
+  // Blocks forever, as the channel is never closed from the other side.
+  void Join() { thread_.join(); }
+};
+
+#endif  // SLEIPNIR_SHM_CHANNEL_H
@@ -0,0 +1,1025 @@
+// A thread-per-core HTTP/1.1 server, the alternative to the `HTTP()` server of Current for the `-p` port of a policy.
+//
+// Each of its event loops is a thread of its own, optionally pinned to a core of its own, with its own listening socket
+// on the same port via `SO_REUSEPORT`, its own `epoll` instance, and its own connections. The kernel spreads the new
+// connections across the loops, and a connection stays on the loop that has accepted it, so the loops share nothing
+// on the request path: no locks, no queues, no handoffs between threads. Each loop allocates its buffers itself, once
+// pinned, so that they are local to its NUMA node, and glibc gives each such thread a `malloc()` arena of its own.
+// With `numa_node` set, the loops are pinned to the cores of that node only.
+//
+// With `io_uring` set, the loops run on io_uring instead of `epoll`, see `io_uring.h`: the accepts, receives and sends
+// of each loop are queued as they come up, and submitted together, with one system call per round of completions
+// rather than a few per request, into and from buffers registered with the kernel once. Where the kernel has no
+// io_uring, the loops run on `epoll`, and `UsesIOUring()` tells which.
+//
+// It speaks as much HTTP/1.1 as the policy endpoints need: `Content-Length` bodies, and keep-alive connections, with
+// pipelining. All the complete requests of each read are handled back to back, and all their responses are written
+// out with one `writev()`, or one io_uring send, see `HTTPResponseQueue`.
+//
+// With `receive_timestamps` set, each request comes with the time the kernel received it, and the time its handling
+// started, for the handler to know how long it has queued, in the socket and in the loop, see `admission_control.h`.
+
+#ifndef SLEIPNIR_THREAD_PER_CORE_SERVER_H
+#define SLEIPNIR_THREAD_PER_CORE_SERVER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "io_uring.h"
+
+struct ThreadPerCoreConfig final {
+  uint32_t threads = 0u;  // The number of event loops, zero for one per core available.
+  bool pin = true;  // Whether to pin each loop to a core of its own.
+  int32_t numa_node = -1;  // Set to only use the cores of this NUMA node.
+  bool io_uring = false;  // Whether to run the loops on io_uring, where available, rather than on `epoll`.
+  bool receive_timestamps = false;  // Whether to fill in `received_ns` and `started_ns` of the requests.
+  std::string address = "0.0.0.0";  // The IPv4 address to listen on, `127.0.0.1` for the loopback interface only.
+};
+
+struct HTTPServerRequest final {
+  std::string_view method;
+  std::string_view path;
+  std::string_view body;
+  // With `ThreadPerCoreConfig::receive_timestamps`, the `CLOCK_REALTIME` nanoseconds of when the kernel received the
+  // last bytes of the request, and of when its handling started; zeros otherwise.
+  uint64_t received_ns = 0u;
+  uint64_t started_ns = 0u;
+};
+
+struct HTTPServerResponse final {
+  int status = 200;
+  char const* content_type = "application/json";
+  std::string body;
+};
+
+// Parses `0-3,8,10-11`, the format of `/sys/devices/system/node/node*/cpulist`.
+inline std::vector<int> ParseCPUList(std::string const& list) {
+  std::vector<int> cpus;
+  size_t i = 0u;
+  while (i < list.length()) {
+    size_t const end = std::min(list.find(',', i), list.length());
+    std::string const range = list.substr(i, end - i);
+    size_t const dash = range.find('-');
+    if (!range.empty() && range[0] >= '0' && range[0] <= '9') {
+      int const first = std::stoi(range);
+      int const last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1u));
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    }
+    i = end + 1u;
+  }
+  return cpus;
+}
+
+// The cores this process may run on, of `numa_node` only unless it is negative.
+inline std::vector<int> ThreadPerCoreCPUs(int32_t numa_node) {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (::sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    throw std::runtime_error("Can not get the CPU affinity of the process.");
+  }
+  std::vector<int> cpus;
+  if (numa_node >= 0) {
+    std::string list;
+    std::ifstream fi("/sys/devices/system/node/node" + std::to_string(numa_node) + "/cpulist");
+    if (!std::getline(fi, list)) {
+      throw std::runtime_error("No NUMA node " + std::to_string(numa_node) + '.');
+    }
+    for (int const cpu : ParseCPUList(list)) {
+      if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+  } else {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  if (cpus.empty()) {
+    throw std::runtime_error("No cores available for the event loops.");
+  }
+  return cpus;
+}
+
+inline char const* HTTPStatusText(int status) {
+  switch (status) {
+    case 200:
+      return "OK";
+    case 400:
+      return "Bad Request";
+    case 403:
+      return "Forbidden";
+    case 404:
+      return "Not Found";
+    case 413:
+      return "Payload Too Large";
+    case 500:
+      return "Internal Server Error";
+    case 503:
+      return "Service Unavailable";
+    default:
+      return "Unknown";
+  }
+}
+
+// The requests of over this many bytes get a `413`, and their connection closed.
+constexpr static size_t kMaxHTTPRequestBytes = 1u << 26;
+// What `ParseHTTPRequest()` returns for a request whose declared body would make it over `kMaxHTTPRequestBytes`.
+constexpr static size_t kHTTPRequestTooLarge = std::string::npos - 1u;
+
+// Returns the number of bytes of the first complete HTTP request in `buffer`, zero if it is not complete yet,
+// `std::string::npos` if the bytes are not an HTTP/1.x request with a body of a known length, or `kHTTPRequestTooLarge`.
+inline size_t ParseHTTPRequest(std::string_view buffer, HTTPServerRequest& request, bool& keep_alive) {
+  size_t const headers_end = buffer.find("\r\n\r\n");
+  if (headers_end == std::string_view::npos) {
+    return 0u;
+  }
+  std::string_view const head = buffer.substr(0u, headers_end + 2u);
+  size_t const line_end = head.find("\r\n");
+  std::string_view const line = head.substr(0u, line_end);
+  size_t const space1 = line.find(' ');
+  size_t const space2 = line.rfind(' ');
+  if (space1 == std::string_view::npos || space2 == space1 || line.substr(space2 + 1u, 7u) != "HTTP/1.") {
+    return std::string::npos;
+  }
+  request.method = line.substr(0u, space1);
+  request.path = line.substr(space1 + 1u, space2 - space1 - 1u);
+  keep_alive = line.substr(space2 + 1u) == "HTTP/1.1";
+  size_t content_length = 0u;
+  auto const is = [](std::string_view name, char const* lowercase) {
+    size_t const n = std::strlen(lowercase);
+    if (name.length() != n) {
+      return false;
+    }
+    for (size_t i = 0u; i < n; ++i) {
+      if ((name[i] | 0x20) != lowercase[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  for (size_t i = line_end + 2u; i < head.length();) {
+    size_t const end = head.find("\r\n", i);
+    std::string_view const header = head.substr(i, end - i);
+    i = end + 2u;
+    size_t const colon = header.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    std::string_view const name = header.substr(0u, colon);
+    std::string_view value = header.substr(colon + 1u);
+    while (!value.empty() && value.front() == ' ') {
+      value.remove_prefix(1u);
+    }
+    if (is(name, "content-length")) {
+      content_length = 0u;
+      for (char const c : value) {
+        if (c < '0' || c > '9') {
+          return std::string::npos;
+        }
+        content_length = content_length * 10u + static_cast<size_t>(c - '0');
+        // Checked digit by digit, so that no number of digits can overflow it.
+        if (content_length > kMaxHTTPRequestBytes) {
+          return kHTTPRequestTooLarge;
+        }
+      }
+    } else if (is(name, "connection")) {
+      if (is(value, "close")) {
+        keep_alive = false;
+      } else if (is(value, "keep-alive")) {
+        keep_alive = true;
+      }
+    } else if (is(name, "transfer-encoding")) {
+      return std::string::npos;
+    }
+  }
+  size_t const total = headers_end + 4u + content_length;
+  if (total > kMaxHTTPRequestBytes) {
+    return kHTTPRequestTooLarge;
+  }
+  if (buffer.length() < total) {
+    return 0u;
+  }
+  request.body = buffer.substr(headers_end + 4u, content_length);
+  return total;
+}
+
+// The status line and the headers of `response`, up to and including the empty line before the body.
+inline void AppendHTTPResponseHead(HTTPServerResponse const& response, bool keep_alive, std::string& output) {
+  output += "HTTP/1.1 ";
+  output += std::to_string(response.status);
+  output += ' ';
+  output += HTTPStatusText(response.status);
+  output += "\r\nContent-Type: ";
+  output += response.content_type;
+  output += "\r\nContent-Length: ";
+  output += std::to_string(response.body.length());
+  output += keep_alive ? "\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+}
+
+inline uint64_t RealtimeNanoseconds() {
+  timespec now;
+  ::clock_gettime(CLOCK_REALTIME, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000u + static_cast<uint64_t>(now.tv_nsec);
+}
+
+// The software receive timestamp of the `recvmsg()` of `message`, from a socket with `SO_TIMESTAMPING` set, or zero.
+// The control buffer is expected to be zeroed before the receive, as io_uring may leave `msg_controllen` as it was.
+inline uint64_t ReceiveTimestamp(msghdr const& message) {
+  char const* control = static_cast<char const*>(message.msg_control);
+  size_t offset = 0u;
+  while (offset + sizeof(cmsghdr) <= message.msg_controllen) {
+    cmsghdr header;
+    std::memcpy(&header, control + offset, sizeof(header));
+    if (header.cmsg_len < sizeof(cmsghdr) || offset + header.cmsg_len > message.msg_controllen) {
+      break;
+    }
+    if (header.cmsg_level == SOL_SOCKET && header.cmsg_type == SCM_TIMESTAMPING &&
+        header.cmsg_len >= CMSG_LEN(sizeof(timespec))) {
+      timespec software;  // The first of the three, the software one.
+      std::memcpy(&software, control + offset + CMSG_LEN(0), sizeof(software));
+      return static_cast<uint64_t>(software.tv_sec) * 1000000000u + static_cast<uint64_t>(software.tv_nsec);
+    }
+    offset += CMSG_ALIGN(header.cmsg_len);
+  }
+  return 0u;
+}
+
+// The responses to the pipelined requests of a connection, to be written out at once. The heads go back to back into
+// one buffer, and the bodies are moved in, not copied, into buffers of their own, to be gathered by `writev()`. All the
+// buffers are kept from round to round of the connection, as are their capacities.
+class HTTPResponseQueue final {
+ private:
+  std::string heads_;
+  std::vector<size_t> head_ends_;
+  std::vector<std::string> bodies_;
+  size_t count_ = 0u;
+  size_t bytes_ = 0u;
+  std::vector<iovec> iov_;  // Built by `Seal()`, and consumed by `Advance()`.
+  size_t iov_next_ = 0u;
+
+ public:
+  bool Empty() const { return !count_; }
+  size_t Bytes() const { return bytes_; }
+
+  // Takes the body of `response`, and leaves it the body of an earlier round, to be cleared and reused.
+  void Push(HTTPServerResponse& response, bool keep_alive) {
+    AppendHTTPResponseHead(response, keep_alive, heads_);
+    head_ends_.push_back(heads_.length());
+    if (bodies_.size() == count_) {
+      bodies_.emplace_back();
+    }
+    bodies_[count_].swap(response.body);
+    bytes_ += bodies_[count_].length();
+    ++count_;
+  }
+
+  // Done pushing, ready to write out.
+  void Seal() {
+    bytes_ += heads_.length();
+    iov_.clear();
+    iov_next_ = 0u;
+    size_t head_begin = 0u;
+    for (size_t i = 0u; i < count_; ++i) {
+      iov_.push_back(iovec{&heads_[head_begin], head_ends_[i] - head_begin});
+      if (!bodies_[i].empty()) {
+        iov_.push_back(iovec{&bodies_[i][0], bodies_[i].length()});
+      }
+      head_begin = head_ends_[i];
+    }
+  }
+
+  // The part not written out yet, as of `Seal()` and `Advance()`.
+  iovec* Pending() { return iov_.data() + iov_next_; }
+  size_t PendingCount() const { return iov_.size() - iov_next_; }
+  bool Done() const { return iov_next_ == iov_.size(); }
+
+  void Advance(size_t bytes) {
+    while (bytes && iov_next_ < iov_.size()) {
+      iovec& v = iov_[iov_next_];
+      size_t const n = std::min(bytes, v.iov_len);
+      v.iov_base = static_cast<char*>(v.iov_base) + n;
+      v.iov_len -= n;
+      bytes -= n;
+      if (!v.iov_len) {
+        ++iov_next_;
+      }
+    }
+  }
+
+  // Copies out the whole of what is queued, `Bytes()` of it, once sealed.
+  void CopyTo(char* destination) const {
+    for (iovec const& v : iov_) {
+      std::memcpy(destination, v.iov_base, v.iov_len);
+      destination += v.iov_len;
+    }
+  }
+
+  void Clear() {
+    heads_.clear();
+    head_ends_.clear();
+    count_ = 0u;
+    bytes_ = 0u;
+    iov_.clear();
+    iov_next_ = 0u;
+  }
+};
+
+class ThreadPerCoreHTTPServer final {
+ public:
+  // Fills in `response`, which is reused, and comes in with the default status and content type, and an empty body.
+  // Called on the loop of the connection; the handler must be safe to call from all the loops concurrently.
+  using handler_t = std::function<void(HTTPServerRequest const& request, HTTPServerResponse& response)>;
+
+  constexpr static size_t kMaxRequestBytes = kMaxHTTPRequestBytes;
+
+ private:
+  struct Connection final {
+    int fd = -1;
+    std::string in;  // What is left over of an incomplete request.
+    HTTPResponseQueue out;
+    bool closing = false;  // Set once the response to the last request is queued in `out`.
+    int fixed = -1;  // The pair of registered buffers of the io_uring loop, if any.
+    bool fixed_send = false;  // Whether `out` is being sent from the registered buffer.
+    size_t fixed_offset = 0u;  // How much of the registered buffer is sent.
+    msghdr message;  // Of the io_uring send of `out` not from the registered buffer, or receive with a timestamp.
+    iovec recv_iov;  // Of the io_uring receive with a timestamp.
+    alignas(cmsghdr) char control[64];  // The timestamp of the last receive, with `receive_timestamps`.
+    std::vector<char> recv_buffer;  // For the io_uring loop, without a registered buffer.
+  };
+
+  // What the two kinds of loops share: the listening socket, the connections, and the handling of the requests.
+  class Loop {
+   protected:
+    // For how long to stop accepting once out of file descriptors, for the connections open to close some of them.
+    constexpr static int kAcceptPauseMS = 100;
+
+    static bool IsOutOfDescriptors(int error) {
+      return error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM;
+    }
+
+    handler_t const& handler_;
+    int const cpu_;
+    bool const timestamps_;
+    int listen_fd_ = -1;
+    int stop_fd_ = -1;
+    std::thread thread_;
+
+    // All owned by the thread of the loop, and allocated by it.
+    std::vector<std::unique_ptr<Connection>> connections_;  // By file descriptor.
+    HTTPServerRequest request_;
+    HTTPServerResponse response_;
+
+    virtual void Run() = 0;
+
+    Connection& Add(int fd) {
+      int const one = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      if (timestamps_) {
+        int const flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        ::setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+      }
+      if (connections_.size() <= static_cast<size_t>(fd)) {
+        connections_.resize(static_cast<size_t>(fd) + 1u);
+      }
+      connections_[fd] = std::make_unique<Connection>();
+      connections_[fd]->fd = fd;
+      return *connections_[fd];
+    }
+
+    Connection* Find(int fd) const {
+      return static_cast<size_t>(fd) < connections_.size() ? connections_[fd].get() : nullptr;
+    }
+
+    void Remove(Connection& c) {
+      int const fd = c.fd;
+      ::close(fd);
+      connections_[fd] = nullptr;
+    }
+
+    // Handles the first request of `input`, if complete, queueing its response in `c.out`. Returns the number of
+    // bytes of the request, all of `input` if it is not a valid one, or zero if it is not complete yet.
+    size_t HandleOne(std::string_view input, Connection& c) {
+      bool keep_alive = true;
+      size_t n = ParseHTTPRequest(input, request_, keep_alive);
+      response_.status = 200;
+      response_.content_type = "application/json";
+      response_.body.clear();
+      if (n == std::string::npos || n == kHTTPRequestTooLarge || (!n && input.length() > kMaxRequestBytes)) {
+        response_.status = n == std::string::npos ? 400 : 413;
+        response_.content_type = "text/plain";
+        keep_alive = false;
+        n = input.length();
+      } else if (!n) {
+        return 0u;
+      } else {
+        request_.started_ns = request_.received_ns ? RealtimeNanoseconds() : 0u;
+        try {
+          handler_(request_, response_);
+        } catch (std::exception const&) {
+          response_.status = 500;
+          response_.content_type = "text/plain";
+          response_.body.clear();
+        }
+      }
+      c.out.Push(response_, keep_alive);
+      c.closing = !keep_alive;
+      return n;
+    }
+
+    // Handles all the complete requests, back to back, of the `received` bytes, prefixed with what is left over in
+    // `c.in` from before, and keeps what is left over of them in `c.in`. Seals `c.out`, unless there are no responses.
+    // The requests are stamped with `received_ns`, when the kernel received the last of the bytes.
+    void HandleAll(Connection& c, char const* received, size_t bytes, uint64_t received_ns) {
+      request_.received_ns = received_ns;
+      // Parsed in place, unless a part of a request is left over from the previous read.
+      bool const in_place = c.in.empty();
+      if (!in_place) {
+        c.in.append(received, bytes);
+      }
+      std::string_view const input = in_place ? std::string_view(received, bytes) : std::string_view(c.in);
+      size_t offset = 0u;
+      while (!c.closing) {
+        size_t const n = HandleOne(input.substr(offset), c);
+        if (!n) {
+          break;
+        }
+        offset += n;
+      }
+      if (in_place) {
+        c.in.assign(input.substr(offset));
+      } else {
+        c.in.erase(0u, offset);
+      }
+      if (!c.out.Empty()) {
+        c.out.Seal();
+      }
+    }
+
+   public:
+    Loop(in_addr address, uint16_t port, handler_t const& handler, int cpu, bool timestamps)
+        : handler_(handler), cpu_(cpu), timestamps_(timestamps) {
+      listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (listen_fd_ < 0) {
+        throw std::runtime_error("Can not create a TCP socket.");
+      }
+      int const one = 1;
+      ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))) {
+        ::close(listen_fd_);
+        throw std::runtime_error("No `SO_REUSEPORT`: " + std::string(std::strerror(errno)) + '.');
+      }
+      sockaddr_in socket_address;
+      std::memset(&socket_address, 0, sizeof(socket_address));
+      socket_address.sin_family = AF_INET;
+      socket_address.sin_addr = address;
+      socket_address.sin_port = htons(port);
+      if (::bind(listen_fd_, reinterpret_cast<sockaddr const*>(&socket_address), sizeof(socket_address)) ||
+          ::listen(listen_fd_, SOMAXCONN)) {
+        ::close(listen_fd_);
+        throw std::runtime_error("Can not listen on port " + std::to_string(port) + ": " + std::strerror(errno) + '.');
+      }
+      stop_fd_ = ::eventfd(0u, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    // Shuts the sockets down before closing them: the operations the io_uring loop had in flight on a socket keep it
+    // open past `close()`, until the kernel is done tearing the ring down, and a listening socket left so would get a
+    // share of the connections to the next server on the port, via `SO_REUSEPORT`, only to drop them.
+    virtual ~Loop() {
+      for (std::unique_ptr<Connection> const& c : connections_) {
+        if (c) {
+          ::shutdown(c->fd, SHUT_RDWR);
+          ::close(c->fd);
+        }
+      }
+      ::close(stop_fd_);
+      ::shutdown(listen_fd_, SHUT_RDWR);
+      ::close(listen_fd_);
+    }
+
+    Loop(Loop const&) = delete;
+    Loop& operator=(Loop const&) = delete;
+
+    void Start() {
+      thread_ = std::thread([this]() {
+        if (cpu_ >= 0) {
+          cpu_set_t cpus;
+          CPU_ZERO(&cpus);
+          CPU_SET(cpu_, &cpus);
+          ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus);
+        }
+        Run();
+      });
+    }
+
+    // To be called by the destructors of the loops, before their own members are destroyed.
+    void Stop() {
+      uint64_t const one = 1u;
+      (void)::write(stop_fd_, &one, sizeof(one));
+      Join();
+    }
+
+    void Join() {
+      if (thread_.joinable()) {
+        thread_.join();
+      }
+    }
+  };
+
+  class EpollLoop final : public Loop {
+   private:
+    int epoll_fd_ = -1;
+    std::vector<char> chunk_;
+    // Out of file descriptors, the listening socket is taken out of the `epoll` set for a while, as it would otherwise
+    // stay readable, and the loop would spin on the accepts failing.
+    bool accepts_paused_ = false;
+    std::chrono::steady_clock::time_point accepts_resume_at_;
+
+    void Watch(int fd, uint32_t events, int op) {
+      epoll_event event;
+      event.events = events;
+      event.data.fd = fd;
+      ::epoll_ctl(epoll_fd_, op, fd, &event);
+    }
+
+    void Accept() {
+      while (true) {
+        int const fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+          if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+          }
+          if (IsOutOfDescriptors(errno)) {
+            ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+            accepts_paused_ = true;
+            accepts_resume_at_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(kAcceptPauseMS);
+          }
+          return;
+        }
+        Add(fd);
+        Watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+      }
+    }
+
+    // The milliseconds to wait for the events for, until the accepts are to be resumed, if paused, or forever.
+    int Timeout() {
+      if (!accepts_paused_) {
+        return -1;
+      }
+      auto const now = std::chrono::steady_clock::now();
+      if (now >= accepts_resume_at_) {
+        accepts_paused_ = false;
+        Watch(listen_fd_, EPOLLIN, EPOLL_CTL_ADD);
+        return -1;
+      }
+      return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(accepts_resume_at_ - now).count());
+    }
+
+    void Close(Connection& c) {
+      ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, c.fd, nullptr);
+      Remove(c);
+    }
+
+    // Writes out what it can of `c.out`, with one `writev()` unless the socket takes only a part of it. Returns
+    // `false` if the connection is broken.
+    bool Flush(Connection& c) {
+      while (!c.out.Done()) {
+        int const count = static_cast<int>(std::min(c.out.PendingCount(), static_cast<size_t>(IOV_MAX)));
+        ssize_t const n = ::writev(c.fd, c.out.Pending(), count);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          return true;
+        }
+        if (n <= 0) {
+          return false;
+        }
+        c.out.Advance(static_cast<size_t>(n));
+      }
+      c.out.Clear();
+      return true;
+    }
+
+    // Reads once, as the readiness is level-triggered, and handles all the complete requests read, writing all their
+    // responses at once. What the socket does not take is written once it is writable, with no reads until then.
+    void OnReadable(Connection& c) {
+      iovec iov{chunk_.data(), chunk_.size()};
+      msghdr message;
+      std::memset(&message, 0, sizeof(message));
+      message.msg_iov = &iov;
+      message.msg_iovlen = 1u;
+      if (timestamps_) {
+        message.msg_control = c.control;
+        message.msg_controllen = sizeof(c.control);
+      }
+      ssize_t n;
+      do {
+        n = ::recvmsg(c.fd, &message, 0);
+      } while (n < 0 && errno == EINTR);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+      }
+      if (n <= 0) {
+        Close(c);
+        return;
+      }
+      HandleAll(c, chunk_.data(), static_cast<size_t>(n), timestamps_ ? ReceiveTimestamp(message) : 0u);
+      if (!Flush(c)) {
+        Close(c);
+      } else if (!c.out.Empty()) {
+        Watch(c.fd, EPOLLOUT, EPOLL_CTL_MOD);
+      } else if (c.closing) {
+        Close(c);
+      }
+    }
+
+    void OnWritable(Connection& c) {
+      if (!Flush(c)) {
+        Close(c);
+      } else if (c.out.Empty()) {
+        if (c.closing) {
+          Close(c);
+        } else {
+          Watch(c.fd, EPOLLIN, EPOLL_CTL_MOD);
+        }
+      }
+    }
+
+    void Run() override {
+      chunk_.resize(1u << 16);
+      std::vector<epoll_event> events(256u);
+      while (true) {
+        int const n = ::epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), Timeout());
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          break;
+        }
+        for (int i = 0; i < n; ++i) {
+          int const fd = events[i].data.fd;
+          if (fd == stop_fd_) {
+            return;
+          } else if (fd == listen_fd_) {
+            Accept();
+          } else if (Connection* c = Find(fd)) {
+            if (events[i].events & EPOLLOUT) {
+              OnWritable(*c);
+            } else {
+              OnReadable(*c);
+            }
+          }
+        }
+      }
+    }
+
+   public:
+    EpollLoop(in_addr address, uint16_t port, handler_t const& handler, int cpu, bool timestamps)
+        : Loop(address, port, handler, cpu, timestamps) {
+      epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+      Watch(listen_fd_, EPOLLIN, EPOLL_CTL_ADD);
+      Watch(stop_fd_, EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    ~EpollLoop() override {
+      Stop();
+      ::close(epoll_fd_);
+    }
+  };
+
+  // Keeps one operation in flight per connection, a receive or a send, and one accept, and submits all the operations
+  // queued by the completions of each round with a single `io_uring_enter()`, which also waits for the next ones.
+  // The first `kFixedConnections` connections of each loop receive into, and send from, registered buffers.
+  class IOUringLoop final : public Loop {
+   private:
+    constexpr static unsigned kEntries = 4096u;
+    constexpr static size_t kFixedConnections = 64u;
+    constexpr static size_t kFixedBufferBytes = 1u << 14;
+
+    enum class Op : uint64_t { Accept = 1u, Recv, Send, Stop, AcceptPause };
+
+    std::vector<char> fixed_;  // Two registered buffers per connection, the receive one and the send one.
+    std::vector<int> free_fixed_;
+    uint64_t stop_value_ = 0u;
+    bool stopping_ = false;
+    __kernel_timespec accept_pause_{0, kAcceptPauseMS * 1000000ll};
+    bool accept_paused_ = false;  // Whether the timeout of `SubmitAcceptPause()` is in flight.
+    size_t in_flight_ = 0u;  // The operations submitted, or queued, and not completed yet.
+    // Declared last, so that it is destroyed first, before the buffers that the kernel may still be using.
+    IOURing ring_;
+
+    io_uring_sqe* NextSQE() {
+      ++in_flight_;
+      return ring_.NextSQE();
+    }
+
+    static uint64_t Tag(Op op, int fd) { return (static_cast<uint64_t>(op) << 32) | static_cast<uint32_t>(fd); }
+    char* FixedBuffer(int index) { return &fixed_[static_cast<size_t>(index) * kFixedBufferBytes]; }
+
+    void SubmitAccept() {
+      io_uring_sqe* const sqe = NextSQE();
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = listen_fd_;
+      sqe->accept_flags = SOCK_CLOEXEC;
+      sqe->user_data = Tag(Op::Accept, listen_fd_);
+    }
+
+    // Out of file descriptors, waits for a while before accepting again, rather than failing the accepts in a loop.
+    void SubmitAcceptPause() {
+      io_uring_sqe* const sqe = NextSQE();
+      sqe->opcode = IORING_OP_TIMEOUT;
+      sqe->addr = reinterpret_cast<uint64_t>(&accept_pause_);
+      sqe->len = 1u;
+      sqe->user_data = Tag(Op::AcceptPause, listen_fd_);
+      accept_paused_ = true;
+    }
+
+    // Receives into the registered buffer of `c`, if any. With the timestamps, as a `recvmsg()` with its control
+    // buffer, which is not a fixed buffer operation, into the same memory nonetheless.
+    void SubmitRecv(Connection& c) {
+      io_uring_sqe* const sqe = NextSQE();
+      sqe->fd = c.fd;
+      sqe->user_data = Tag(Op::Recv, c.fd);
+      if (timestamps_) {
+        if (c.fixed < 0) {
+          c.recv_buffer.resize(kFixedBufferBytes);
+        }
+        c.recv_iov.iov_base = c.fixed >= 0 ? FixedBuffer(2 * c.fixed) : c.recv_buffer.data();
+        c.recv_iov.iov_len = kFixedBufferBytes;
+        std::memset(&c.message, 0, sizeof(c.message));
+        std::memset(c.control, 0, sizeof(c.control));
+        c.message.msg_iov = &c.recv_iov;
+        c.message.msg_iovlen = 1u;
+        c.message.msg_control = c.control;
+        c.message.msg_controllen = sizeof(c.control);
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->addr = reinterpret_cast<uint64_t>(&c.message);
+      } else if (c.fixed >= 0) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = reinterpret_cast<uint64_t>(FixedBuffer(2 * c.fixed));
+        sqe->len = kFixedBufferBytes;
+        sqe->buf_index = static_cast<uint16_t>(2 * c.fixed);
+      } else {
+        c.recv_buffer.resize(kFixedBufferBytes);
+        sqe->opcode = IORING_OP_RECV;
+        sqe->addr = reinterpret_cast<uint64_t>(c.recv_buffer.data());
+        sqe->len = static_cast<uint32_t>(c.recv_buffer.size());
+      }
+    }
+
+    // Sends the rest of `c.out`: from the registered buffer if the whole of it fits there, or gathered as `writev()`
+    // would otherwise.
+    void SubmitSend(Connection& c) {
+      io_uring_sqe* const sqe = NextSQE();
+      sqe->fd = c.fd;
+      sqe->user_data = Tag(Op::Send, c.fd);
+      if (c.fixed_send) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = reinterpret_cast<uint64_t>(FixedBuffer(2 * c.fixed + 1) + c.fixed_offset);
+        sqe->len = static_cast<uint32_t>(c.out.Bytes() - c.fixed_offset);
+        sqe->buf_index = static_cast<uint16_t>(2 * c.fixed + 1);
+      } else {
+        std::memset(&c.message, 0, sizeof(c.message));
+        c.message.msg_iov = c.out.Pending();
+        c.message.msg_iovlen = std::min(c.out.PendingCount(), static_cast<size_t>(IOV_MAX));
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = reinterpret_cast<uint64_t>(&c.message);
+        sqe->msg_flags = MSG_NOSIGNAL;
+      }
+    }
+
+    void StartSend(Connection& c) {
+      c.fixed_send = c.fixed >= 0 && c.out.Bytes() <= kFixedBufferBytes;
+      c.fixed_offset = 0u;
+      if (c.fixed_send) {
+        c.out.CopyTo(FixedBuffer(2 * c.fixed + 1));
+      }
+      SubmitSend(c);
+    }
+
+    void Close(Connection& c) {
+      if (c.fixed >= 0) {
+        free_fixed_.push_back(c.fixed);
+      }
+      Remove(c);
+    }
+
+    // Handles all the complete requests received, and sends all their responses at once, or receives more.
+    void OnReceived(Connection& c, size_t bytes) {
+      HandleAll(c,
+                c.fixed >= 0 ? FixedBuffer(2 * c.fixed) : c.recv_buffer.data(),
+                bytes,
+                timestamps_ ? ReceiveTimestamp(c.message) : 0u);
+      if (!c.out.Empty()) {
+        StartSend(c);
+      } else if (c.closing) {
+        Close(c);
+      } else {
+        SubmitRecv(c);
+      }
+    }
+
+    void OnSent(Connection& c, size_t bytes) {
+      if (c.fixed_send) {
+        c.fixed_offset += bytes;
+        if (c.fixed_offset < c.out.Bytes()) {
+          SubmitSend(c);
+          return;
+        }
+      } else {
+        c.out.Advance(bytes);
+        if (!c.out.Done()) {
+          SubmitSend(c);
+          return;
+        }
+      }
+      c.out.Clear();
+      if (c.closing) {
+        Close(c);
+      } else {
+        SubmitRecv(c);
+      }
+    }
+
+    void OnCompletion(io_uring_cqe const& cqe) {
+      Op const op = static_cast<Op>(cqe.user_data >> 32);
+      int const fd = static_cast<int>(cqe.user_data & 0xffffffffu);
+      --in_flight_;
+      if (op == Op::Stop) {
+        stopping_ = true;
+      } else if (op == Op::Accept) {
+        if (cqe.res >= 0) {
+          Connection& c = Add(cqe.res);
+          if (!free_fixed_.empty()) {
+            c.fixed = free_fixed_.back();
+            free_fixed_.pop_back();
+          }
+          SubmitRecv(c);
+          SubmitAccept();
+        } else if (IsOutOfDescriptors(-cqe.res)) {
+          SubmitAcceptPause();
+        } else {
+          SubmitAccept();
+        }
+      } else if (op == Op::AcceptPause) {
+        accept_paused_ = false;
+        SubmitAccept();
+      } else if (Connection* c = Find(fd)) {
+        if (cqe.res <= 0) {
+          Close(*c);
+        } else if (op == Op::Recv) {
+          OnReceived(*c, static_cast<size_t>(cqe.res));
+        } else {
+          OnSent(*c, static_cast<size_t>(cqe.res));
+        }
+      }
+    }
+
+    void Run() override {
+      fixed_.resize(2u * kFixedConnections * kFixedBufferBytes);
+      std::vector<iovec> buffers(2u * kFixedConnections);
+      for (size_t i = 0u; i < buffers.size(); ++i) {
+        buffers[i].iov_base = &fixed_[i * kFixedBufferBytes];
+        buffers[i].iov_len = kFixedBufferBytes;
+      }
+      if (ring_.RegisterBuffers(buffers)) {
+        for (int i = static_cast<int>(kFixedConnections) - 1; i >= 0; --i) {
+          free_fixed_.push_back(i);
+        }
+      } else {
+        fixed_.clear();
+        fixed_.shrink_to_fit();
+      }
+      io_uring_sqe* const sqe = NextSQE();
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = stop_fd_;
+      sqe->addr = reinterpret_cast<uint64_t>(&stop_value_);
+      sqe->len = sizeof(stop_value_);
+      sqe->user_data = Tag(Op::Stop, stop_fd_);
+      SubmitAccept();
+      while (!stopping_) {
+        ring_.Submit(1u);
+        ring_.ForEachCompletion([this](io_uring_cqe const& cqe) { OnCompletion(cqe); });
+      }
+    }
+
+   public:
+    IOUringLoop(in_addr address, uint16_t port, handler_t const& handler, int cpu, bool timestamps)
+        : Loop(address, port, handler, cpu, timestamps), ring_(kEntries) {
+      // The operations on the listening socket wait in the ring, not in `accept4()`.
+      ::fcntl(listen_fd_, F_SETFL, ::fcntl(listen_fd_, F_GETFL) & ~O_NONBLOCK);
+    }
+
+    // The operations still in flight receive into, and send from, the buffers of the connections and `fixed_`, so they
+    // are all completed before any of those is freed: the sockets are shut down, which completes the accept, and the
+    // receives and the sends, and the pause before the next accept, if any, is cancelled.
+    ~IOUringLoop() override {
+      Stop();
+      ::shutdown(listen_fd_, SHUT_RDWR);
+      for (std::unique_ptr<Connection> const& c : connections_) {
+        if (c) {
+          ::shutdown(c->fd, SHUT_RDWR);
+        }
+      }
+      if (accept_paused_) {
+        io_uring_sqe* const sqe = NextSQE();
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->addr = Tag(Op::AcceptPause, listen_fd_);
+        sqe->user_data = Tag(Op::Stop, stop_fd_);
+      }
+      while (in_flight_) {
+        ring_.Submit(1u);
+        ring_.ForEachCompletion([this](io_uring_cqe const& cqe) {
+          --in_flight_;
+          if (static_cast<Op>(cqe.user_data >> 32) == Op::Accept && cqe.res >= 0) {
+            ::close(cqe.res);
+          }
+        });
+      }
+    }
+  };
+
+  handler_t const handler_;
+  std::vector<std::unique_ptr<Loop>> loops_;
+  bool io_uring_ = false;
+
+ public:
+  ThreadPerCoreHTTPServer(uint16_t port, ThreadPerCoreConfig const& config, handler_t handler)
+      : handler_(std::move(handler)) {
+    // The peers that have gone away are noticed via the errors of the writes, not the signal.
+    ::signal(SIGPIPE, SIG_IGN);
+    std::vector<int> const cpus = ThreadPerCoreCPUs(config.numa_node);
+    size_t const threads = config.threads ? config.threads : cpus.size();
+    io_uring_ = config.io_uring;
+    in_addr address;
+    if (::inet_pton(AF_INET, config.address.c_str(), &address) != 1) {
+      throw std::invalid_argument("The address `" + config.address + "` is not an IPv4 address.");
+    }
+    // All the listening sockets are bound before any loop starts, so that the failure to bind any one of them throws.
+    for (size_t i = 0u; i < threads; ++i) {
+      int const cpu = config.pin ? cpus[i % cpus.size()] : -1;
+      if (io_uring_) {
+        try {
+          loops_.push_back(std::make_unique<IOUringLoop>(address, port, handler_, cpu, config.receive_timestamps));
+          continue;
+        } catch (std::runtime_error const&) {
+          if (i) {
+            throw;
+          }
+          io_uring_ = false;  // Falls back to `epoll` if the kernel has no io_uring.
+        }
+      }
+      loops_.push_back(std::make_unique<EpollLoop>(address, port, handler_, cpu, config.receive_timestamps));
+    }
+    for (std::unique_ptr<Loop>& loop : loops_) {
+      loop->Start();
+    }
+  }
+
+  ThreadPerCoreHTTPServer(ThreadPerCoreHTTPServer const&) = delete;
+  ThreadPerCoreHTTPServer& operator=(ThreadPerCoreHTTPServer const&) = delete;
+
+  size_t Loops() const { return loops_.size(); }
+  // Whether the loops are on io_uring, as asked for and supported by the kernel, or on `epoll`.
+  bool UsesIOUring() const { return io_uring_; }
+
+  // Blocks for as long as the loops are up.
+  void Join() {
+    for (std::unique_ptr<Loop>& loop : loops_) {
+      loop->Join();
+    }
+  }
+};
+
+#endif  // SLEIPNIR_THREAD_PER_CORE_SERVER_H
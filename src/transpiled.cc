@@ -2,8 +2,14 @@
 // g++ -Wall -std=c++17 -O3 -DNDEBUG -pthread rego.cc -o rego
 
 #include <cstdarg>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <type_traits>
 
 #include "current/blocks/http/api.h"
 #include "current/blocks/json/json.h"
@@ -12,6 +18,20 @@
 #include "current/bricks/dflags/dflags.h"
 #include "current/bricks/file/file.h"
 
+#include "admission_control.h"
+#include "bench_stages.h"
+#include "binary_protocol.h"
+#include "decision_log.h"
+#include "mmap_lines.h"
+#include "opa_profile.h"
+#include "ordered_pipeline.h"
+#include "perf_counters.h"
+#include "query_corpus.h"
+#include "server_metrics.h"
+#include "shm_channel.h"
+#include "thread_per_core_server.h"
+#include "unix_socket_server.h"
+
 using namespace current::json;
 using namespace current::vt100;
 
@@ -20,14 +40,103 @@ using policy_input_t = JSONValue;
 // === INSERT CUSTOM TYPE INSTEAD OF `policy_input_t` IF NEEDED ===
 
 DEFINE_uint16(p, 0u, "Set `-p $PORT` to listen on `localhost:$PORT`.");
-DEFINE_bool(d, false, "Set `-d` to daemonize the HTTP server on port `-p`.");
+DEFINE_bool(d, false, "Set `-d` to daemonize the HTTP server on port `-p`, and the other listeners, if any.");
 DEFINE_string(queries, "", "Set to run a local perftest, separating JSON parsing from policy evaluation.");
 DEFINE_string(output, "", "Set to write the results of running against `--queries`.");
+DEFINE_string(stages_json, "", "Set to write the in-process per-stage timings over `--queries` into this file.");
+DEFINE_string(compile_queries, "", "Set to compile `--queries` into this binary corpus file for `--queries_bin`.");
+DEFINE_string(queries_bin, "", "Set to run a local perftest against the binary corpus from `--compile_queries`.");
+DEFINE_uint32(queries_chunk, 0u, "Set to stream `--queries`, parsing and evaluating this many queries at a time.");
+DEFINE_uint32(threads, 0u, "The number of worker threads for the standard input mode, zero for one per core.");
+DEFINE_uint32(stdin_chunk_bytes, 1u << 20, "The size of the blocks the standard input mode reads and processes at once.");
+DEFINE_uint32(batch, 0u, "Set to evaluate `--queries` via `policy_batch()`, this many inputs at a time.");
+DEFINE_uint32(batch_chunk, 1000u, "The number of NDJSON results to stream back per chunk from `/v1/batch/...`.");
+DEFINE_bool(perf_counters, false, "Set to report IPC, cache and branch misses per query in the `--queries` mode.");
+DEFINE_uint32(metrics_sample, 64u, "Time the stages of one in this many requests per thread for `/metrics`.");
+DEFINE_string(decision_log, "", "Set to log every decision, asynchronously, into this file.");
+DEFINE_string(decision_log_format, "ndjson", "The format of `--decision_log`, `ndjson` or `binary`.");
+DEFINE_uint32(decision_log_ring_bytes, 1u << 24, "The per-thread decision log buffer size; when it is full, drop.");
+DEFINE_uint32(decision_log_fsync_ms, 1000u, "How often to `fdatasync()` the decision log, in milliseconds.");
+DEFINE_string(unix_socket, "", "Set to also serve newline-delimited `{\"input\":{...}}` queries on this Unix socket.");
+DEFINE_string(shm_channel, "", "Set to also serve queries over the shared-memory channel `/dev/shm/$NAME`.");
+DEFINE_uint16(binary_port, 0u, "Set to also serve the compact binary protocol of `binary_protocol.h` on this port.");
+DEFINE_string(binary_address, "127.0.0.1", "The address of `--binary_port`, loopback-only unless set otherwise.");
+DEFINE_uint32(thread_per_core, 0u, "Set to serve `-p` from this many `SO_REUSEPORT` event loops instead, one per core.");
+DEFINE_bool(pin_threads, true, "Set to pin each event loop of `--thread_per_core` to a core of its own.");
+DEFINE_int32(numa_node, -1, "Set to only run the event loops of `--thread_per_core` on the cores of this NUMA node.");
+DEFINE_bool(io_uring, false, "Set to serve `-p` from event loops on io_uring, falling back to `epoll` where unsupported.");
+DEFINE_double(codel_target_ms, 0.0, "Set to shed the `-p` requests queued for longer than this when overloaded.");
+DEFINE_double(codel_interval_ms, 100.0, "The CoDel interval of `--codel_target_ms`, and the longest wait admitted.");
+DEFINE_string(shed_decision, "", "Set to `false`, or `null` for undefined, to answer the shed queries so, not `503`.");
 
 using OPAString = Optional<std::string>;
-using OPANumber = Optional<double>;
 using OPABoolean = Optional<bool>;
 
+// The numbers of the locals, optional as `Optional<double>` was, but tagged: the integers, the array indexes and the loop
+// keys among them, are exact `int64_t`-s, and `+`, `-` and `*` on them are exact, with only the results that would
+// overflow `int64_t` promoted to doubles. The doubles that hold integers are stored as integers, so comparing is exact.
+// The numbers of `OPAValue` are `JSONNumber` doubles, which `NumberOf()` reads in as tagged.
+class OPANumber final {
+ private:
+  enum class Kind : uint8_t { Undefined, Integer, Double };
+  Kind kind_ = Kind::Undefined;
+  union {
+    int64_t integer_;
+    double double_;
+  };
+
+ public:
+  OPANumber() : integer_(0) {}
+  OPANumber(std::nullptr_t) : integer_(0) {}
+  template <typename T, class = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>>
+  OPANumber(T v) : kind_(Kind::Integer), integer_(static_cast<int64_t>(v)) {
+    if constexpr (std::is_unsigned_v<T> && sizeof(T) >= sizeof(int64_t)) {
+      if (v > static_cast<T>(std::numeric_limits<int64_t>::max())) {
+        kind_ = Kind::Double;
+        double_ = static_cast<double>(v);
+      }
+    }
+  }
+  OPANumber(double v) {
+    // The range of `int64_t` is [-2^63, 2^63); NaN-s fail the comparisons and stay doubles.
+    if (v >= -9223372036854775808.0 && v < 9223372036854775808.0 && static_cast<double>(static_cast<int64_t>(v)) == v) {
+      kind_ = Kind::Integer;
+      integer_ = static_cast<int64_t>(v);
+    } else {
+      kind_ = Kind::Double;
+      double_ = v;
+    }
+  }
+
+  // The double as is, not normalized, for the integer results that have overflowed.
+  static OPANumber Promoted(double v) {
+    OPANumber n;
+    n.kind_ = Kind::Double;
+    n.double_ = v;
+    return n;
+  }
+
+  bool IsDefined() const { return kind_ != Kind::Undefined; }
+  bool IsInteger() const { return kind_ == Kind::Integer; }
+  int64_t Integer() const { return integer_; }  // Only if `IsInteger()`.
+  double AsDouble() const { return kind_ == Kind::Integer ? static_cast<double>(integer_) : double_; }
+
+  // Exact also between an integer and a double. The undefined numbers only equal each other, as with `Optional`.
+  bool operator==(OPANumber const& rhs) const {
+    if (kind_ == rhs.kind_) {
+      return kind_ == Kind::Undefined || (kind_ == Kind::Integer ? integer_ == rhs.integer_ : double_ == rhs.double_);
+    } else if (kind_ == Kind::Undefined || rhs.kind_ == Kind::Undefined) {
+      return false;
+    }
+    OPANumber const& integer = IsInteger() ? *this : rhs;
+    OPANumber const normalized(IsInteger() ? rhs.double_ : double_);
+    return normalized.IsInteger() && normalized.integer_ == integer.integer_;
+  }
+};
+
+inline bool Exists(OPANumber const& n) { return n.IsDefined(); }
+inline double Value(OPANumber const& n) { return n.AsDouble(); }
+
 struct ArrayCreationCapacity final {
   size_t const capacity;
   ArrayCreationCapacity(size_t capacity) : capacity(capacity) {}
@@ -126,13 +235,8 @@ class OPAValue final {
   }
 
   OPAValue DoGetValueByKey(OPANumber key) const {
-    if (!Exists(key)) {
-      return OPAValue();
-    }
-    double const v = Value(key);
-    size_t const i = static_cast<size_t>(v);
-    if (static_cast<double>(i) == v) {
-      return DoGetValueByKey(i);
+    if (key.IsInteger() && key.Integer() >= 0) {
+      return DoGetValueByKey(static_cast<size_t>(key.Integer()));
     } else {
       return OPAValue();
     }
@@ -147,6 +251,56 @@ class OPAValue final {
 
 using OPAArray = OPAValue;  // This is ugly, but will do for now.
 
+inline OPANumber NumberOf(OPAValue const& value) {
+  return Exists<JSONNumber>(value.opa_value) ? OPANumber(Value<JSONNumber>(value.opa_value).number) : OPANumber();
+}
+
+// The lazy value of `numbers.range(first, last)`, the first of the lazy sequences: `Scan`, `Len` and `GetValueByKey`
+// compute its elements off the bounds, so a range that is only iterated over allocates nothing. It is materialized
+// into a `JSONArray` only when converted into an `OPAValue`, i.e. when stored into one, pushed, or returned.
+// Descending if `first > last`, as in OPA. Undefined unless both bounds are integers.
+class OPARange final {
+ private:
+  bool defined_ = false;
+  int64_t first_ = 0;
+  int64_t last_ = 0;
+
+ public:
+  OPARange() = default;
+  OPARange(int64_t first, int64_t last) : defined_(true), first_(first), last_(last) {}
+
+  bool IsDefined() const { return defined_; }
+
+  // The spans are computed modulo 2^64, so that they do not overflow `int64_t`.
+  size_t Size() const {
+    if (!defined_) {
+      return 0u;
+    }
+    uint64_t const span = first_ <= last_ ? static_cast<uint64_t>(last_) - static_cast<uint64_t>(first_)
+                                          : static_cast<uint64_t>(first_) - static_cast<uint64_t>(last_);
+    return span == std::numeric_limits<uint64_t>::max() ? span : span + 1u;
+  }
+
+  // The element `i`, for `i < Size()`.
+  int64_t At(size_t i) const {
+    uint64_t const first = static_cast<uint64_t>(first_);
+    return static_cast<int64_t>(first_ <= last_ ? first + i : first - i);
+  }
+
+  operator OPAValue() const {
+    if (!defined_) {
+      return OPAValue();
+    }
+    size_t const n = Size();
+    JSONArray array;
+    array.elements.reserve(n);
+    for (size_t i = 0u; i < n; ++i) {
+      array.push_back(JSONNumber(static_cast<double>(At(i))));
+    }
+    return OPAValue(std::move(array));
+  }
+};
+
 inline void ResetToUndefined(OPAValue& value) { value.DoResetToUndefined(); }
 inline void ResetToUndefined(Optional<std::string>& value) { value = nullptr; }
 
@@ -154,10 +308,14 @@ inline void MakeNull(OPAValue& value) { value.DoMakeNull(); }
 inline void MakeObject(OPAValue& value) { value.DoMakeObject(); }
 
 inline bool IsArray(OPAValue const& value) { return value.DoIsArray(); }
+inline bool IsArray(OPARange const& value) { return value.IsDefined(); }
 inline bool IsObject(OPAValue const& value) { return value.DoIsObject(); }
+inline bool IsObject(OPARange const&) { return false; }
 
 inline bool IsUndefined(OPAValue const& value) { return value.DoIsUndefined(); }
 inline bool IsUndefined(Optional<std::string> const& value) { return Exists(value); }
+inline bool IsUndefined(OPANumber const& value) { return !Exists(value); }
+inline bool IsUndefined(OPARange const& value) { return !value.IsDefined(); }
 
 inline bool IsStringEqualTo(OPAValue const& value, char const* s) { return value.DoIsStringEqualTo(s); }
 inline bool IsStringEqualTo(OPAString const& value, char const* s) { return Exists(value) && Value(value) == s; }
@@ -175,41 +333,58 @@ inline size_t Len(OPAValue const& v0) {
     return 0u;
   }
 }
+inline size_t Len(OPARange const& range) { return range.Size(); }
 
-inline bool AreLocalsEqual(OPANumber a, OPANumber b) {
-  if (Exists(a) != Exists(b)) {
-    return false;
-  }
-  if (Exists(a)) {
-    return Value(a) == Value(b);
-  } else {
-    return true;
-  }
-}
+inline bool AreLocalsEqual(OPANumber const& a, OPANumber const& b) { return a == b; }
 
-inline bool AreLocalsEqual(OPANumber a, size_t b) { return Exists(a) && Value(a) == static_cast<double>(b); }
-inline bool AreLocalsEqual(size_t a, OPANumber b) { return Exists(b) && static_cast<double>(a) == Value(b); }
+inline bool AreLocalsEqual(OPANumber const& a, size_t b) { return a == OPANumber(b); }
+inline bool AreLocalsEqual(size_t a, OPANumber const& b) { return OPANumber(a) == b; }
 inline bool AreLocalsEqual(size_t a, size_t b) { return a == b; }
 
-inline bool AreLocalsEqual(OPAValue const& a, OPANumber b) {
+inline bool AreLocalsEqual(OPAValue const& a, OPANumber const& b) {
   if (!Exists(b)) {
-    return !Exists(a);
+    return a.DoIsUndefined();
   } else {
-    return Exists<JSONNumber>(a.opa_value) && Value<JSONNumber>(a.opa_value).number == Value(b);
+    return NumberOf(a) == b;
   }
 }
-inline bool AreLocalsEqual(OPANumber a, OPAValue const& b) {
+inline bool AreLocalsEqual(OPANumber const& a, OPAValue const& b) {
   return AreLocalsEqual(b, a);
 }
 
 inline bool AreLocalsEqual(OPAValue const& a, size_t b) {
-  // NOTE: Would need tighter type checks.
-  return Exists<JSONNumber>(a.opa_value) && Value<JSONNumber>(a.opa_value).number == static_cast<double>(b);
+  return Exists<JSONNumber>(a.opa_value) && NumberOf(a) == OPANumber(b);
 }
 inline bool AreLocalsEqual(size_t a, OPAValue const& b) {
   return AreLocalsEqual(b, a);
 }
 
+// Element by element, with no range materialized.
+inline bool AreLocalsEqual(OPARange const& a, OPAValue const& b) {
+  if (!Exists<JSONArray>(b.opa_value)) {
+    return !a.IsDefined() && b.DoIsUndefined();
+  }
+  JSONArray const& array = Value<JSONArray>(b.opa_value);
+  if (!a.IsDefined() || array.size() != a.Size()) {
+    return false;
+  }
+  for (size_t i = 0u; i < array.size(); ++i) {
+    if (!(OPANumber(a.At(i)) == NumberOf(array[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+inline bool AreLocalsEqual(OPAValue const& a, OPARange const& b) {
+  return AreLocalsEqual(b, a);
+}
+inline bool AreLocalsEqual(OPARange const& a, OPARange const& b) {
+  if (a.IsDefined() != b.IsDefined() || a.Size() != b.Size()) {
+    return false;
+  }
+  return !a.Size() || (a.At(0u) == b.At(0u) && a.At(a.Size() - 1u) == b.At(b.Size() - 1u));
+}
+
 inline bool AreJSONValuesEqual(JSONValue const& a, JSONValue const& b) {
   struct JSONValueComparator final {
     JSONValue const& b;
@@ -287,7 +462,6 @@ inline OPAValue GetValueByKey(OPAValue const& object, size_t key) { return objec
 inline OPAValue GetValueByKey(OPAValue const& object, OPANumber key) { return object.DoGetValueByKey(key); }
 inline OPAValue GetValueByKey(OPAValue const& object, OPAValue const& key) {
   if (Exists<JSONNumber>(key.opa_value)) {
-    // NOTE: This `OPANumber` is extra work for the CPU. Can improve.
     return object.DoGetValueByKey(OPANumber(Value<JSONNumber>(key.opa_value).number));
   } else if (Exists<JSONString>(key.opa_value)) {
     return object.DoGetValueByKey(Value<JSONString>(key.opa_value).string);
@@ -296,6 +470,83 @@ inline OPAValue GetValueByKey(OPAValue const& object, OPAValue const& key) {
   }
 }
 
+inline OPANumber GetValueByKey(OPARange const& range, size_t key) {
+  return key < range.Size() ? OPANumber(range.At(key)) : OPANumber();
+}
+inline OPANumber GetValueByKey(OPARange const& range, OPANumber key) {
+  return key.IsInteger() && key.Integer() >= 0 ? GetValueByKey(range, static_cast<size_t>(key.Integer())) : OPANumber();
+}
+inline OPANumber GetValueByKey(OPARange const& range, OPAValue const& key) { return GetValueByKey(range, NumberOf(key)); }
+
+// The keys of the `sN` structs are known at compile time, so the untyped lookups by them build no `std::string`: their
+// lengths and their first eight bytes, as a word, are constants, and comparing a key of an object against one of them is
+// a length compare and an integer compare, plus a fixed-size `memcmp()` of the rest of the longer keys. The objects are
+// ordered maps, with no hashes to probe, so the small ones are searched linearly by these compares, which beats the
+// tree descent of `find()` and its out-of-line string comparisons; the larger ones are searched by `find()`.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The key prefixes are little-endian words.");
+
+constexpr size_t kOPASmallObjectFields = 8u;
+
+constexpr size_t OPAConstKeyLength(char const* s) {
+  size_t n = 0u;
+  while (s[n]) {
+    ++n;
+  }
+  return n;
+}
+
+constexpr uint64_t OPAConstKeyPrefix(char const* s, size_t n) {
+  uint64_t prefix = 0u;
+  for (size_t i = 0u; i < n && i < 8u; ++i) {
+    prefix |= static_cast<uint64_t>(static_cast<unsigned char>(s[i])) << (8u * i);
+  }
+  return prefix;
+}
+
+template <class S>
+struct OPAConstKey final {
+  constexpr static size_t length = OPAConstKeyLength(S::s);
+  constexpr static uint64_t prefix = OPAConstKeyPrefix(S::s, length);
+
+  static bool Matches(std::string const& key) {
+    if (key.length() != length) {
+      return false;
+    }
+    uint64_t word = 0u;
+    std::memcpy(&word, key.data(), std::min(length, static_cast<size_t>(8u)));
+    if constexpr (length <= 8u) {
+      return word == prefix;
+    } else {
+      return word == prefix && !std::memcmp(key.data() + 8u, S::s + 8u, length - 8u);
+    }
+  }
+};
+
+template <class S>
+inline JSONValue const* FindByConstKey(JSONObject const& object) {
+  if (object.fields.size() <= kOPASmallObjectFields) {
+    for (auto const& field : object.fields) {
+      if (OPAConstKey<S>::Matches(field.first)) {
+        return &field.second;
+      }
+    }
+    return nullptr;
+  }
+  auto const cit = object.fields.find(std::string(S::s, OPAConstKey<S>::length));
+  return cit != object.fields.end() ? &cit->second : nullptr;
+}
+
+// Takes the `JSONValue` as is, so that looking up a key of the untyped input does not copy all of it into an `OPAValue`.
+template <class S>
+inline OPAValue GetValueByConstKey(JSONValue const& object) {
+  if (Exists<JSONObject>(object)) {
+    if (JSONValue const* value = FindByConstKey<S>(Value<JSONObject>(object))) {
+      return *value;
+    }
+  }
+  return OPAValue();
+}
+
 template <typename T>
 inline void SetValueForKey(OPAValue& target, char const* key, T&& value) {
   target.DoSetValueForKey(key, std::forward<T>(value));
@@ -318,7 +569,7 @@ inline void Scan(OPAValue const& source, K& key, V& value, F&& f) {
   if (Exists<JSONArray>(source.opa_value)) {
     JSONArray const& a = Value<JSONArray>(source.opa_value);
     for (size_t i = 0u; i < a.size(); ++i) {
-      key = OPANumber(i);
+      key = i;  // As is into the `size_t` and `OPANumber` keys, with no round trip via `double`.
       value = a[i];
       f();
     }
@@ -328,45 +579,85 @@ inline void Scan(OPAValue const& source, K& key, V& value, F&& f) {
   }
 }
 
-inline OPAValue opa_plus(OPAValue const& a, OPAValue const& b) {
-  if (Exists<JSONNumber>(a.opa_value) && Exists<JSONNumber>(b.opa_value)) {
-    return Value<JSONNumber>(a.opa_value).number + Value<JSONNumber>(b.opa_value).number;
-  } else {
-    return nullptr;
+template <typename K, typename V, class F>
+inline void Scan(OPARange const& source, K& key, V& value, F&& f) {
+  size_t const n = source.Size();
+  for (size_t i = 0u; i < n; ++i) {
+    key = i;
+    value = OPANumber(source.At(i));
+    f();
   }
 }
 
-inline OPAValue opa_minus(OPAValue const& a, OPAValue const& b) {
-  // TODO(dkorolev): Only work on numbers!
-  if (Exists<JSONNumber>(a.opa_value) && Exists<JSONNumber>(b.opa_value)) {
-    return Value<JSONNumber>(a.opa_value).number - Value<JSONNumber>(b.opa_value).number;
-  } else {
-    return nullptr;
-  }
+// The profiled `Scan`, which counts its iterations towards `site`; the same as the above unless built with `-DOPA_PROFILE`.
+template <typename S, typename K, typename V, class F>
+inline void Scan(OPAProfile::Site const& site, S const& source, K& key, V& value, F&& f) {
+  OPAProfile::Scope scope(site);
+  Scan(source, key, value, [&]() {
+    scope.Iteration();
+    f();
+  });
 }
 
-inline OPAValue opa_mul(OPAValue const& a, OPAValue const& b) {
-  if (Exists<JSONNumber>(a.opa_value) && Exists<JSONNumber>(b.opa_value)) {
-    return Value<JSONNumber>(a.opa_value).number * Value<JSONNumber>(b.opa_value).number;
+// Exact on two integers, unless `integer_op` reports an overflow, in which case the result is promoted to a double.
+// Undefined unless both operands are numbers.
+template <class I, class D>
+inline OPANumber OPAArithmetic(OPANumber const& a, OPANumber const& b, I&& integer_op, D&& double_op) {
+  if (a.IsInteger() && b.IsInteger()) {
+    int64_t result;
+    if (integer_op(a.Integer(), b.Integer(), &result)) {
+      return OPANumber::Promoted(double_op(a.AsDouble(), b.AsDouble()));
+    }
+    return result;
+  } else if (Exists(a) && Exists(b)) {
+    return double_op(a.AsDouble(), b.AsDouble());
   } else {
     return nullptr;
   }
 }
 
-inline OPAValue opa_range(OPAValue const& a, OPAValue const& b) {
-  if (Exists<JSONNumber>(a.opa_value) && Exists<JSONNumber>(b.opa_value)) {
-    JSONArray array;
-    int const va = static_cast<int>(Value<JSONNumber>(a.opa_value).number);
-    int const vb = static_cast<int>(Value<JSONNumber>(b.opa_value).number);
-    for (int i = va; i <= vb; ++i) {
-      array.push_back(JSONNumber(i));
-    }
-    return OPAValue(array);
-  } else {
-    return OPAValue();
-  }
+inline OPANumber opa_plus(OPANumber const& a, OPANumber const& b) {
+  return OPAArithmetic(
+      a, b, [](int64_t x, int64_t y, int64_t* r) { return __builtin_add_overflow(x, y, r); }, std::plus<double>());
+}
+
+inline OPANumber opa_minus(OPANumber const& a, OPANumber const& b) {
+  return OPAArithmetic(
+      a, b, [](int64_t x, int64_t y, int64_t* r) { return __builtin_sub_overflow(x, y, r); }, std::minus<double>());
 }
 
+inline OPANumber opa_mul(OPANumber const& a, OPANumber const& b) {
+  return OPAArithmetic(
+      a, b, [](int64_t x, int64_t y, int64_t* r) { return __builtin_mul_overflow(x, y, r); }, std::multiplies<double>());
+}
+
+// With a number local on either side, the result stays a tagged number; only between two `OPAValue`-s is it stored
+// back as a `JSONNumber`.
+inline OPANumber opa_plus(OPANumber const& a, OPAValue const& b) { return opa_plus(a, NumberOf(b)); }
+inline OPANumber opa_plus(OPAValue const& a, OPANumber const& b) { return opa_plus(NumberOf(a), b); }
+inline OPAValue opa_plus(OPAValue const& a, OPAValue const& b) { return opa_plus(NumberOf(a), NumberOf(b)); }
+inline OPANumber opa_minus(OPANumber const& a, OPAValue const& b) { return opa_minus(a, NumberOf(b)); }
+inline OPANumber opa_minus(OPAValue const& a, OPANumber const& b) { return opa_minus(NumberOf(a), b); }
+inline OPAValue opa_minus(OPAValue const& a, OPAValue const& b) { return opa_minus(NumberOf(a), NumberOf(b)); }
+inline OPANumber opa_mul(OPANumber const& a, OPAValue const& b) { return opa_mul(a, NumberOf(b)); }
+inline OPANumber opa_mul(OPAValue const& a, OPANumber const& b) { return opa_mul(NumberOf(a), b); }
+inline OPAValue opa_mul(OPAValue const& a, OPAValue const& b) { return opa_mul(NumberOf(a), NumberOf(b)); }
+
+// The longest `numbers.range()`, as its bounds may come from the input, and a longer one would take seconds to scan,
+// or gigabytes to materialize. A little over a million elements.
+constexpr static size_t kOPAMaxRangeSize = 1u << 20;
+
+// Lazy, see `OPARange`. Undefined unless both bounds are integers, as `numbers.range()` is an error on the others in OPA,
+// and undefined if longer than `kOPAMaxRangeSize`.
+inline OPARange opa_range(OPANumber const& a, OPANumber const& b) {
+  if (!a.IsInteger() || !b.IsInteger()) {
+    return OPARange();
+  }
+  OPARange range(a.Integer(), b.Integer());
+  return range.Size() <= kOPAMaxRangeSize ? range : OPARange();
+}
+inline OPARange opa_range(OPAValue const& a, OPAValue const& b) { return opa_range(NumberOf(a), NumberOf(b)); }
+
 struct OPAResult final {
   std::vector<OPAValue> result_set;
   void AddToResultSet(OPAValue value) { result_set.push_back(std::move(value)); }
@@ -401,7 +692,10 @@ struct s0 final {
     return std::forward<T>(x).result;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("result");
+    return GetValueByConstKey<s0>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s0>(object);
   }
 };
 struct s1 final {
@@ -411,7 +705,10 @@ struct s1 final {
     return std::forward<T>(x).user;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("user");
+    return GetValueByConstKey<s1>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s1>(object);
   }
 };
 struct s2 final {
@@ -421,7 +718,10 @@ struct s2 final {
     return std::forward<T>(x).alice;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("alice");
+    return GetValueByConstKey<s2>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s2>(object);
   }
 };
 struct s3 final {
@@ -431,7 +731,10 @@ struct s3 final {
     return std::forward<T>(x).eng;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("eng");
+    return GetValueByConstKey<s3>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s3>(object);
   }
 };
 struct s4 final {
@@ -441,7 +744,10 @@ struct s4 final {
     return std::forward<T>(x).web;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("web");
+    return GetValueByConstKey<s4>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s4>(object);
   }
 };
 struct s5 final {
@@ -451,7 +757,10 @@ struct s5 final {
     return std::forward<T>(x).bob;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("bob");
+    return GetValueByConstKey<s5>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s5>(object);
   }
 };
 struct s6 final {
@@ -461,7 +770,10 @@ struct s6 final {
     return std::forward<T>(x).hr;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("hr");
+    return GetValueByConstKey<s6>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s6>(object);
   }
 };
 struct s7 final {
@@ -471,7 +783,10 @@ struct s7 final {
     return std::forward<T>(x).action;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("action");
+    return GetValueByConstKey<s7>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s7>(object);
   }
 };
 struct s8 final {
@@ -481,7 +796,10 @@ struct s8 final {
     return std::forward<T>(x).read;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("read");
+    return GetValueByConstKey<s8>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s8>(object);
   }
 };
 struct s9 final {
@@ -491,7 +809,10 @@ struct s9 final {
     return std::forward<T>(x).object;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("object");
+    return GetValueByConstKey<s9>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s9>(object);
   }
 };
 struct s10 final {
@@ -501,7 +822,10 @@ struct s10 final {
     return std::forward<T>(x).server123;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("server123");
+    return GetValueByConstKey<s10>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s10>(object);
   }
 };
 struct s11 final {
@@ -511,7 +835,10 @@ struct s11 final {
     return std::forward<T>(x).database456;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("database456");
+    return GetValueByConstKey<s11>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s11>(object);
   }
 };
 struct s12 final {
@@ -521,11 +848,27 @@ struct s12 final {
     return std::forward<T>(x).write;
   }
   static OPAValue GetValueByKeyFrom(OPAValue const &object) {
-    return object.DoGetValueByKey("write");
+    return GetValueByConstKey<s12>(object.opa_value);
+  }
+  static OPAValue GetValueByKeyFrom(JSONValue const &object) {
+    return GetValueByConstKey<s12>(object);
   }
 };
+OPAProfile::Site const profile_function_body_0("function_body_0");
+OPAProfile::Site const profile_function_body_1("function_body_1");
+OPAProfile::Site const profile_function_body_2("function_body_2");
+OPAProfile::Site const profile_function_body_2_scan_x6("function_body_2: Scan(x6)");
+OPAProfile::Site const profile_function_body_2_scan_x13("function_body_2: Scan(x13)");
+// The memoized results of the functions that do not depend on the input, materialized by `WarmUpPolicy()` before the
+// first evaluation, and read on the request path by reference, with no thread-safe-static guards and no copies.
+struct PolicySingletons final {
+  OPAValue function_0;
+  OPAValue function_1;
+};
+PolicySingletons policy_singletons;
 template <typename T1, typename T2>
 decltype(auto) function_body_0(T1 &&p1, T2 &&p2) {
+  OPAProfile::Scope const profile(profile_function_body_0);
   OPAValue retval;
   OPAValue x1;
   OPAValue x2;
@@ -551,13 +894,12 @@ decltype(auto) function_body_0(T1 &&p1, T2 &&p2) {
   return retval;
 }
 template <typename T1, typename T2>
-decltype(auto) function_0(T1 &&p1, T2 &&p2) {
-  static auto singleton_result =
-      function_body_0(std::forward<T1>(p1), std::forward<T2>(p2));
-  return singleton_result;
+OPAValue const &function_0(T1 &&, T2 &&) {
+  return policy_singletons.function_0;
 }
 template <typename T1, typename T2>
 decltype(auto) function_body_1(T1 &&p1, T2 &&p2) {
+  OPAProfile::Scope const profile(profile_function_body_1);
   OPAValue retval;
   OPAValue x1;
   OPAValue x2;
@@ -603,25 +945,24 @@ decltype(auto) function_body_1(T1 &&p1, T2 &&p2) {
   return retval;
 }
 template <typename T1, typename T2>
-decltype(auto) function_1(T1 &&p1, T2 &&p2) {
-  static auto singleton_result =
-      function_body_1(std::forward<T1>(p1), std::forward<T2>(p2));
-  return singleton_result;
+OPAValue const &function_1(T1 &&, T2 &&) {
+  return policy_singletons.function_1;
 }
 template <typename T1, typename T2>
 decltype(auto) function_body_2(T1 &&p1, T2 &&p2) {
+  OPAProfile::Scope const profile(profile_function_body_2);
   OPAValue retval;
   OPAValue x1;
   decltype(s1::GetValueByKeyFrom(std::forward<T1>(p1))) x2;
   decltype(x2) x3;
-  decltype(function_0(std::declval<T1>(), std::declval<T2>())) x4;
+  decltype(function_0(std::declval<T1>(), std::declval<T2>())) x4 = function_0(p1, p2);
   decltype(GetValueByKey(x4, x3)) x5;
   decltype(x5) x6;
   OPAValue x7;
   OPAValue x8;
   decltype(x7) x9;
   decltype(x8) x10;
-  decltype(function_1(std::declval<T1>(), std::declval<T2>())) x11;
+  decltype(function_1(std::declval<T1>(), std::declval<T2>())) x11 = function_1(p1, p2);
   decltype(GetValueByKey(x11, x10)) x12;
   decltype(x12) x13;
   OPAValue x14;
@@ -639,16 +980,14 @@ decltype(auto) function_body_2(T1 &&p1, T2 &&p2) {
   x1 = Undefined();
   x2 = s1::GetValueByKeyFrom(std::forward<T1>(p1));
   x3 = x2;
-  x4 = function_0(std::forward<T1>(p1), std::forward<T2>(p2));
   x5 = GetValueByKey(x4, x3);
   x6 = x5;
-  Scan(x6, x7, x8, [&]() {
+  Scan(profile_function_body_2_scan_x6, x6, x7, x8, [&]() {
     x9 = x7;
     x10 = x8;
-    x11 = function_1(std::forward<T1>(p1), std::forward<T2>(p2));
     x12 = GetValueByKey(x11, x10);
     x13 = x12;
-    Scan(x13, x14, x15, [&]() {
+    Scan(profile_function_body_2_scan_x13, x13, x14, x15, [&]() {
       x16 = x14;
       x17 = x15;
       x18 = s7::GetValueByKeyFrom(std::forward<T1>(p1));
@@ -699,11 +1038,186 @@ OPAResult policy(T_INPUT &&input, T_DATA &&data) {
   SetValueForKey(x3, "result", x2);
   result.AddToResultSet(x3);
   return result;
-}template <class T>
+}
+
+// The batch counterpart of `policy()`: evaluates many inputs with one pass over `function_0` and `function_1` per user.
+// The inputs are grouped by `input.user`, and each role's permissions of that user are walked once per group,
+// testing `action` and `object` against the whole group at once, as columns of interned string IDs.
+// Falls back to calling `policy()` per input if the data can not be represented this way.
+struct PolicyBatchIndex final {
+  constexpr static uint32_t kUnknown = static_cast<uint32_t>(-1);
+  constexpr static uint32_t kNotAString = static_cast<uint32_t>(-2);
+
+  bool applicable = true;
+  std::unordered_map<std::string, uint32_t> interned;
+  std::unordered_map<std::string, uint32_t> user_ids;
+  std::vector<std::vector<uint32_t>> user_roles;
+  std::vector<std::vector<uint32_t>> role_actions;
+  std::vector<std::vector<uint32_t>> role_objects;
+
+  uint32_t Intern(std::string const& s) { return interned.emplace(s, static_cast<uint32_t>(interned.size())).first->second; }
+
+  uint32_t IdOf(std::string const& s) const {
+    auto const cit = interned.find(s);
+    return cit != interned.end() ? cit->second : kUnknown;
+  }
+  uint32_t IdOf(OPAValue const& v) const {
+    return Exists<JSONString>(v.opa_value) ? IdOf(Value<JSONString>(v.opa_value).string) : kNotAString;
+  }
+
+  uint32_t UserIdOf(std::string const& s) const {
+    auto const cit = user_ids.find(s);
+    return cit != user_ids.end() ? cit->second : kUnknown;
+  }
+  uint32_t UserIdOf(OPAValue const& v) const {
+    return Exists<JSONString>(v.opa_value) ? UserIdOf(Value<JSONString>(v.opa_value).string) : kUnknown;
+  }
+
+  PolicyBatchIndex(OPAValue const& users, OPAValue const& roles) {
+    if (!Exists<JSONObject>(users.opa_value) || !Exists<JSONObject>(roles.opa_value)) {
+      applicable = false;
+      return;
+    }
+    std::unordered_map<std::string, uint32_t> role_ids;
+    for (auto const& role : Value<JSONObject>(roles.opa_value).fields) {
+      uint32_t const role_id = static_cast<uint32_t>(role_ids.size());
+      role_ids[role.first] = role_id;
+      role_actions.emplace_back();
+      role_objects.emplace_back();
+      if (!Exists<JSONArray>(role.second)) {
+        continue;
+      }
+      for (JSONValue const& permission : Value<JSONArray>(role.second).elements) {
+        // Mirrors `IsObject(x17)`, `Len(x17) == 2`, and the two `AreLocalsEqual()`-s of `function_body_2`.
+        if (!Exists<JSONObject>(permission) || Value<JSONObject>(permission).size() != 2u) {
+          continue;
+        }
+        JSONObject const& fields = Value<JSONObject>(permission);
+        JSONValue const& action = fields["action"];
+        JSONValue const& object = fields["object"];
+        if (!Exists<JSONString>(action) || !Exists<JSONString>(object)) {
+          // A missing or non-string `action` or `object` could match a non-string input value, so play it safe.
+          applicable = false;
+          return;
+        }
+        role_actions.back().push_back(Intern(Value<JSONString>(action).string));
+        role_objects.back().push_back(Intern(Value<JSONString>(object).string));
+      }
+    }
+    for (auto const& user : Value<JSONObject>(users.opa_value).fields) {
+      user_ids[user.first] = static_cast<uint32_t>(user_roles.size());
+      user_roles.emplace_back();
+      if (!Exists<JSONArray>(user.second)) {
+        continue;
+      }
+      for (JSONValue const& role : Value<JSONArray>(user.second).elements) {
+        if (Exists<JSONString>(role)) {
+          auto const cit = role_ids.find(Value<JSONString>(role).string);
+          if (cit != role_ids.end()) {
+            user_roles.back().push_back(cit->second);
+          }
+        }
+      }
+    }
+  }
+};
+
+// Built by `WarmUpPolicy()`, along with the `PolicySingletons` it is built from.
+std::unique_ptr<PolicyBatchIndex const> policy_batch_index;
+
+template <typename T_INPUT, typename T_DATA>
+std::vector<JSONValue> policy_batch(std::vector<T_INPUT const*> const& inputs, T_DATA &&data) {
+  std::vector<JSONValue> results;
+  results.reserve(inputs.size());
+  if (inputs.empty()) {
+    return results;
+  }
+  PolicyBatchIndex const& index = *policy_batch_index;
+  if (!index.applicable) {
+    for (T_INPUT const* input : inputs) {
+      results.push_back(policy(*input, data).pack());
+    }
+    return results;
+  }
+
+  // Group the inputs by user, leaving out the ones with no known user, as they are `false` right away.
+  std::vector<std::pair<uint32_t, uint32_t>> user_and_index;
+  user_and_index.reserve(inputs.size());
+  for (size_t i = 0u; i < inputs.size(); ++i) {
+    uint32_t const user_id = index.UserIdOf(s1::GetValueByKeyFrom(*inputs[i]));
+    if (user_id != PolicyBatchIndex::kUnknown) {
+      user_and_index.emplace_back(user_id, static_cast<uint32_t>(i));
+    }
+  }
+  std::sort(user_and_index.begin(), user_and_index.end());
+
+  std::vector<uint8_t> allowed(inputs.size(), 0u);
+  std::vector<uint32_t> group_actions;
+  std::vector<uint32_t> group_objects;
+  std::vector<uint8_t> group_allowed;
+  for (size_t begin = 0u; begin < user_and_index.size();) {
+    uint32_t const user_id = user_and_index[begin].first;
+    size_t end = begin + 1u;
+    while (end < user_and_index.size() && user_and_index[end].first == user_id) {
+      ++end;
+    }
+    size_t const n = end - begin;
+    group_actions.resize(n);
+    group_objects.resize(n);
+    group_allowed.assign(n, 0u);
+    for (size_t j = 0u; j < n; ++j) {
+      T_INPUT const& input = *inputs[user_and_index[begin + j].second];
+      group_actions[j] = index.IdOf(s7::GetValueByKeyFrom(input));
+      group_objects[j] = index.IdOf(s9::GetValueByKeyFrom(input));
+    }
+    uint32_t const* const qa = group_actions.data();
+    uint32_t const* const qo = group_objects.data();
+    uint8_t* const qr = group_allowed.data();
+    for (uint32_t const role_id : index.user_roles[user_id]) {
+      std::vector<uint32_t> const& actions = index.role_actions[role_id];
+      std::vector<uint32_t> const& objects = index.role_objects[role_id];
+      for (size_t k = 0u; k < actions.size(); ++k) {
+        uint32_t const a = actions[k];
+        uint32_t const o = objects[k];
+        // Branch-free, so that this inner loop is auto-vectorized.
+        for (size_t j = 0u; j < n; ++j) {
+          qr[j] |= static_cast<uint8_t>((qa[j] == a) & (qo[j] == o));
+        }
+      }
+    }
+    for (size_t j = 0u; j < n; ++j) {
+      allowed[user_and_index[begin + j].second] = qr[j];
+    }
+    begin = end;
+  }
+
+  for (uint8_t const a : allowed) {
+    results.push_back(JSONBoolean(a != 0u));
+  }
+  return results;
+}
+
+// Materializes the memoized data of the policy, `PolicySingletons` and the index of `policy_batch()`, so that no request
+// pays for building it, the first one included. To be called before the first evaluation; the calls after the first
+// one are no-ops, as the data memoized is that of the first call, as it was with the function-local statics.
+template <typename T_DATA>
+void WarmUpPolicy(T_DATA &&data) {
+  static std::once_flag once;
+  std::call_once(once, [&data]() {
+    JSONValue const no_input;
+    policy_singletons.function_0 = function_body_0(no_input, data);
+    policy_singletons.function_1 = function_body_1(no_input, data);
+    policy_batch_index = std::make_unique<PolicyBatchIndex const>(policy_singletons.function_0,
+                                                                  policy_singletons.function_1);
+  });
+}
+
+template <class T>
 struct PotentiallyCustomTypeImpl final {
   using extracted_t = decltype(std::declval<T>().input) const&;
   static policy_input_t DoParse(std::string const& input) { return ParseJSON<policy_input_t>(input); }
   static extracted_t DoExtract(T const& input) { return input.input; }
+  static std::string DoSerialize(T const& input) { return JSON(input); }
 };
 
 template <>
@@ -718,6 +1232,7 @@ struct PotentiallyCustomTypeImpl<JSONValue> final {
       return null;
     }
   }
+  static std::string DoSerialize(JSONValue const& input) { return AsJSON(input); }
 };
 
 template <class T>
@@ -725,27 +1240,433 @@ policy_input_t ParsePolicyInputFromString(std::string const& input) {
   return PotentiallyCustomTypeImpl<policy_input_t>::DoParse(input);
 }
 
+// The JSON parsers take `std::string const&`, so the zero-copy lines go through one reused buffer per thread.
+template <class T>
+policy_input_t ParsePolicyInputFromString(std::string_view input) {
+  thread_local std::string buffer;
+  buffer.assign(input.data(), input.length());
+  return PotentiallyCustomTypeImpl<policy_input_t>::DoParse(buffer);
+}
+
 template <class T>
 typename PotentiallyCustomTypeImpl<std::decay_t<T>>::extracted_t ExtractPolicyInputFromParsedInput(T&& input) {
   return PotentiallyCustomTypeImpl<std::decay_t<T>>::DoExtract(std::forward<T>(input));
 }
 
+using policy_extracted_input_t = std::decay_t<typename PotentiallyCustomTypeImpl<policy_input_t>::extracted_t>;
+
+// Evaluates the `{"input":{...}}` `queries`, in order, via `policy_batch()`, and calls `respond` with the one-line
+// `{"result":...}` of each, or an `{"error":...}` for a query that is empty or fails to parse, so that the N-th response
+// always answers the N-th query. Returns the number of the invalid queries.
+// Logs the decisions into `decision_log`, unless it is `nullptr`.
+template <class F>
+size_t EvaluateQueryBatch(std::vector<std::string_view> const& queries,
+                          JSONValue const& data,
+                          DecisionLog* decision_log,
+                          F&& respond) {
+  std::vector<policy_input_t> inputs;
+  std::vector<bool> parsed;
+  std::vector<policy_extracted_input_t const*> extracted;
+  inputs.reserve(queries.size());
+  parsed.reserve(queries.size());
+  for (std::string_view const query : queries) {
+    if (query.empty()) {
+      parsed.push_back(false);
+    } else {
+      try {
+        inputs.push_back(ParsePolicyInputFromString<policy_input_t>(query));
+        parsed.push_back(true);
+      } catch (std::exception const&) {
+        parsed.push_back(false);
+      }
+    }
+  }
+  extracted.reserve(inputs.size());
+  for (policy_input_t const& input : inputs) {
+    extracted.push_back(&ExtractPolicyInputFromParsedInput(input));
+  }
+  std::vector<JSONValue> const results = policy_batch(extracted, data);
+  size_t invalid = 0u;
+  std::string response;
+  size_t i = 0u;
+  for (size_t j = 0u; j < parsed.size(); ++j) {
+    if (parsed[j]) {
+      std::string const result = AsJSON(results[i++]);
+      response = "{\"result\":";
+      response += result;
+      response += '}';
+      respond(std::string_view(response));
+      if (decision_log) {
+        decision_log->Log(queries[j], result);
+      }
+    } else {
+      respond(std::string_view("{\"error\":\"Synopsis: `{\\\"input\\\":{...}}` per line.\"}"));
+      ++invalid;
+    }
+  }
+  return invalid;
+}
+
+// Evaluates the newline-delimited `{"input":{...}}` queries from `body`, in order, via `EvaluateQueryBatch()`.
+// Passes NDJSON-formatted results to `emit` in chunks of up to `--batch_chunk` lines, one per line of `body`, empty
+// lines included. A trailing newline at the very end of `body` does not start a query.
+// Returns the number of queries, valid or not, and adds the number of the invalid ones to `*invalid`, if given.
+template <class F>
+size_t EvaluateNDJSONBatch(
+    std::string const& body, JSONValue const& data, DecisionLog* decision_log, F&& emit, size_t* invalid = nullptr) {
+  size_t const chunk_size = std::max(static_cast<size_t>(FLAGS_batch_chunk), static_cast<size_t>(1u));
+  size_t total = 0u;
+  std::string output;
+  std::vector<std::string_view> queries;
+  queries.reserve(chunk_size);
+  auto const flush = [&]() {
+    size_t const n = EvaluateQueryBatch(queries, data, decision_log, [&output](std::string_view response) {
+      output.append(response.data(), response.length());
+      output += '\n';
+    });
+    if (invalid) {
+      *invalid += n;
+    }
+    emit(output);
+    total += queries.size();
+    output.clear();
+    queries.clear();
+  };
+  size_t begin = 0u;
+  while (begin < body.length()) {
+    size_t end = body.find('\n', begin);
+    if (end == std::string::npos) {
+      end = body.length();
+    }
+    std::string_view line = std::string_view(body).substr(begin, end - begin);
+    begin = end + 1u;
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1u);
+    }
+    queries.push_back(line);
+    if (queries.size() == chunk_size) {
+      flush();
+    }
+  }
+  if (!queries.empty()) {
+    flush();
+  }
+  return total;
+}
+
+// Evaluates the requests of the binary protocol, see `binary_protocol.h`, in order, via `policy_batch()`.
+// Appends one response per request to `output`, `Invalid` for the requests that fail to decode.
+// The decision log gets the decoded inputs as JSON, as the binary requests have no query text.
+void EvaluateBinaryBatch(std::vector<std::string_view> const& payloads,
+                         JSONValue const& data,
+                         DecisionLog* decision_log,
+                         std::string& output) {
+  std::vector<policy_input_t> inputs;
+  std::vector<bool> parsed;
+  std::vector<policy_extracted_input_t const*> extracted;
+  inputs.reserve(payloads.size());
+  parsed.reserve(payloads.size());
+  for (std::string_view const payload : payloads) {
+    try {
+      policy_input_t input;
+      DecodeBinaryRequest(payload, input);
+      inputs.push_back(std::move(input));
+      parsed.push_back(true);
+    } catch (std::exception const&) {
+      parsed.push_back(false);
+    }
+  }
+  extracted.reserve(inputs.size());
+  for (policy_input_t const& input : inputs) {
+    extracted.push_back(&ExtractPolicyInputFromParsedInput(input));
+  }
+  std::vector<JSONValue> const results = policy_batch(extracted, data);
+  size_t i = 0u;
+  for (bool const ok : parsed) {
+    if (ok) {
+      AppendBinaryResponse(output, results[i]);
+      if (decision_log) {
+        decision_log->Log(PotentiallyCustomTypeImpl<policy_input_t>::DoSerialize(inputs[i]), AsJSON(results[i]));
+      }
+      ++i;
+    } else {
+      output += static_cast<char>(BinaryProtocolDecision::Invalid);
+    }
+  }
+}
+
+// Evaluates one `{"input":{...}}` query, the body of a request to `/`, into the `{"result":...}` body of its response.
+// Returns `false`, leaving `response` as is, if the query is not a JSON object, or not JSON at all.
+bool EvaluateHTTPQuery(std::string const& query,
+                       JSONValue const& data,
+                       DecisionLog* decision_log,
+                       std::string& response) {
+  MetricsRequestScope metrics(MetricsRoute::Policy);
+  JSONValue json;
+  try {
+    json = ParseJSONUniversally(query);
+  } catch (std::exception const&) {
+  }
+  metrics.StageDone(MetricsStage::Parse);
+  if (!Exists<JSONObject>(json)) {
+    metrics.Error();
+    return false;
+  }
+  JSONValue const result = policy(Value<JSONObject>(json)["input"], data).pack();
+  metrics.StageDone(MetricsStage::Eval);
+  std::string const result_json = AsJSON(result);
+  response = "{\"result\":" + result_json + '}';
+  metrics.StageDone(MetricsStage::Serialize);
+  if (decision_log) {
+    decision_log->Log(query, result_json);
+  }
+  return true;
+}
+
+// Built with `-DSLEIPNIR_NO_MAIN` as part of the in-process library, see `capi/sleipnir_policy.h`.
+#ifndef SLEIPNIR_NO_MAIN
 int main(int argc, char** argv) {
   ParseDFlags(&argc, &argv);
 
   JSONValue const test_data_that_is_empty = JSONObject();
+  {
+    auto const begin = std::chrono::steady_clock::now();
+    WarmUpPolicy(test_data_that_is_empty);
+    StartupMetrics::WarmedUp(std::chrono::steady_clock::now() - begin);
+  }
 
-  if (!FLAGS_queries.empty()) {
-    std::vector<policy_input_t> inputs;
+  if (!FLAGS_stages_json.empty()) {
+    WriteBenchStages(FLAGS_stages_json,
+                     MeasureBenchStages(
+                         FLAGS_queries,
+                         [](std::string const& line) { return ParsePolicyInputFromString<policy_input_t>(line); },
+                         [&test_data_that_is_empty](policy_input_t const& input) {
+                           return policy(ExtractPolicyInputFromParsedInput(input), test_data_that_is_empty).pack();
+                         },
+                         [](JSONValue const& result) { return "{\"result\":" + AsJSON(result) + '}'; }));
+    return 0;
+  }
+
+  if (!FLAGS_compile_queries.empty()) {
+    if (FLAGS_queries.empty()) {
+      std::cerr << "The `--compile_queries` mode requires `--queries`." << std::endl;
+      return 1;
+    }
+    MMappedFile const file(FLAGS_queries);
+    LinesCursor lines(file.Contents());
+    QueryCorpusWriter writer;
     {
       current::ProgressLine report;
-      report << "Reading " << cyan << FLAGS_queries << reset << " ...";
-      current::FileSystem::ReadFileByLines(FLAGS_queries, [&inputs](std::string const& s) {
-        inputs.push_back(ParsePolicyInputFromString<policy_input_t>(s));
-      });
+      report << "Compiling " << cyan << FLAGS_queries << reset << " ...";
+      std::string_view line;
+      while (lines.Next(line)) {
+        writer.Add(ParsePolicyInputFromString<policy_input_t>(line));
+      }
+    }
+    uint64_t const bytes = writer.Save(FLAGS_compile_queries);
+    std::cout << "Compiled " << magenta << writer.Records() << reset << " queries, " << magenta << writer.Strings()
+              << reset << " unique strings, into " << cyan << FLAGS_compile_queries << reset << ", " << bytes
+              << " bytes." << std::endl;
+    return 0;
+  }
+
+  std::unique_ptr<DecisionLog> decision_log;
+  if (!FLAGS_decision_log.empty()) {
+    if (FLAGS_decision_log_format != "ndjson" && FLAGS_decision_log_format != "binary") {
+      std::cerr << "The `--decision_log_format` must be `ndjson` or `binary`." << std::endl;
+      return 1;
+    }
+    DecisionLogConfig config;
+    config.filename = FLAGS_decision_log;
+    config.binary = FLAGS_decision_log_format == "binary";
+    config.ring_bytes = FLAGS_decision_log_ring_bytes;
+    config.fsync_ms = FLAGS_decision_log_fsync_ms;
+    decision_log = std::make_unique<DecisionLog>(config);
+  }
+
+  if (!FLAGS_queries.empty() || !FLAGS_queries_bin.empty()) {
+    std::ofstream fo;
+    if (!FLAGS_output.empty()) {
+      fo.open(FLAGS_output);
+    }
+    auto const evaluate = [&test_data_that_is_empty](std::vector<policy_input_t> const& inputs,
+                                                      std::vector<JSONValue>& results) {
+      if (FLAGS_batch) {
+        std::vector<policy_extracted_input_t const*> batch;
+        batch.reserve(FLAGS_batch);
+        for (size_t begin = 0u; begin < inputs.size(); begin += FLAGS_batch) {
+          size_t const end = std::min(inputs.size(), begin + FLAGS_batch);
+          batch.clear();
+          for (size_t i = begin; i < end; ++i) {
+            batch.push_back(&ExtractPolicyInputFromParsedInput(inputs[i]));
+          }
+          for (JSONValue& result : policy_batch(batch, test_data_that_is_empty)) {
+            results.push_back(std::move(result));
+          }
+        }
+      } else {
+        for (policy_input_t const& input : inputs) {
+          results.push_back(policy(ExtractPolicyInputFromParsedInput(input), test_data_that_is_empty).pack());
+        }
+      }
+    };
+    // The decisions are logged as part of the evaluation, so that its timing shows the cost of logging them.
+    // The `--queries_bin` mode has no query text to log.
+    std::vector<std::string_view> queries;
+    auto const log_decisions = [&decision_log, &queries](std::vector<JSONValue> const& results) {
+      if (decision_log) {
+        for (size_t i = 0u; i < queries.size(); ++i) {
+          decision_log->Log(queries[i], AsJSON(results[i]));
+        }
+      }
+    };
+    auto const close_decision_log = [&decision_log]() {
+      if (decision_log) {
+        uint64_t const dropped = decision_log->Dropped();
+        std::chrono::microseconds const t0 = current::time::Now();
+        decision_log.reset();
+        std::chrono::microseconds const t1 = current::time::Now();
+        std::cout << "Decision log: " << magenta << dropped << reset << " decisions dropped, flushed in "
+                  << current::strings::RoundDoubleToString((t1 - t0).count() * 1e-3, 3) << "ms." << std::endl;
+      }
+    };
+    auto const write_results = [&fo](std::vector<JSONValue> const& results) {
+      if (fo.is_open()) {
+        for (auto const& result : results) {
+          fo << "{\"result\":" << AsJSON(result) << "}\n";
+        }
+      }
+    };
+    auto const print_result = [](char const* title, std::chrono::microseconds dt, size_t n) {
+      double const paps = n * 1e6 / std::max(dt.count(), static_cast<decltype(dt.count())>(1));
+      double const us = 1.0 * dt.count() / n;
+      std::cout << title << bold << magenta << current::strings::RoundDoubleToString(us, 3) << "us" << reset << ", "
+                << bold << green << current::strings::RoundDoubleToString(paps, 3) << " PAPS" << reset << std::endl;
+    };
+    // With `--perf_counters`, parsing and evaluation are counted separately, each by its own `perf_event_open` group.
+    std::unique_ptr<PerfCounters> parse_counters;
+    std::unique_ptr<PerfCounters> eval_counters;
+    if (FLAGS_perf_counters) {
+      parse_counters = std::make_unique<PerfCounters>();
+      eval_counters = std::make_unique<PerfCounters>();
+      if (!parse_counters->Available() || !eval_counters->Available()) {
+        std::string const& error = (parse_counters->Available() ? eval_counters : parse_counters)->Error();
+        std::cout << red << "Perf counters are unavailable: " << error << '.' << reset
+                  << " Try `sysctl kernel.perf_event_paranoid=1`, or `--cap-add PERFMON` in Docker."
+                  << std::endl;
+        parse_counters = nullptr;
+        eval_counters = nullptr;
+      }
+    }
+    auto const counted = [](std::unique_ptr<PerfCounters> const& counters, auto&& f) {
+      if (counters) {
+        counters->Start();
+      }
+      f();
+      if (counters) {
+        counters->Stop();
+      }
+    };
+    auto const print_counters = [&parse_counters, &eval_counters](size_t n) {
+      if (parse_counters) {
+        parse_counters->Print("Parse: ", n);
+        eval_counters->Print("Result: ", n);
+      }
+    };
+
+    if (FLAGS_queries_bin.empty() && FLAGS_queries_chunk) {
+      MMappedFile const file(FLAGS_queries);
+      LinesCursor lines(file.Contents());
+      // Streaming mode: parse and evaluate `--queries_chunk` queries at a time, never holding the whole corpus.
+      std::vector<policy_input_t> inputs;
+      std::vector<JSONValue> results;
+      inputs.reserve(FLAGS_queries_chunk);
+      results.reserve(FLAGS_queries_chunk);
+      size_t total = 0u;
+      std::chrono::microseconds parse_time(0);
+      std::chrono::microseconds eval_time(0);
+      std::chrono::microseconds const t0 = current::time::Now();
+      {
+        current::ProgressLine report;
+        std::string_view line;
+        bool more = true;
+        while (more) {
+          std::chrono::microseconds const t_parse = current::time::Now();
+          inputs.clear();
+          queries.clear();
+          counted(parse_counters, [&]() {
+            while (inputs.size() < FLAGS_queries_chunk && (more = lines.Next(line))) {
+              inputs.push_back(ParsePolicyInputFromString<policy_input_t>(line));
+              if (decision_log) {
+                queries.push_back(line);
+              }
+            }
+          });
+          std::chrono::microseconds const t_eval = current::time::Now();
+          results.clear();
+          counted(eval_counters, [&]() { evaluate(inputs, results); });
+          log_decisions(results);
+          std::chrono::microseconds const t_done = current::time::Now();
+          parse_time += t_eval - t_parse;
+          eval_time += t_done - t_eval;
+          write_results(results);
+          total += inputs.size();
+          report << "Streaming " << cyan << FLAGS_queries << reset << ", " << magenta << total << reset << " queries ...";
+        }
+      }
+      std::chrono::microseconds const t1 = current::time::Now();
+      std::cout << "Streamed " << cyan << FLAGS_queries << reset << ", " << magenta << total << reset << " queries."
+                << std::endl;
+      if (total) {
+        print_result("Parse: ", parse_time, total);
+        print_result("Result: ", eval_time, total);
+        print_result("End-to-end, including I/O: ", t1 - t0, total);
+        print_counters(total);
+      }
+      if (kOPAProfilingEnabled) {
+        std::cout << OPAProfile::Report();
+      }
+      close_decision_log();
+      return 0;
+    }
+
+    std::vector<policy_input_t> inputs;
+    std::unique_ptr<MMappedFile> queries_file;  // Kept mapped for `queries` to point into.
+    if (!FLAGS_queries_bin.empty()) {
+      std::chrono::microseconds t0;
+      std::chrono::microseconds t1;
+      uint64_t bytes;
+      {
+        current::ProgressLine report;
+        report << "Loading " << cyan << FLAGS_queries_bin << reset << " ...";
+        t0 = current::time::Now();
+        QueryCorpusReader const corpus(FLAGS_queries_bin);
+        counted(parse_counters, [&]() { corpus.DecodeAll(inputs); });
+        bytes = corpus.Bytes();
+        t1 = current::time::Now();
+      }
+      double const mbps = bytes / std::max(static_cast<double>((t1 - t0).count()), 1.0);
+      std::cout << "Loaded " << cyan << FLAGS_queries_bin << reset << ", " << magenta << inputs.size() << reset
+                << " queries, at " << current::strings::RoundDoubleToString(mbps, 3) << " MB/s." << std::endl;
+    } else {
+      queries_file = std::make_unique<MMappedFile>(FLAGS_queries);
+      LinesCursor lines(queries_file->Contents());
+      {
+        current::ProgressLine report;
+        report << "Reading " << cyan << FLAGS_queries << reset << " ...";
+        std::string_view line;
+        counted(parse_counters, [&]() {
+          while (lines.Next(line)) {
+            inputs.push_back(ParsePolicyInputFromString<policy_input_t>(line));
+            if (decision_log) {
+              queries.push_back(line);
+            }
+          }
+        });
+      }
+      std::cout << "Read " << cyan << FLAGS_queries << reset << ", " << magenta << inputs.size() << reset
+                << " queries." << std::endl;
     }
-    std::cout << "Read " << cyan << FLAGS_queries << reset << ", " << magenta << inputs.size() << reset << " queries."
-              << std::endl;
     if (!inputs.empty()) {
       std::vector<JSONValue> results;
       results.reserve(inputs.size());
@@ -755,48 +1676,266 @@ int main(int argc, char** argv) {
         current::ProgressLine report;
         report << "Running ...";
         t0 = current::time::Now();
-        for (policy_input_t const& input : inputs) {
-          results.push_back(policy(ExtractPolicyInputFromParsedInput(input), test_data_that_is_empty).pack());
-        }
+        counted(eval_counters, [&]() { evaluate(inputs, results); });
+        log_decisions(results);
         t1 = current::time::Now();
       }
-      auto const dt = (t1 - t0).count();
-      double const paps = inputs.size() * 1e6 / dt;
-      double const us = 1.0 * dt / inputs.size();
-      std::cout << "Result: " << bold << magenta << current::strings::RoundDoubleToString(us, 3) << "us" << reset
-                << ", " << bold << green << current::strings::RoundDoubleToString(paps, 3) << " PAPS" << reset
-                << std::endl;
-      if (!FLAGS_output.empty()) {
-        std::ofstream fo(FLAGS_output);
-        for (auto const& result : results) {
-          fo << "{\"result\":" << AsJSON(result) << "}\n";
-        }
+      print_result("Result: ", t1 - t0, inputs.size());
+      print_counters(inputs.size());
+      if (kOPAProfilingEnabled) {
+        std::cout << OPAProfile::Report();
       }
+      write_results(results);
     }
+    close_decision_log();
     return 0;
   }
 
+  // The local transports, for sidecar deployments, take the queries and return the results as the NDJSON endpoint does.
+  auto const evaluate_lines = [&test_data_that_is_empty, &decision_log](std::string const& lines, std::string& output) {
+    EvaluateNDJSONBatch(
+        lines, test_data_that_is_empty, decision_log.get(), [&output](std::string const& chunk) { output += chunk; });
+  };
+  std::unique_ptr<UnixSocketLineServer> unix_socket_server;
+  if (!FLAGS_unix_socket.empty()) {
+    unix_socket_server = std::make_unique<UnixSocketLineServer>(FLAGS_unix_socket, evaluate_lines);
+  }
+  std::unique_ptr<ShmChannelServer> shm_channel_server;
+  if (!FLAGS_shm_channel.empty()) {
+    shm_channel_server = std::make_unique<ShmChannelServer>(
+        FLAGS_shm_channel,
+        [&test_data_that_is_empty, &decision_log](std::vector<std::string_view> const& requests,
+                                                  ShmChannelServer::respond_t const& respond) {
+          EvaluateQueryBatch(requests, test_data_that_is_empty, decision_log.get(), respond);
+        });
+  }
+  std::unique_ptr<BinaryProtocolServer> binary_server;
+  if (FLAGS_binary_port) {
+    binary_server = std::make_unique<BinaryProtocolServer>(
+        FLAGS_binary_port,
+        [&test_data_that_is_empty, &decision_log](std::vector<std::string_view> const& payloads, std::string& output) {
+          EvaluateBinaryBatch(payloads, test_data_that_is_empty, decision_log.get(), output);
+        },
+        FLAGS_binary_address);
+  }
+
+  // With `--thread_per_core` or `--io_uring`, the same endpoints are served by the event loops of
+  // `thread_per_core_server.h` instead, one per core unless `--thread_per_core` says otherwise. So they are with
+  // `--codel_target_ms`, as only the event loops know how long each request has queued.
+  bool const admission_control = FLAGS_codel_target_ms > 0;
+  bool const thread_per_core = FLAGS_thread_per_core || FLAGS_io_uring || admission_control;
+  // Normalized, and validated up front. Only a deny, or undefined, as a query that was never evaluated must not pass.
+  std::string shed_decision;
+  if (!FLAGS_shed_decision.empty()) {
+    JSONValue value;
+    try {
+      value = ParseJSONUniversally(FLAGS_shed_decision);
+    } catch (std::exception const&) {
+    }
+    if (!(Exists<JSONNull>(value) || (Exists<JSONBoolean>(value) && !Value<JSONBoolean>(value).boolean))) {
+      std::cerr << "The `--shed_decision` must be `false`, or `null` for undefined." << std::endl;
+      return 1;
+    }
+    shed_decision = AsJSON(value);
+  }
+  std::unique_ptr<ThreadPerCoreHTTPServer> thread_per_core_server;
+  if (FLAGS_p && thread_per_core) {
+    MetricsClock::Calibrate();
+    MetricsClock::SetSamplePeriod(FLAGS_metrics_sample);
+    ThreadPerCoreConfig config;
+    config.threads = FLAGS_thread_per_core;
+    config.pin = FLAGS_pin_threads;
+    config.numa_node = FLAGS_numa_node;
+    config.io_uring = FLAGS_io_uring;
+    config.receive_timestamps = admission_control;
+    thread_per_core_server = std::make_unique<ThreadPerCoreHTTPServer>(
+        FLAGS_p,
+        config,
+        [&test_data_that_is_empty, &decision_log, admission_control, &shed_decision](
+            HTTPServerRequest const& request, HTTPServerResponse& response) {
+          if (request.path == "/metrics") {
+            response.content_type = "text/plain; version=0.0.4";
+            response.body = PrometheusMetrics(decision_log.get());
+            return;
+          }
+          if (request.path == "/profile") {
+            response.content_type = "text/plain";
+            response.body = OPAProfile::Report();
+            return;
+          }
+          if (request.path == "/health") {
+            // The loops serve from before `StartupMetrics::Ready()`, so not `OK` until all the servers are up.
+            response.content_type = "text/plain";
+            if (StartupMetrics::IsReady()) {
+              response.body = "OK\n";
+            } else {
+              response.status = 503;
+              response.body = "Not ready.\n";
+            }
+            return;
+          }
+          bool const batch = request.path.substr(0u, 9u) == "/v1/batch";
+          if (admission_control) {
+            thread_local CoDelAdmission admission(static_cast<uint64_t>(FLAGS_codel_target_ms * 1e6),
+                                                  static_cast<uint64_t>(FLAGS_codel_interval_ms * 1e6));
+            if (!admission.Admit(request.received_ns, request.started_ns)) {
+              MetricsRoute const route = batch ? MetricsRoute::Batch : MetricsRoute::Policy;
+              ServerMetrics::Local().shed[static_cast<size_t>(route)].Add(1u);
+              if (!batch && !shed_decision.empty()) {
+                response.body = "{\"result\":" + shed_decision + '}';
+                // Logged as any other decision, for the valid queries, as the log must account for every one given.
+                if (decision_log) {
+                  thread_local std::string query;
+                  query.assign(request.body.data(), request.body.length());
+                  JSONValue json;
+                  try {
+                    json = ParseJSONUniversally(query);
+                  } catch (std::exception const&) {
+                  }
+                  if (Exists<JSONObject>(json)) {
+                    decision_log->Log(query, shed_decision);
+                  }
+                }
+              } else {
+                response.status = 503;
+                response.content_type = "text/plain";
+                response.body = "Overloaded, retry later.\n";
+              }
+              return;
+            }
+          }
+          thread_local std::string body;  // Reused per loop, as the JSON parsers take `std::string const&`.
+          body.assign(request.body.data(), request.body.length());
+          if (batch) {
+            MetricsRequestScope metrics(MetricsRoute::Batch);
+            size_t invalid = 0u;
+            metrics.BatchQueries(EvaluateNDJSONBatch(
+                body,
+                test_data_that_is_empty,
+                decision_log.get(),
+                [&response](std::string const& chunk) { response.body += chunk; },
+                &invalid));
+            if (invalid) {
+              metrics.Error();
+            }
+          } else if (!EvaluateHTTPQuery(body, test_data_that_is_empty, decision_log.get(), response.body)) {
+            response.status = 400;
+            response.content_type = "text/plain";
+            response.body = "Synopsis: `{\"input\":{...}}`.\n";
+          }
+        });
+    if (FLAGS_io_uring && !thread_per_core_server->UsesIOUring()) {
+      std::cerr << "No io_uring in this kernel, serving via `epoll`." << std::endl;
+    }
+  }
+
   HTTPRoutesScope http_routes;
-  if (FLAGS_p) {
+  if (FLAGS_p && !thread_per_core) {
     auto& http = HTTP(current::net::BarePort(FLAGS_p));
-    http_routes += http.Register("/", URLPathArgs::CountMask::Any, [&test_data_that_is_empty](Request r) {
-      auto const json = ParseJSONUniversally(r.body);
-      if (Exists<JSONObject>(json)) {
-        r("{\"result\":" + AsJSON(policy(Value<JSONObject>(json)["input"], test_data_that_is_empty).pack()) + '}',
-          HTTPResponseCode.OK,
-          current::net::http::Headers(),
-          current::net::constants::kDefaultJSONContentType);
+    MetricsClock::Calibrate();
+    MetricsClock::SetSamplePeriod(FLAGS_metrics_sample);
+    http_routes += http.Register(
+        "/", URLPathArgs::CountMask::Any, [&test_data_that_is_empty, &decision_log](Request r) {
+          std::string body;
+          if (EvaluateHTTPQuery(r.body, test_data_that_is_empty, decision_log.get(), body)) {
+            r(std::move(body),
+              HTTPResponseCode.OK,
+              current::net::http::Headers(),
+              current::net::constants::kDefaultJSONContentType);
+          } else {
+            r("Synopsis: `{\"input\":{...}}`.\n", HTTPResponseCode.BadRequest);
+          }
+        });
+    http_routes += http.Register(
+        "/v1/batch", URLPathArgs::CountMask::Any, [&test_data_that_is_empty, &decision_log](Request r) {
+          MetricsRequestScope metrics(MetricsRoute::Batch);
+          auto response = r.SendChunkedResponse();
+          size_t invalid = 0u;
+          metrics.BatchQueries(EvaluateNDJSONBatch(
+              r.body,
+              test_data_that_is_empty,
+              decision_log.get(),
+              [&response](std::string const& chunk) { response(chunk); },
+              &invalid));
+          if (invalid) {
+            metrics.Error();
+          }
+        });
+    http_routes += http.Register("/metrics", [&decision_log](Request r) {
+      r(PrometheusMetrics(decision_log.get()),
+        HTTPResponseCode.OK,
+        current::net::http::Headers(),
+        "text/plain; version=0.0.4");
+    });
+    http_routes += http.Register("/profile", [](Request r) { r(OPAProfile::Report()); });
+    http_routes += http.Register("/health", [](Request r) {
+      if (StartupMetrics::IsReady()) {
+        r("OK\n");
       } else {
-        r("Synopsis: `{\"input\":{...}}`.\n", HTTPResponseCode.BadRequest);
+        r("Not ready.\n", HTTPResponseCode.ServiceUnavailable);
       }
     });
-    if (FLAGS_d) {
-      http.Join();
-    }
   }
-
-  std::string test_input;
-  while (std::getline(std::cin, test_input)) {
-    std::cout << AsJSON(policy(ParseJSONUniversally(test_input), test_data_that_is_empty).pack()) << std::endl;
+  if (FLAGS_p || unix_socket_server || shm_channel_server || binary_server) {
+    StartupMetrics::Ready();
+  }
+  if (FLAGS_d && FLAGS_p && !thread_per_core) {
+    HTTP(current::net::BarePort(FLAGS_p)).Join();
+  }
+  if (FLAGS_d && thread_per_core_server) {
+    thread_per_core_server->Join();
+  }
+  if (FLAGS_d && unix_socket_server) {
+    unix_socket_server->Join();
+  }
+  if (FLAGS_d && shm_channel_server) {
+    shm_channel_server->Join();
   }
+  if (FLAGS_d && binary_server) {
+    binary_server->Join();
+  }
+
+  OrderedPipelineConfig pipeline;
+  pipeline.threads = FLAGS_threads;
+  pipeline.chunk_bytes = FLAGS_stdin_chunk_bytes;
+  RunOrderedLinePipeline(
+      STDIN_FILENO,
+      STDOUT_FILENO,
+      pipeline,
+      [&test_data_that_is_empty, &decision_log](std::vector<std::string_view> const& lines, std::string& output) {
+        std::string line;
+        std::vector<JSONValue> inputs;
+        std::vector<bool> parsed;
+        std::vector<JSONValue const*> batch;
+        inputs.reserve(lines.size());
+        parsed.reserve(lines.size());
+        for (std::string_view const input : lines) {
+          line.assign(input.data(), input.length());
+          try {
+            inputs.push_back(ParseJSONUniversally(line));
+            parsed.push_back(true);
+          } catch (std::exception const&) {
+            parsed.push_back(false);
+          }
+        }
+        batch.reserve(inputs.size());
+        for (JSONValue const& input : inputs) {
+          batch.push_back(&input);
+        }
+        std::vector<JSONValue> const results = policy_batch(batch, test_data_that_is_empty);
+        size_t i = 0u;
+        for (size_t j = 0u; j < lines.size(); ++j) {
+          if (parsed[j]) {
+            std::string const result = AsJSON(results[i++]);
+            output += result;
+            output += '\n';
+            if (decision_log) {
+              decision_log->Log(lines[j], result);
+            }
+          } else {
+            output += "{\"error\":\"Invalid JSON.\"}\n";
+          }
+        }
+      });
 }
+#endif  // SLEIPNIR_NO_MAIN
@@ -0,0 +1,173 @@
+// A Unix domain socket listener for sidecar deployments, speaking newline-delimited requests and responses.
+//
+// Each request is one line, and each response is one line, in order, so that clients can pipeline freely; the handler
+// must answer every line, empty ones included. A last line with no newline is answered once the client has shut its
+// side of the connection down, and a line longer than `kUnixSocketMaxLineBytes` closes the connection.
+// There is one detached thread per connection, as a sidecar serves a handful of local clients, and only the live ones
+// are tracked, so that the clients coming and going leave nothing behind. The complete lines of each `read()` are
+// handed to the handler at once, and all their responses are sent back with one `send()`.
+
+#ifndef SLEIPNIR_UNIX_SOCKET_SERVER_H
+#define SLEIPNIR_UNIX_SOCKET_SERVER_H
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Writes to a socket, failing rather than raising `SIGPIPE` if the peer has gone, as the servers run with the default
+// disposition of it, which would end the process.
+inline bool WriteAll(int fd, char const* data, size_t length) {
+  while (length) {
+    ssize_t const n = ::send(fd, data, length, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    length -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// As a line is buffered until its newline arrives, this bounds what one client can make the server hold.
+constexpr static size_t kUnixSocketMaxLineBytes = 1u << 20;
+
+inline sockaddr_un UnixSocketAddress(std::string const& path) {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.length() >= sizeof(address.sun_path)) {
+    throw std::invalid_argument("The Unix socket path `" + path + "` is too long.");
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.length());
+  return address;
+}
+
+class UnixSocketLineServer final {
+ public:
+  // Appends the responses to the complete, newline-terminated, request `lines` to `output`, one line per line.
+  using handler_t = std::function<void(std::string const& lines, std::string& output)>;
+
+ private:
+  std::string const path_;
+  handler_t const handler_;
+  int listen_fd_;
+  std::mutex mutex_;
+  std::condition_variable all_closed_;
+  std::unordered_set<int> connections_;  // One per live connection thread.
+  std::thread acceptor_;
+
+  void Serve(int fd) {
+    std::string buffer;
+    std::string lines;
+    std::string output;
+    std::vector<char> chunk(1u << 16);
+    while (true) {
+      ssize_t const n = ::read(fd, chunk.data(), chunk.size());
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        break;
+      }
+      if (n == 0) {
+        if (buffer.empty()) {
+          break;
+        }
+        buffer += '\n';
+      } else {
+        buffer.append(chunk.data(), static_cast<size_t>(n));
+      }
+      size_t const last_newline = buffer.rfind('\n');
+      if (last_newline == std::string::npos) {
+        if (buffer.length() > kUnixSocketMaxLineBytes) {
+          break;
+        }
+        continue;
+      }
+      if (buffer.length() - last_newline - 1u > kUnixSocketMaxLineBytes) {
+        break;
+      }
+      lines.assign(buffer, 0u, last_newline + 1u);
+      buffer.erase(0u, last_newline + 1u);
+      output.clear();
+      handler_(lines, output);
+      if (!WriteAll(fd, output.data(), output.length())) {
+        break;
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.erase(fd);
+    ::close(fd);
+    if (connections_.empty()) {
+      all_closed_.notify_all();
+    }
+  }
+
+ public:
+  UnixSocketLineServer(std::string path, handler_t handler) : path_(std::move(path)), handler_(std::move(handler)) {
+    sockaddr_un const address = UnixSocketAddress(path_);
+    listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+      throw std::runtime_error("Can not create a Unix socket.");
+    }
+    ::unlink(path_.c_str());
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) ||
+        ::listen(listen_fd_, SOMAXCONN)) {
+      ::close(listen_fd_);
+      throw std::runtime_error("Can not listen on `" + path_ + "`: " + std::strerror(errno) + '.');
+    }
+    acceptor_ = std::thread([this]() {
+      while (true) {
+        int const fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+          if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+          }
+          return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections_.insert(fd);
+        std::thread([this, fd]() { Serve(fd); }).detach();
+      }
+    });
+  }
+
+  ~UnixSocketLineServer() {
+    ::shutdown(listen_fd_, SHUT_RDWR);
+    if (acceptor_.joinable()) {
+      acceptor_.join();
+    }
+    ::close(listen_fd_);
+    {
+      // The connection threads are detached, so this waits for the last one of them to be done with `this`.
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (int fd : connections_) {
+        ::shutdown(fd, SHUT_RDWR);
+      }
+      all_closed_.wait(lock, [this]() { return connections_.empty(); });
+    }
+    ::unlink(path_.c_str());
+  }
+
+  UnixSocketLineServer(UnixSocketLineServer const&) = delete;
+  UnixSocketLineServer& operator=(UnixSocketLineServer const&) = delete;
+
+  // Blocks for as long as the listener is up.
+  void Join() { acceptor_.join(); }
+};
+
+#endif  // SLEIPNIR_UNIX_SOCKET_SERVER_H